@@ -1,6 +1,7 @@
 #include <atomic>
 #include <cstring>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 #include <cstring>
@@ -18,7 +19,8 @@ std::atomic<bool> isRunning{true};
 void printUsage() {
   std::cout << "[USAGE] ./nexus -node [ground|satellite] -name <NODE_NAME> -ip "
                "<IP_ADDRESS> -port "
-               "<PORT> -x <X_COORD> -y <Y_COORD>"
+               "<PORT> -x <X_COORD> -y <Y_COORD> [-routing flat|area|geo] "
+               "[-groups <GROUP>[,<GROUP>...]]"
             << std::endl;
 }
 
@@ -27,6 +29,7 @@ void printCommands() {
   std::cout << "[USAGE] message - Send a message.\n";
   std::cout << "[USAGE] file    - Send a file.\n";
   std::cout << "[USAGE] list    - List nodes in the current p2p network.\n";
+  std::cout << "[USAGE] near    - List registered nodes in radio range.\n";
   std::cout << "[USAGE] help    - Display help.\n";
   std::cout << "[USAGE] q       - Quit the application.\n";
 }
@@ -51,9 +54,9 @@ void handleInput(const std::shared_ptr<Node> &node) {
     std::cout << node->getName() << " prompt: ";
     std::cin >> command;
 
-    // Available commands: message, list, file, quit
+    // Available commands: message, list, near, file, quit
     if (command == "message") {
-      std::cout << "Enter target node name: ";
+      std::cout << "Enter target node or anycast group name: ";
       std::cin >> targetName;
 
       // Clear the input buffer before reading the message
@@ -68,7 +71,7 @@ void handleInput(const std::shared_ptr<Node> &node) {
         logger.log(LogLevel::ERROR, "Message cannot be empty.");
       }
     } else if (command == "file") {
-      std::cout << "Enter target node name: ";
+      std::cout << "Enter target node or anycast group name: ";
       std::cin >> targetName;
 
       // Clear the input buffer before reading the message
@@ -85,6 +88,21 @@ void handleInput(const std::shared_ptr<Node> &node) {
       node->sendFile(targetName, message);
     } else if (command == "list") {
       networkManager.listNodes();
+    } else if (command == "near") {
+      // Straight from the registry, so it works before our list is synced
+      std::vector<NodeInfo> nearby;
+      if (!networkManager.findNodesNear(node->getCoords(), GEO_LINK_RANGE,
+                                        nearby)) {
+        logger.log(LogLevel::ERROR, "Registry did not answer the query.");
+        continue;
+      }
+      for (const auto &info : nearby) {
+        logger.log(LogLevel::INFO,
+                   "[NEXUS] " + info.type + " " + info.name + " at " +
+                       info.ip + ":" + std::to_string(info.port) + " [" +
+                       std::to_string(info.coords.first) + ", " +
+                       std::to_string(info.coords.second) + "]");
+      }
     }
     // Handle "q" for quitting
     else if (command == "q") {
@@ -102,7 +120,7 @@ void handleInput(const std::shared_ptr<Node> &node) {
 }
 
 int main(int argc, char **argv) {
-  if (argc != 13) {
+  if (argc < 13 || argc % 2 == 0) {
     printUsage();
     return 1;
   }
@@ -112,6 +130,8 @@ int main(int argc, char **argv) {
   std::string ip;
   int port = 0;
   std::pair<double, double> coords{0.0, 0.0};
+  std::string routingMode = "flat";
+  std::vector<std::string> groups;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-node") == 0) {
@@ -126,6 +146,14 @@ int main(int argc, char **argv) {
       coords.first = std::stod(argv[++i]);
     } else if (strcmp(argv[i], "-y") == 0) {
       coords.second = std::stod(argv[++i]);
+    } else if (strcmp(argv[i], "-routing") == 0) {
+      routingMode = argv[++i];
+    } else if (strcmp(argv[i], "-groups") == 0) {
+      std::stringstream ss(argv[++i]);
+      std::string group;
+      while (std::getline(ss, group, ',')) {
+        groups.push_back(group);
+      }
     } else {
       printUsage();
       return 2;
@@ -142,6 +170,15 @@ int main(int argc, char **argv) {
     return 3;
   }
 
+  RoutingMode::Mode routingModeEnum = RoutingMode::fromString(routingMode);
+  if (routingModeEnum == RoutingMode::UNKNOWN) {
+    logger.log(LogLevel::ERROR, "Invalid routing mode. Must be 'flat', 'area' "
+                                "or 'geo'.");
+    printUsage();
+    return 3;
+  }
+  networkManager.setRoutingMode(routingModeEnum);
+
   std::shared_ptr<Node> node;
   std::thread positionUpdateThread;
 
@@ -166,6 +203,7 @@ int main(int argc, char **argv) {
     });
   }
 
+  node->setGroups(groups);
   networkManager.registerNodeWithRegistry(node);
 
   if (!node->bind()) {
@@ -182,16 +220,37 @@ int main(int argc, char **argv) {
 
   // Move to a function later
   std::thread fetchNodeThread([node]() {
+    auto nextRefresh = std::chrono::steady_clock::now();
     while (isRunning) {
-      logger.log(LogLevel::INFO,
-                 "[NEXUS] Refreshing local network manager every " +
-                     std::to_string(UPDATE_INTERVAL) + " seconds ...");
-      networkManager.fetchNodesFromRegistry();
-      networkManager.updateRoutingTable(node);
-      std::this_thread::sleep_for(std::chrono::seconds(UPDATE_INTERVAL));
+      auto now = std::chrono::steady_clock::now();
+      if (now < nextRefresh) {
+        // Woken early by the registry, so only its changes are taken in;
+        // probing and flooding keep to UPDATE_INTERVAL
+        networkManager.applyRegistryChanges();
+        networkManager.updateRoutingTable(node);
+      } else {
+        logger.log(LogLevel::INFO,
+                   "[NEXUS] Refreshing local network manager every " +
+                       std::to_string(UPDATE_INTERVAL) + " seconds ...");
+        networkManager.renewRegistryLease(node);
+        networkManager.applyRegistryChanges();
+        networkManager.applyLinkState();
+        networkManager.updateRoutingTable(node);
+        node->probeNeighbors();
+        node->advertiseLinkState();
+        nextRefresh = now + std::chrono::seconds(UPDATE_INTERVAL);
+      }
+      // Changes pushed by the registry cut the wait short
+      networkManager.waitForRegistryChanges(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              nextRefresh - std::chrono::steady_clock::now()));
     }
   });
 
+  // Joins, leaves and moves are pushed by the registry instead of polled
+  std::thread registryThread(
+      []() { networkManager.watchRegistry(isRunning); });
+
   handleInput(node);
 
   isRunning = false;
@@ -209,5 +268,9 @@ int main(int argc, char **argv) {
     fetchNodeThread.join();
   }
 
+  if (registryThread.joinable()) {
+    registryThread.join();
+  }
+
   return 0;
 }
\ No newline at end of file
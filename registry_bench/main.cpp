@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <json/json.h>
+
+#include "../src/RegistryProtocol.h"
+
+// Load generator for a running registry_server. Virtual nodes are
+// registered up front, then every connection sends a random mix of
+// requests at Poisson arrival times, whether or not earlier answers came
+// back. Latency counts from when a request was due, not when it went out,
+// so a registry falling behind shows up as queueing rather than as a
+// slower arrival rate. Every run prints one JSON object on stdout.
+
+constexpr double NODE_SPACING = 300;   // Mean distance between neighbors
+constexpr size_t PUBLIC_KEY_SIZE = 450; // About a PEM RSA-2048 key
+constexpr int DRAIN_SECONDS = 5;        // Wait for late answers at the end
+
+enum Op { REGISTER, UPDATE, LIST, KEY, OP_COUNT };
+static const char *OP_NAMES[OP_COUNT] = {"register", "update", "list", "key"};
+
+struct BenchOptions {
+  std::string host = "127.0.0.1";
+  std::string port = "5001";
+  int nodes = 1000;
+  double rate = 10000; // Requests per second over all connections
+  double seconds = 10;
+  unsigned connections = 4;
+  double mix[OP_COUNT] = {1, 90, 1, 8}; // Relative weights
+  bool json = false;
+  unsigned seed = 1;
+};
+
+// One request waiting for its answer
+struct Pending {
+  Op op;
+  std::chrono::steady_clock::time_point due;
+};
+
+struct ConnectionStats {
+  std::vector<uint32_t> latencyUs[OP_COUNT];
+  uint64_t sent = 0;
+  uint64_t errors = 0;
+  bool disconnected = false; // The registry closed or reset the connection
+};
+
+void printUsage() {
+  std::cout << "[USAGE] ./registry_bench [-registry HOST:PORT] [-nodes N] "
+               "[-rate REQ_PER_S] [-seconds S] [-connections C] "
+               "[-mix REGISTER:UPDATE:LIST:KEY] [-protocol binary|json] "
+               "[-seed S]"
+            << std::endl;
+}
+
+static std::vector<std::string> splitList(const std::string &list,
+                                          char separator) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, separator)) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+static int connectTo(const BenchOptions &options) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints,
+                  &result) != 0) {
+    return -1;
+  }
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock >= 0 && connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+    close(sock);
+    sock = -1;
+  }
+  freeaddrinfo(result);
+  if (sock >= 0) {
+    int enable = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  }
+  return sock;
+}
+
+static NodeInfo virtualNode(int index, std::mt19937 &rng, double side) {
+  std::uniform_real_distribution<double> position(0, side);
+  NodeInfo node{};
+  node.type = "Satellite";
+  node.name = "bench" + std::to_string(index);
+  node.ip = "10." + std::to_string((index >> 16) & 0xff) + "." +
+            std::to_string((index >> 8) & 0xff) + "." +
+            std::to_string(index & 0xff);
+  node.port = 5000;
+  node.coords = {position(rng), position(rng)};
+  node.publicKey = std::string(PUBLIC_KEY_SIZE, 'K');
+  return node;
+}
+
+// Serializes requests and parses answers for one connection
+class Client {
+public:
+  explicit Client(const BenchOptions &options)
+      : json(options.json), host(options.host + ":" + options.port) {}
+
+  // Appends the request to out
+  void request(Op op, const NodeInfo &node, std::string &out) {
+    if (json) {
+      Json::Value payload;
+      payload["action"] = op == REGISTER ? "register"
+                          : op == UPDATE ? "update"
+                          : op == LIST   ? "list"
+                                         : "getPublicKey";
+      payload["name"] = node.name;
+      if (op == REGISTER || op == UPDATE) {
+        payload["type"] = node.type;
+        payload["ip"] = node.ip;
+        payload["port"] = node.port;
+        payload["x"] = node.coords.first;
+        payload["y"] = node.coords.second;
+        payload["publicKey"] = node.publicKey;
+      } else if (op == LIST) {
+        payload["epoch"] = Json::UInt64(epoch);
+        payload["since"] = Json::UInt64(version);
+      }
+      std::string body = Json::writeString(writer, payload);
+      out += "POST / HTTP/1.1\r\nHost: " + host +
+             "\r\nContent-Type: application/json\r\nContent-Length: " +
+             std::to_string(body.size()) + "\r\n\r\n" + body;
+      return;
+    }
+
+    WireWriter payload;
+    RegistryOp registryOp = RegistryOp::GET_PUBLIC_KEY;
+    switch (op) {
+    case REGISTER:
+      registryOp = RegistryOp::REGISTER;
+      payload.node(node);
+      break;
+    case UPDATE:
+      registryOp = RegistryOp::MOVE;
+      payload.str(node.name);
+      payload.f64(node.coords.first);
+      payload.f64(node.coords.second);
+      break;
+    case LIST:
+      registryOp = RegistryOp::LIST;
+      payload.u64(epoch);
+      payload.u64(version);
+      payload.u32(0);
+      break;
+    default:
+      payload.str(node.name);
+    }
+    std::string body = payload.release();
+    out += registryFrameHeader(static_cast<uint8_t>(registryOp), body.size());
+    out += body;
+  }
+
+  // Takes the next complete answer off in; false while there is none.
+  // ok tells whether the registry accepted the request.
+  bool answer(Op op, std::string &in, bool &ok) {
+    return json ? httpAnswer(op, in, ok) : frameAnswer(op, in, ok);
+  }
+
+private:
+  bool json;
+  std::string host;
+  Json::StreamWriterBuilder writer;
+  // List position of this connection, so lists are deltas as for a node
+  uint64_t epoch = 0;
+  uint64_t version = 0;
+
+  bool frameAnswer(Op op, std::string &in, bool &ok) {
+    // Not registryFrameSize: answers, such as full lists, may be larger
+    // than the largest request
+    uint32_t length = 0;
+    WireReader header(in.data(), in.size());
+    if (!header.u32(length) || in.size() - 4 < length) {
+      return false;
+    }
+    size_t size = length + 4;
+    RegistryStatus status = static_cast<RegistryStatus>(in[4]);
+    // A public key of a node that was never registered is not an error
+    ok = status == RegistryStatus::OK ||
+         (op == KEY && status == RegistryStatus::NOT_FOUND);
+    if (op == LIST && ok) {
+      WireReader reader(in.data() + REGISTRY_FRAME_HEADER,
+                        size - REGISTRY_FRAME_HEADER);
+      reader.u64(epoch);
+      reader.u64(version);
+    }
+    in.erase(0, size);
+    return true;
+  }
+
+  bool httpAnswer(Op op, std::string &in, bool &ok) {
+    size_t headerEnd = in.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) {
+      return false;
+    }
+    size_t length = 0;
+    size_t field = in.find("Content-Length:");
+    if (field != std::string::npos && field < headerEnd) {
+      length = std::strtoul(in.c_str() + field + 15, nullptr, 10);
+    }
+    if (in.size() < headerEnd + 4 + length) {
+      return false;
+    }
+
+    std::string body = in.substr(headerEnd + 4, length);
+    ok = in.compare(0, 12, "HTTP/1.1 200") == 0 &&
+         (op == KEY || body.find("\"error\"") == std::string::npos);
+    if (op == LIST && ok) {
+      Json::Value root;
+      Json::CharReaderBuilder reader;
+      std::istringstream stream(body);
+      std::string errs;
+      if (Json::parseFromStream(reader, stream, &root, &errs) &&
+          root.isObject()) {
+        epoch = root["epoch"].asUInt64();
+        version = root["version"].asUInt64();
+      }
+    }
+    in.erase(0, headerEnd + 4 + length);
+    return true;
+  }
+};
+
+static bool sendAll(int sock, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(sock, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+// Registers the virtual nodes, pipelined over one connection
+static bool registerNodes(const BenchOptions &options,
+                          const std::vector<NodeInfo> &nodes) {
+  int sock = connectTo(options);
+  if (sock < 0) {
+    return false;
+  }
+  Client client(options);
+  std::string handshake = options.json ? "" : std::string(REGISTRY_MAGIC);
+  bool ok = sendAll(sock, handshake);
+
+  const size_t window = 256;
+  std::string in;
+  size_t answered = 0;
+  for (size_t next = 0; ok && answered < nodes.size();) {
+    std::string out;
+    for (; next < nodes.size() && next - answered < window; next++) {
+      client.request(REGISTER, nodes[next], out);
+    }
+    ok = sendAll(sock, out);
+
+    char buffer[65536];
+    ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      ok = false;
+      break;
+    }
+    in.append(buffer, n);
+    bool accepted = true;
+    while (answered < next && client.answer(REGISTER, in, accepted)) {
+      answered++;
+      ok = ok && accepted;
+    }
+  }
+  close(sock);
+  return ok;
+}
+
+static void runConnection(const BenchOptions &options,
+                          std::vector<NodeInfo> nodes, unsigned index,
+                          std::chrono::steady_clock::time_point start,
+                          ConnectionStats &stats) {
+  int sock = connectTo(options);
+  if (sock < 0) {
+    stats.errors++;
+    return;
+  }
+  Client client(options);
+  std::string out = options.json ? "" : std::string(REGISTRY_MAGIC);
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+  std::mt19937 rng(options.seed * 7919 + index);
+  std::exponential_distribution<double> gap(options.rate /
+                                            options.connections);
+  std::discrete_distribution<int> pickOp(options.mix, options.mix + OP_COUNT);
+  std::uniform_int_distribution<int> pickNode(0, options.nodes - 1);
+  std::normal_distribution<double> drift(0, 1);
+
+  auto end = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::duration<double>(options.seconds));
+  auto due = start;
+  std::deque<Pending> pending;
+  std::string in;
+  bool failed = false;
+
+  while (!failed) {
+    auto now = std::chrono::steady_clock::now();
+    // Every request that fell due, even if the registry is behind
+    while (due <= now && due < end) {
+      Op op = static_cast<Op>(pickOp(rng));
+      NodeInfo &node = nodes[pickNode(rng)];
+      if (op == UPDATE) {
+        node.coords.first += drift(rng);
+        node.coords.second += drift(rng);
+      }
+      client.request(op, node, out);
+      pending.push_back({op, due});
+      stats.sent++;
+      due += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::duration<double>(gap(rng)));
+    }
+    if (now >= end && (pending.empty() ||
+                       now >= end + std::chrono::seconds(DRAIN_SECONDS))) {
+      break;
+    }
+
+    while (!out.empty()) {
+      ssize_t n = send(sock, out.data(), out.size(), 0);
+      if (n <= 0) {
+        failed = n < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+        break;
+      }
+      out.erase(0, n);
+    }
+
+    auto next = due < end ? due : end + std::chrono::seconds(DRAIN_SECONDS);
+    auto wait =
+        std::chrono::duration_cast<std::chrono::milliseconds>(next - now);
+    pollfd fd{sock, static_cast<short>(POLLIN | (out.empty() ? 0 : POLLOUT)),
+              0};
+    if (poll(&fd, 1, std::max<long long>(0, wait.count())) <= 0 ||
+        !(fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+      continue;
+    }
+
+    char buffer[65536];
+    ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      failed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+      continue;
+    }
+    in.append(buffer, n);
+    auto received = std::chrono::steady_clock::now();
+    bool ok = true;
+    while (!pending.empty() && client.answer(pending.front().op, in, ok)) {
+      if (ok) {
+        stats.latencyUs[pending.front().op].push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                received - pending.front().due)
+                .count()));
+      } else {
+        stats.errors++;
+      }
+      pending.pop_front();
+    }
+  }
+
+  // Unanswered requests are failures too. The registry drops connections
+  // with too much input queued, which is how overload usually ends.
+  stats.disconnected = failed;
+  stats.errors += pending.size();
+  close(sock);
+}
+
+static Json::Value percentiles(std::vector<uint32_t> &latencyUs) {
+  Json::Value result;
+  result["count"] = static_cast<Json::UInt64>(latencyUs.size());
+  if (latencyUs.empty()) {
+    return result;
+  }
+  std::sort(latencyUs.begin(), latencyUs.end());
+  auto at = [&latencyUs](double quantile) {
+    size_t index = static_cast<size_t>(quantile * (latencyUs.size() - 1));
+    return latencyUs[index];
+  };
+  result["p50_us"] = at(0.5);
+  result["p99_us"] = at(0.99);
+  result["p999_us"] = at(0.999);
+  result["max_us"] = latencyUs.back();
+  return result;
+}
+
+static Json::Value runBenchmark(const BenchOptions &options) {
+  Json::Value result;
+  result["protocol"] = options.json ? "json" : "binary";
+  result["nodes"] = options.nodes;
+  result["rate"] = options.rate;
+  result["seconds"] = options.seconds;
+  result["connections"] = options.connections;
+
+  std::mt19937 rng(options.seed);
+  double side = std::sqrt(static_cast<double>(options.nodes)) * NODE_SPACING;
+  std::vector<NodeInfo> nodes;
+  nodes.reserve(options.nodes);
+  for (int i = 0; i < options.nodes; i++) {
+    nodes.push_back(virtualNode(i, rng, side));
+  }
+
+  auto started = std::chrono::steady_clock::now();
+  if (!registerNodes(options, nodes)) {
+    result["error"] = "failed to register the virtual nodes";
+    return result;
+  }
+  result["populate_ms"] =
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - started)
+          .count();
+
+  std::vector<ConnectionStats> stats(options.connections);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < options.connections; i++) {
+    threads.emplace_back(runConnection, std::cref(options), nodes, i, start,
+                         std::ref(stats[i]));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  uint64_t sent = 0;
+  uint64_t errors = 0;
+  unsigned disconnects = 0;
+  std::vector<uint32_t> all;
+  Json::Value ops;
+  for (int op = 0; op < OP_COUNT; op++) {
+    std::vector<uint32_t> latencyUs;
+    for (auto &connection : stats) {
+      latencyUs.insert(latencyUs.end(), connection.latencyUs[op].begin(),
+                       connection.latencyUs[op].end());
+    }
+    all.insert(all.end(), latencyUs.begin(), latencyUs.end());
+    if (!latencyUs.empty()) {
+      ops[OP_NAMES[op]] = percentiles(latencyUs);
+    }
+  }
+  for (const auto &connection : stats) {
+    sent += connection.sent;
+    errors += connection.errors;
+    disconnects += connection.disconnected ? 1 : 0;
+  }
+
+  result["sent"] = static_cast<Json::UInt64>(sent);
+  result["errors"] = static_cast<Json::UInt64>(errors);
+  result["disconnects"] = disconnects;
+  result["throughput"] = all.size() / elapsed;
+  result["latency"] = percentiles(all);
+  result["ops"] = ops;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+
+  try {
+    for (int i = 1; i < argc; i++) {
+      if (i + 1 >= argc) {
+        printUsage();
+        return 1;
+      }
+      if (strcmp(argv[i], "-registry") == 0) {
+        std::string address = argv[++i];
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+          printUsage();
+          return 1;
+        }
+        options.host = address.substr(0, colon);
+        options.port = address.substr(colon + 1);
+      } else if (strcmp(argv[i], "-nodes") == 0) {
+        options.nodes = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "-rate") == 0) {
+        options.rate = std::stod(argv[++i]);
+      } else if (strcmp(argv[i], "-seconds") == 0) {
+        options.seconds = std::stod(argv[++i]);
+      } else if (strcmp(argv[i], "-connections") == 0) {
+        options.connections = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "-mix") == 0) {
+        auto weights = splitList(argv[++i], ':');
+        if (weights.size() != OP_COUNT) {
+          printUsage();
+          return 1;
+        }
+        for (int op = 0; op < OP_COUNT; op++) {
+          options.mix[op] = std::stod(weights[op]);
+        }
+      } else if (strcmp(argv[i], "-protocol") == 0) {
+        std::string protocol = argv[++i];
+        if (protocol != "binary" && protocol != "json") {
+          printUsage();
+          return 2;
+        }
+        options.json = protocol == "json";
+      } else if (strcmp(argv[i], "-seed") == 0) {
+        options.seed = std::stoul(argv[++i]);
+      } else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    printUsage();
+    return 1;
+  }
+
+  if (options.rate <= 0 || options.seconds <= 0) {
+    printUsage();
+    return 2;
+  }
+
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  std::cout << Json::writeString(writer, runBenchmark(options)) << std::endl;
+  return 0;
+}
@@ -2,16 +2,25 @@
 #include "../src/NexusRegistryServer.h"
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cout << "Usage: registry_service PORT" << std::endl;
+  if (argc < 2 || argc > 6) {
+    std::cout << "Usage: registry_service PORT [BACKLOG [WORKERS [DATA_DIR "
+                 "[LEASE_SECONDS]]]]"
+              << std::endl;
     return 1;
   }
 
-  logger.setLogLevel(LogLevel::INFO);
+  // Levels were not enforced before, so the registry has always logged
+  // everything; keep it that way
+  logger.setLogLevel(LogLevel::DEBUG);
   logger.log(LogLevel::INFO, "Starting Nexus Registry Server...");
 
-  NexusRegistryServer server(
-      std::stoi(argv[1])); // Port for the registry server
+  int backlog = argc > 2 ? std::stoi(argv[2]) : REGISTRY_DEFAULT_BACKLOG;
+  unsigned workers = argc > 3 ? std::stoul(argv[3]) : 0;
+  std::string dataDirectory = argc > 4 ? argv[4] : ""; // Empty: memory only
+  int leaseSeconds = argc > 5 ? std::stoi(argv[5]) : REGISTRY_LEASE_SECONDS;
+
+  NexusRegistryServer server(std::stoi(argv[1]), // Port for the registry server
+                             backlog, 0, workers, dataDirectory, leaseSeconds);
   server.start();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <json/json.h>
+
+#include "../src/Logger.h"
+#include "../src/NetworkManager.h"
+#include "../src/Node.h"
+#include "../src/NodeType.h"
+
+// Synthetic constellations for timing the routing engine without launching
+// nodes. Every run prints one JSON object per line on stdout.
+
+constexpr double NODE_SPACING = 300;    // Mean distance between neighbors
+constexpr double CLUSTER_SPREAD = 400;  // Std deviation around a cluster
+constexpr int CLUSTER_POPULATION = 100; // Nodes per cluster
+constexpr int GROUND_PERCENT = 5;       // Share of ground stations
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+#define LINK_COST_NAME TO_STRING(NEXUS_LINK_COST_POLICY)
+
+struct BenchOptions {
+  std::vector<std::string> layouts{"uniform", "clustered", "shell"};
+  std::vector<int> sizes{100, 1000, 10000, 100000};
+  RoutingMode::Mode routing = RoutingMode::FLAT;
+  int reps = 3;
+  int lookups = 10000;
+  int allPairsMax = 2000;
+  unsigned threads = 0;
+  size_t matrixBudgetMb = 4096;
+  unsigned seed = 1;
+};
+
+void printUsage() {
+  std::cout << "[USAGE] ./routing_bench [-layout uniform|clustered|shell|all] "
+               "[-nodes N[,N...]] [-routing flat|area|geo] [-reps R] "
+               "[-lookups L] [-allpairs MAX_NODES] [-threads T] "
+               "[-matrix-mb MB] [-seed S]"
+            << std::endl;
+}
+
+static std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+// Positions for n nodes; the side of the plane grows with sqrt(n) so the
+// density, and with it the neighborhood size, stays the same
+static std::vector<std::pair<double, double>>
+generateLayout(const std::string &layout, int n, std::mt19937 &rng) {
+  std::vector<std::pair<double, double>> coords;
+  coords.reserve(n);
+  const double side = std::sqrt(static_cast<double>(n)) * NODE_SPACING;
+  std::uniform_real_distribution<double> uniform(0, side);
+
+  if (layout == "clustered") {
+    int clusters = std::max(1, n / CLUSTER_POPULATION);
+    std::vector<std::pair<double, double>> centers;
+    for (int i = 0; i < clusters; i++) {
+      centers.emplace_back(uniform(rng), uniform(rng));
+    }
+    std::normal_distribution<double> spread(0, CLUSTER_SPREAD);
+    for (int i = 0; i < n; i++) {
+      const auto &center = centers[i % clusters];
+      coords.emplace_back(center.first + spread(rng),
+                          center.second + spread(rng));
+    }
+  } else if (layout == "shell") {
+    // Walker-style shell flattened onto the plane: evenly spaced orbital
+    // planes, each one phase-shifted from the last
+    int planes = std::max(1, static_cast<int>(std::sqrt(n)));
+    int perPlane = (n + planes - 1) / planes;
+    double planeGap = side / planes;
+    double slotGap = side / perPlane;
+    for (int i = 0; i < n; i++) {
+      int plane = i / perPlane;
+      int slot = i % perPlane;
+      double phase = (plane % 2) * slotGap / 2;
+      coords.emplace_back(plane * planeGap, std::fmod(slot * slotGap + phase,
+                                                      side));
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      coords.emplace_back(uniform(rng), uniform(rng));
+    }
+  }
+  return coords;
+}
+
+// Resident set size in KB, the peak on systems without /proc
+static long residentKb() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  long pages = 0, resident = 0;
+  if (statm >> pages >> resident) {
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+#endif
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+template <typename F> static double millisecondsOf(F &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static Json::Value runBenchmark(const BenchOptions &options,
+                                const std::string &layout, int n) {
+  Json::Value result;
+  result["layout"] = layout;
+  result["nodes"] = n;
+  result["routing"] = RoutingMode::toString(options.routing);
+  result["cost_policy"] = LINK_COST_NAME;
+
+  // The flat topology matrix alone is n^2 64-bit weights
+  size_t matrixMb = static_cast<size_t>(n) * n * sizeof(long long) >> 20;
+  if (options.routing == RoutingMode::FLAT &&
+      matrixMb > options.matrixBudgetMb) {
+    result["skipped"] = "topology matrix needs " + std::to_string(matrixMb) +
+                        " MB, over the -matrix-mb budget";
+    return result;
+  }
+
+  std::mt19937 rng(options.seed + n);
+  auto coords = generateLayout(layout, n, rng);
+  long baseKb = residentKb();
+
+  NetworkManager networkManager("http://127.0.0.1:5001");
+  networkManager.setRoutingMode(options.routing);
+  std::vector<std::shared_ptr<Node>> nodes;
+  nodes.reserve(n);
+
+  result["populate_ms"] = millisecondsOf([&]() {
+    for (int i = 0; i < n; i++) {
+      NodeType::Type type = (i % 100 < GROUND_PERCENT) ? NodeType::GROUND
+                                                       : NodeType::SATELLITE;
+      std::string ip = "10." + std::to_string((i >> 16) & 0xff) + "." +
+                       std::to_string((i >> 8) & 0xff) + "." +
+                       std::to_string(i & 0xff);
+      nodes.push_back(std::make_shared<Node>(type, "n" + std::to_string(i),
+                                             ip, 5000, coords[i],
+                                             networkManager));
+      networkManager.addNode(nodes.back());
+    }
+  });
+
+  // Route from a satellite, as the data path would
+  std::shared_ptr<Node> src = nodes[GROUND_PERCENT % n];
+
+  std::vector<LinkEndpoint> endpoints;
+  endpoints.reserve(n);
+  for (const auto &node : nodes) {
+    auto position = node->getCoords();
+    endpoints.push_back({position.first, position.second, node->getType()});
+  }
+
+  // Full matrix build, as flat routing does it on every refresh
+  if (options.routing == RoutingMode::FLAT) {
+    matrix topology;
+    double best = 0;
+    for (int rep = 0; rep < options.reps; rep++) {
+      double ms = millisecondsOf(
+          [&]() { buildTopology<LinkCost>(endpoints, topology); });
+      best = (rep == 0) ? ms : std::min(best, ms);
+    }
+    result["topology_ms"] = best;
+  }
+
+  double bestUpdate = 0;
+  for (int rep = 0; rep < options.reps; rep++) {
+    double ms =
+        millisecondsOf([&]() { networkManager.updateRoutingTable(src); });
+    bestUpdate = (rep == 0) ? ms : std::min(bestUpdate, ms);
+  }
+  result["update_ms"] = bestUpdate;
+  result["rss_kb"] = static_cast<Json::Int64>(residentKb() - baseKb);
+
+  if (options.routing == RoutingMode::FLAT) {
+    int srcIdx = networkManager.getSnapshot()->self;
+    double bestRoute = 0;
+    for (int rep = 0; rep < options.reps; rep++) {
+      double ms = millisecondsOf([&]() { networkManager.route(srcIdx); });
+      bestRoute = (rep == 0) ? ms : std::min(bestRoute, ms);
+    }
+    result["route_ms"] = bestRoute;
+
+    if (n <= options.allPairsMax) {
+      std::vector<std::vector<int>> table;
+      result["all_pairs_ms"] = millisecondsOf(
+          [&]() { networkManager.allPairsNextHops(table, options.threads); });
+    }
+  }
+
+  // Lookups against the published snapshot, as sendMessage would do them
+  std::uniform_int_distribution<int> pick(0, n - 1);
+  std::vector<std::string> targets;
+  for (int i = 0; i < options.lookups; i++) {
+    targets.push_back(nodes[pick(rng)]->getName());
+  }
+  int reachable = 0;
+  std::vector<sockaddr_in> hops;
+  Packet pkt;
+  sockaddr_in nextAddr{};
+  double lookupMs = millisecondsOf([&]() {
+    for (int i = 0; i < targets.size(); i++) {
+      if (options.routing != RoutingMode::GEO) {
+        reachable += networkManager.getSourceRoute(targets[i], hops, i);
+        continue;
+      }
+      // Geographic mode has no routes, only the first forwarding decision
+      auto target = networkManager.findNode(targets[i]);
+      pkt.forwarding = forwardMode::GREEDY;
+      pkt.targetX = static_cast<int32_t>(target->getCoords().first);
+      pkt.targetY = static_cast<int32_t>(target->getCoords().second);
+      reachable += networkManager.getGeographicNextHop(pkt, nullptr, nextAddr);
+    }
+  });
+  result["lookup_ns"] = options.lookups ? lookupMs * 1e6 / options.lookups : 0;
+  result["reachable_percent"] =
+      options.lookups ? 100.0 * reachable / options.lookups : 0;
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+
+  try {
+    for (int i = 1; i < argc; i++) {
+      if (i + 1 >= argc) {
+        printUsage();
+        return 1;
+      }
+      if (strcmp(argv[i], "-layout") == 0) {
+        std::string layout = argv[++i];
+        if (layout != "all") {
+          options.layouts = {layout};
+        }
+      } else if (strcmp(argv[i], "-nodes") == 0) {
+        options.sizes.clear();
+        for (const auto &size : splitList(argv[++i])) {
+          options.sizes.push_back(std::stoi(size));
+        }
+      } else if (strcmp(argv[i], "-routing") == 0) {
+        options.routing = RoutingMode::fromString(argv[++i]);
+      } else if (strcmp(argv[i], "-reps") == 0) {
+        options.reps = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "-lookups") == 0) {
+        options.lookups = std::max(0, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "-allpairs") == 0) {
+        options.allPairsMax = std::stoi(argv[++i]);
+      } else if (strcmp(argv[i], "-threads") == 0) {
+        options.threads = std::stoul(argv[++i]);
+      } else if (strcmp(argv[i], "-matrix-mb") == 0) {
+        options.matrixBudgetMb = std::stoul(argv[++i]);
+      } else if (strcmp(argv[i], "-seed") == 0) {
+        options.seed = std::stoul(argv[++i]);
+      } else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    printUsage();
+    return 1;
+  }
+
+  if (options.routing == RoutingMode::UNKNOWN) {
+    printUsage();
+    return 2;
+  }
+  for (const auto &layout : options.layouts) {
+    if (layout != "uniform" && layout != "clustered" && layout != "shell") {
+      printUsage();
+      return 2;
+    }
+  }
+
+  // Results go to stdout, keep the routing engine's logging out of it
+  logger.setLogLevel(LogLevel::ERROR);
+
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  for (const auto &layout : options.layouts) {
+    for (int n : options.sizes) {
+      if (n < 2) {
+        continue;
+      }
+      std::cout << Json::writeString(writer, runBenchmark(options, layout, n))
+                << std::endl;
+    }
+  }
+  return 0;
+}
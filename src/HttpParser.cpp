@@ -0,0 +1,170 @@
+#include "HttpParser.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+static std::string toLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+  return value;
+}
+
+static std::string trim(const std::string &value) {
+  size_t begin = value.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = value.find_last_not_of(" \t");
+  return value.substr(begin, end - begin + 1);
+}
+
+std::string HttpRequest::header(const std::string &name) const {
+  for (const auto &entry : headers) {
+    if (entry.first == name) {
+      return entry.second;
+    }
+  }
+  return "";
+}
+
+void HttpParser::reset() {
+  state = REQUEST_LINE;
+  current = HttpRequest();
+  remaining = 0;
+  headerBytes = 0;
+}
+
+HttpParser::Result HttpParser::readLine(const std::string &data, size_t &pos,
+                                        std::string &line) {
+  size_t end = data.find("\r\n", pos);
+  if (end == std::string::npos) {
+    // Bound what a client can make us buffer before the body
+    return (data.size() - pos > HTTP_MAX_HEADER_SIZE) ? BAD : NEED_MORE;
+  }
+
+  line = data.substr(pos, end - pos);
+  pos = end + 2;
+  return DONE;
+}
+
+HttpParser::Result HttpParser::startBody() {
+  std::string connection = toLower(current.header("connection"));
+  if (current.version == "HTTP/1.0") {
+    current.keepAlive = connection == "keep-alive";
+  } else {
+    current.keepAlive = connection != "close";
+  }
+
+  if (toLower(current.header("transfer-encoding")).find("chunked") !=
+      std::string::npos) {
+    state = CHUNK_SIZE;
+    return NEED_MORE;
+  }
+
+  std::string length = current.header("content-length");
+  char *end = nullptr;
+  remaining = length.empty() ? 0 : std::strtoul(length.c_str(), &end, 10);
+  if (!length.empty() && *end != '\0') {
+    return BAD;
+  }
+  state = BODY;
+  return NEED_MORE;
+}
+
+HttpParser::Result HttpParser::parse(const std::string &data, size_t &pos) {
+  std::string line;
+
+  while (true) {
+    switch (state) {
+    case REQUEST_LINE:
+    case HEADERS:
+    case TRAILERS: {
+      size_t start = pos;
+      Result result = readLine(data, pos, line);
+      if (result != DONE) {
+        return result;
+      }
+      headerBytes += pos - start;
+      if (headerBytes > HTTP_MAX_HEADER_SIZE) {
+        return BAD;
+      }
+
+      if (state == REQUEST_LINE) {
+        if (line.empty()) {
+          continue; // Tolerate stray CRLFs between pipelined requests
+        }
+        std::istringstream iss(line);
+        if (!(iss >> current.method >> current.target >> current.version) ||
+            current.version.compare(0, 5, "HTTP/") != 0) {
+          return BAD;
+        }
+        state = HEADERS;
+      } else if (!line.empty()) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+          return BAD;
+        }
+        if (state == HEADERS) {
+          current.headers.emplace_back(toLower(trim(line.substr(0, colon))),
+                                       trim(line.substr(colon + 1)));
+        }
+      } else if (state == HEADERS) {
+        Result body = startBody();
+        if (body != NEED_MORE) {
+          return body;
+        }
+      } else {
+        return DONE; // End of the trailers
+      }
+      break;
+    }
+
+    case BODY: {
+      size_t take = std::min(remaining, data.size() - pos);
+      current.body.append(data, pos, take);
+      pos += take;
+      remaining -= take;
+      return remaining == 0 ? DONE : NEED_MORE;
+    }
+
+    case CHUNK_SIZE: {
+      Result result = readLine(data, pos, line);
+      if (result != DONE) {
+        return result;
+      }
+      // Chunk extensions after ';' are ignored
+      char *end = nullptr;
+      remaining = std::strtoul(line.c_str(), &end, 16);
+      if (end == line.c_str()) {
+        return BAD;
+      }
+      state = (remaining == 0) ? TRAILERS : CHUNK_DATA;
+      break;
+    }
+
+    case CHUNK_DATA: {
+      size_t take = std::min(remaining, data.size() - pos);
+      current.body.append(data, pos, take);
+      pos += take;
+      remaining -= take;
+      if (remaining > 0) {
+        return NEED_MORE;
+      }
+      state = CHUNK_END;
+      break;
+    }
+
+    case CHUNK_END: {
+      if (data.size() - pos < 2) {
+        return NEED_MORE;
+      }
+      if (data.compare(pos, 2, "\r\n") != 0) {
+        return BAD;
+      }
+      pos += 2;
+      state = CHUNK_SIZE;
+      break;
+    }
+    }
+  }
+}
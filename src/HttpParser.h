@@ -0,0 +1,56 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr size_t HTTP_MAX_HEADER_SIZE = 64 * 1024; // Request line + headers
+
+struct HttpRequest {
+  std::string method;
+  std::string target;
+  std::string version;
+  std::vector<std::pair<std::string, std::string>> headers; // Lowercase names
+  std::string body;
+  bool keepAlive = true;
+
+  // Value of the first header with that (lowercase) name, empty if absent
+  std::string header(const std::string &name) const;
+};
+
+// Incremental HTTP/1.1 request parser. Data may arrive in any split; the
+// parser keeps its state between calls, so complete lines and body bytes are
+// never parsed twice.
+// Handles Content-Length and chunked bodies.
+class HttpParser {
+public:
+  enum Result { NEED_MORE, DONE, BAD };
+
+  // Parses from data[pos], advancing pos past what was consumed. On DONE
+  // the request is available until reset().
+  Result parse(const std::string &data, size_t &pos);
+  const HttpRequest &request() const { return current; }
+  void reset();
+
+private:
+  enum State {
+    REQUEST_LINE,
+    HEADERS,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_END,
+    TRAILERS
+  };
+
+  State state = REQUEST_LINE;
+  HttpRequest current;
+  size_t remaining = 0;   // Body or chunk bytes still expected
+  size_t headerBytes = 0; // Bytes of request line and headers so far
+
+  Result readLine(const std::string &data, size_t &pos, std::string &line);
+  Result startBody();
+};
+
+#endif // HTTP_PARSER_H
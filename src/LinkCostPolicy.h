@@ -0,0 +1,130 @@
+#ifndef LINK_COST_POLICY_H
+#define LINK_COST_POLICY_H
+
+#include <cmath>
+#include <limits.h>
+#include <vector>
+
+#include "NodeType.h"
+
+using matrix = std::vector<std::vector<long long>>;
+
+// What the weight kernel needs to know about a node, flattened out of Node so
+// the O(N^2) loop stays on contiguous memory.
+struct LinkEndpoint {
+  double x;
+  double y;
+  NodeType::Type type;
+};
+
+// Cost policies plug into buildTopology at compile time. Each one provides a
+// static weight() that the kernel inlines, LONG_LONG_MAX meaning "no link".
+// Ground stations never talk to each other directly under any policy.
+
+inline double linkDistance(const LinkEndpoint &a, const LinkEndpoint &b) {
+  return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+}
+
+// Euclidean distance, +1000 for ground links, quadratic past 500 units.
+struct DistanceCost {
+  static long long weight(const LinkEndpoint &a, const LinkEndpoint &b) {
+    bool aGround = a.type == NodeType::GROUND;
+    bool bGround = b.type == NodeType::GROUND;
+    if (aGround && bGround) {
+      return LONG_LONG_MAX;
+    }
+
+    long long weight = linkDistance(a, b);
+    if (aGround || bGround) {
+      weight += 1000;
+    }
+
+    // Applying a quadratic penalty when exceeding 500 units
+    if (weight > 500) {
+      weight = 500 + (weight - 500) * (weight - 500);
+    }
+    return weight;
+  }
+};
+
+// Fewest relays: every link within radio range costs the same.
+struct HopCountCost {
+  static constexpr double LINK_RANGE = 2000;
+
+  static long long weight(const LinkEndpoint &a, const LinkEndpoint &b) {
+    if (a.type == NodeType::GROUND && b.type == NodeType::GROUND) {
+      return LONG_LONG_MAX;
+    }
+    return linkDistance(a, b) <= LINK_RANGE ? 1 : LONG_LONG_MAX;
+  }
+};
+
+// Propagation delay in microseconds (one unit taken as one km), plus a fixed
+// forwarding delay per hop and extra scheduling delay on ground links.
+struct LatencyCost {
+  static constexpr double MICROS_PER_UNIT = 10.0 / 3;
+  static constexpr long long HOP_DELAY = 500;
+  static constexpr long long GROUND_DELAY = 2000;
+
+  static long long weight(const LinkEndpoint &a, const LinkEndpoint &b) {
+    bool aGround = a.type == NodeType::GROUND;
+    bool bGround = b.type == NodeType::GROUND;
+    if (aGround && bGround) {
+      return LONG_LONG_MAX;
+    }
+
+    long long weight = linkDistance(a, b) * MICROS_PER_UNIT + HOP_DELAY;
+    return (aGround || bGround) ? weight + GROUND_DELAY : weight;
+  }
+};
+
+// Radio energy grows with the square of the distance; satellites also pay
+// a fixed electronics cost per transmission since they run on batteries,
+// whereas ground stations are mains powered.
+struct EnergyCost {
+  static constexpr long long ENERGY_SCALE = 100;
+  static constexpr long long SATELLITE_OVERHEAD = 50;
+
+  static long long weight(const LinkEndpoint &a, const LinkEndpoint &b) {
+    bool aGround = a.type == NodeType::GROUND;
+    bool bGround = b.type == NodeType::GROUND;
+    if (aGround && bGround) {
+      return LONG_LONG_MAX;
+    }
+
+    double distance = linkDistance(a, b);
+    long long weight = distance * distance / ENERGY_SCALE;
+    weight += aGround ? 0 : SATELLITE_OVERHEAD;
+    weight += bGround ? 0 : SATELLITE_OVERHEAD;
+    return weight;
+  }
+};
+
+// Weight kernel: fills the symmetric topology matrix for the given endpoints.
+template <typename CostPolicy>
+void buildTopology(const std::vector<LinkEndpoint> &endpoints,
+                   matrix &topology) {
+  const size_t n = endpoints.size();
+  if (topology.size() != n) {
+    topology.assign(n, std::vector<long long>(n, 0));
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    topology[i][i] = 0;
+    for (size_t j = i + 1; j < n; j++) {
+      long long weight = CostPolicy::weight(endpoints[i], endpoints[j]);
+      topology[i][j] = weight;
+      topology[j][i] = weight;
+    }
+  }
+}
+
+// Policy compiled into the nexus routing engine, picked at build time with
+// -DNEXUS_LINK_COST_POLICY=<policy>.
+#ifndef NEXUS_LINK_COST_POLICY
+#define NEXUS_LINK_COST_POLICY DistanceCost
+#endif
+
+using LinkCost = NEXUS_LINK_COST_POLICY;
+
+#endif // LINK_COST_POLICY_H
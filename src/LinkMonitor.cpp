@@ -0,0 +1,73 @@
+#include "LinkMonitor.h"
+
+#include <algorithm>
+
+uint32_t LinkMonitor::startProbe(const std::string &peer) {
+  std::lock_guard<std::mutex> lock(linksMutex);
+  LinkEstimate &link = links[peer];
+
+  if (link.pending) {
+    link.loss = (1 - LINK_EWMA_ALPHA) * link.loss + LINK_EWMA_ALPHA;
+  }
+
+  link.pending = true;
+  link.pendingSequence = ++nextSequence;
+  return link.pendingSequence;
+}
+
+void LinkMonitor::recordReply(const std::string &peer, uint32_t sequence,
+                              double rttMs) {
+  std::lock_guard<std::mutex> lock(linksMutex);
+  auto it = links.find(peer);
+
+  // Late replies were already counted as lost
+  if (it == links.end() || !it->second.pending ||
+      it->second.pendingSequence != sequence) {
+    return;
+  }
+
+  LinkEstimate &link = it->second;
+  link.pending = false;
+  link.loss = (1 - LINK_EWMA_ALPHA) * link.loss;
+
+  if (link.srttMs == 0) {
+    link.srttMs = rttMs;
+    link.minRttMs = rttMs;
+  } else {
+    link.srttMs = (1 - LINK_EWMA_ALPHA) * link.srttMs + LINK_EWMA_ALPHA * rttMs;
+    link.minRttMs = std::min(link.minRttMs, rttMs);
+  }
+}
+
+std::vector<std::pair<std::string, int>>
+LinkMonitor::congestionFactors(const std::vector<std::string> &peers) const {
+  std::lock_guard<std::mutex> lock(linksMutex);
+  std::vector<std::pair<std::string, int>> factors;
+
+  for (const auto &peer : peers) {
+    auto it = links.find(peer);
+    if (it == links.end()) {
+      continue;
+    }
+
+    const LinkEstimate &link = it->second;
+    if (link.srttMs == 0 && link.loss == 0) {
+      continue; // Nothing measured yet
+    }
+
+    // Queueing shows up as RTT above the propagation floor, and every lost
+    // probe means expected retransmissions on top of that.
+    double factor = 1;
+    if (link.srttMs > 0) {
+      factor = (link.srttMs + LINK_RTT_FLOOR_MS) /
+               (link.minRttMs + LINK_RTT_FLOOR_MS);
+    }
+    double delivery = 1 - link.loss;
+    factor = delivery > 0 ? factor / (delivery * delivery) : LINK_MAX_FACTOR;
+
+    int percent = static_cast<int>(std::min<double>(factor * 100,
+                                                    LINK_MAX_FACTOR));
+    factors.emplace_back(peer, std::max(percent, 100));
+  }
+  return factors;
+}
@@ -0,0 +1,44 @@
+#ifndef LINK_MONITOR_H
+#define LINK_MONITOR_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+constexpr double LINK_EWMA_ALPHA = 0.125; // Weight of the newest sample
+constexpr double LINK_RTT_FLOOR_MS = 1.0; // Jitter below this is ignored
+constexpr int LINK_MAX_FACTOR = 10000;    // Cap for a dead link (percent)
+
+// EWMA round-trip time and loss estimates for the links this node probes.
+// Probes are started by the refresh thread and answered on the receiver
+// thread, so all access is locked.
+class LinkMonitor {
+public:
+  // Starts a probe to peer and returns its sequence number. A probe still
+  // outstanding from the previous round is counted as lost.
+  uint32_t startProbe(const std::string &peer);
+  void recordReply(const std::string &peer, uint32_t sequence, double rttMs);
+
+  // Cost multiplier per peer in percent, 100 for a link running at its best
+  // observed RTT with no loss.
+  std::vector<std::pair<std::string, int>>
+  congestionFactors(const std::vector<std::string> &peers) const;
+
+private:
+  struct LinkEstimate {
+    double srttMs = 0;   // Smoothed RTT, 0 until the first reply
+    double minRttMs = 0; // Best RTT seen, taken as the propagation delay
+    double loss = 0;     // Smoothed loss rate in [0, 1]
+    bool pending = false;
+    uint32_t pendingSequence = 0;
+  };
+
+  std::unordered_map<std::string, LinkEstimate> links;
+  uint32_t nextSequence = 0;
+  mutable std::mutex linksMutex;
+};
+
+#endif // LINK_MONITOR_H
@@ -0,0 +1,134 @@
+#include "LinkState.h"
+#include "LinkMonitor.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+std::string LinkStateAdvertisement::serialize() const {
+  std::ostringstream oss;
+  oss << sequence << " " << static_cast<int>(ttl) << " "
+      << NodeType::toString(type) << " " << name << " " << ip << " " << port
+      << " " << formatToTwoDecimalPlaces(coords.first) << " "
+      << formatToTwoDecimalPlaces(coords.second);
+  for (const auto &link : links) {
+    oss << " " << link.first << ":" << link.second;
+  }
+  for (const auto &group : groups) {
+    oss << " @" << group;
+  }
+  return oss.str();
+}
+
+bool LinkStateAdvertisement::deserialize(const std::string &payload,
+                                         LinkStateAdvertisement &lsa) {
+  std::istringstream iss(payload);
+  std::string typeStr;
+  int ttlValue = 0;
+
+  if (!(iss >> lsa.sequence >> ttlValue >> typeStr >> lsa.name >> lsa.ip >>
+        lsa.port >> lsa.coords.first >> lsa.coords.second)) {
+    return false;
+  }
+  // The TTL is all that bounds a flood, so it is never above our own
+  if (ttlValue < 0 || ttlValue > LSA_MAX_TTL) {
+    return false;
+  }
+
+  lsa.links.clear();
+  lsa.groups.clear();
+  std::string link;
+  while (iss >> link) {
+    if (link[0] == '@') {
+      lsa.groups.push_back(link.substr(1));
+      continue;
+    }
+
+    size_t sep = link.rfind(':');
+    if (sep == std::string::npos) {
+      return false;
+    }
+    int factor;
+    try {
+      factor = std::stoi(link.substr(sep + 1));
+    } catch (const std::exception &e) {
+      return false;
+    }
+    // Anyone can send us this; a factor below 100 would make a link cheaper
+    // than its length and one of 0 or less would break shortest paths
+    lsa.links.emplace_back(link.substr(0, sep),
+                           std::min(std::max(factor, 100), LINK_MAX_FACTOR));
+  }
+
+  lsa.ttl = static_cast<uint8_t>(ttlValue);
+  lsa.type = NodeType::fromString(typeStr);
+  return lsa.type != NodeType::UNKNOWN;
+}
+
+bool LinkStateDatabase::update(const LinkStateAdvertisement &lsa) {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  auto it = lsas.find(lsa.name);
+
+  if (it != lsas.end() && it->second.lsa.sequence >= lsa.sequence) {
+    return false;
+  }
+
+  bool seeded = it != lsas.end() && it->second.seeded;
+  lsas[lsa.name] = Entry{lsa, std::chrono::steady_clock::now(), seeded};
+  return true;
+}
+
+void LinkStateDatabase::seed(const LinkStateAdvertisement &lsa) {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  auto it = lsas.find(lsa.name);
+
+  if (it == lsas.end() || it->second.lsa.sequence == 0) {
+    lsas[lsa.name] = Entry{lsa, std::chrono::steady_clock::now(), true};
+  } else {
+    it->second.seeded = true;
+  }
+}
+
+std::vector<std::string> LinkStateDatabase::seededNames() const {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  std::vector<std::string> result;
+  for (const auto &entry : lsas) {
+    if (entry.second.seeded) {
+      result.push_back(entry.first);
+    }
+  }
+  return result;
+}
+
+std::vector<LinkStateAdvertisement> LinkStateDatabase::entries() const {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  std::vector<LinkStateAdvertisement> result;
+  result.reserve(lsas.size());
+  for (const auto &entry : lsas) {
+    result.push_back(entry.second.lsa);
+  }
+  return result;
+}
+
+std::vector<std::string>
+LinkStateDatabase::expire(std::chrono::seconds maxAge) {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  auto now = std::chrono::steady_clock::now();
+  std::vector<std::string> expired;
+
+  for (auto it = lsas.begin(); it != lsas.end();) {
+    if (!it->second.seeded && now - it->second.receivedAt > maxAge) {
+      expired.push_back(it->first);
+      it = lsas.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return expired;
+}
+
+void LinkStateDatabase::remove(const std::string &name) {
+  std::lock_guard<std::mutex> lock(lsasMutex);
+  lsas.erase(name);
+}
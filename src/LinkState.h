@@ -0,0 +1,68 @@
+#ifndef LINK_STATE_H
+#define LINK_STATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "NodeType.h"
+
+constexpr int LSA_MAX_TTL = 8;  // Hop limit for flooded advertisements
+constexpr int LSA_MAX_AGE = 15; // Seconds before an unrefreshed LSA is dropped
+constexpr int LSA_FANOUT = 6;   // Nearest neighbors an LSA is flooded to
+
+// Advertisement a node floods to its neighbors to announce itself. Link costs
+// are derived from the advertised coordinates, scaled by the congestion the
+// origin measured on its own links.
+struct LinkStateAdvertisement {
+  std::string name;
+  NodeType::Type type;
+  std::string ip;
+  int port;
+  std::pair<double, double> coords;
+  uint32_t sequence;
+  uint8_t ttl;
+  // Measured cost multiplier (percent) per neighbor name
+  std::vector<std::pair<std::string, int>> links;
+  std::vector<std::string> groups; // Anycast groups the origin answers for
+
+  // Payload format:
+  //   sequence ttl type name ip port x y [neighbor:factor]... [@group]...
+  std::string serialize() const;
+  static bool deserialize(const std::string &payload,
+                          LinkStateAdvertisement &lsa);
+};
+
+// Latest advertisement heard from each origin. Written by the receiver
+// thread and drained by the refresh thread, so all access is locked.
+class LinkStateDatabase {
+public:
+  // Returns true if the advertisement is newer than the one held for its
+  // origin, i.e. it was stored and should be flooded further.
+  bool update(const LinkStateAdvertisement &lsa);
+  // Stores a sequence 0 entry for a node the registry knows of. It never
+  // expires, only remove drops it, and it only replaces an entry that was
+  // seeded too, as flooded advertisements are newer.
+  void seed(const LinkStateAdvertisement &lsa);
+  std::vector<std::string> seededNames() const;
+  std::vector<LinkStateAdvertisement> entries() const;
+  // Drops advertisements older than maxAge and returns their origins.
+  // Seeded origins are kept however old.
+  std::vector<std::string> expire(std::chrono::seconds maxAge);
+  void remove(const std::string &name);
+
+private:
+  struct Entry {
+    LinkStateAdvertisement lsa;
+    std::chrono::steady_clock::time_point receivedAt;
+    bool seeded;
+  };
+
+  std::unordered_map<std::string, Entry> lsas;
+  mutable std::mutex lsasMutex;
+};
+
+#endif // LINK_STATE_H
@@ -38,6 +38,9 @@ public:
 
   void log(LogLevel level, const std::string &message) {
     std::lock_guard<std::mutex> lock(mutex);
+    if (level < minLogLevel) {
+      return;
+    }
     std::string logMessage = " [" + logLevelToString(level) + "] " + message;
 
     if (logFile.is_open()) {
@@ -82,7 +85,7 @@ private:
 
   std::ofstream logFile;
   std::mutex mutex;
-  LogLevel minLogLevel;
+  LogLevel minLogLevel = LogLevel::DEBUG;
 
   static std::string logLevelToString(LogLevel level) {
     static const std::unordered_map<LogLevel, std::string> levelToString = {
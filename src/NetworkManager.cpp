@@ -1,15 +1,39 @@
 #include "NetworkManager.h"
 
+#include <arpa/inet.h>
 #include <curl/curl.h> // Requires libcurl
 #include <json/json.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <queue>
+#include <thread>
+#include <unordered_set>
 
+#include "LinkMonitor.h"
 #include "Logger.h"
 #include "Node.h"
 
 NetworkManager::NetworkManager(const std::string &registryAddress)
-    : registryAddress(registryAddress) {}
+    : snapshot(std::make_shared<RoutingSnapshot>()),
+      registryAddress(registryAddress) {
+  // host:port for the binary protocol, from http://host:port[/path]
+  std::string hostPort = registryAddress;
+  size_t scheme = hostPort.find("://");
+  if (scheme != std::string::npos) {
+    hostPort.erase(0, scheme + 3);
+  }
+  hostPort = hostPort.substr(0, hostPort.find('/'));
+  size_t colon = hostPort.rfind(':');
+  registryHost = hostPort.substr(0, colon);
+  registryPort = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+}
 
 // Helper: Check if a node exists in the list
 bool NetworkManager::nodeExists(const std::shared_ptr<Node> &node) const {
@@ -31,13 +55,32 @@ static size_t WriteCallback(void *contents, size_t size, size_t nmemb,
   return 0;
 }
 
+// One handle per thread, so its connection to the registry is kept alive
+// across requests instead of reconnecting every time
+static CURL *registryHandle() {
+  struct Handle {
+    CURL *curl = curl_easy_init();
+    ~Handle() {
+      if (curl)
+        curl_easy_cleanup(curl);
+    }
+  };
+  thread_local Handle handle;
+
+  if (handle.curl) {
+    curl_easy_reset(handle.curl); // Keeps the open connection
+  }
+  return handle.curl;
+}
+
 // Helper: Perform CURL requests
 bool NetworkManager::performCurlRequest(const std::string &url,
                                         const std::string &payload,
-                                        std::string &response) {
+                                        std::string &response,
+                                        long timeoutSeconds) {
   logger.log(LogLevel::DEBUG,
              "[NEXUS] Performing request to NexusRegistryServer ...");
-  CURL *curl = curl_easy_init();
+  CURL *curl = registryHandle();
   if (!curl) {
     logger.log(LogLevel::ERROR, "Failed to initialize CURL.");
     return false;
@@ -47,7 +90,6 @@ bool NetworkManager::performCurlRequest(const std::string &url,
       curl_slist_append(nullptr, "Content-Type: application/json");
   if (!headers) {
     logger.log(LogLevel::ERROR, "Failed to set CURL headers.");
-    curl_easy_cleanup(curl);
     return false;
   }
 
@@ -56,12 +98,13 @@ bool NetworkManager::performCurlRequest(const std::string &url,
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);       // Set timeout
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeoutSeconds); // Set timeout
   curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L); // Set connection timeout
+  // Offers every encoding curl can decode, so large lists come compressed
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
   CURLcode res = curl_easy_perform(curl);
   curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
 
   if (res != CURLE_OK) {
     logger.log(LogLevel::ERROR, "Failed to send CURL request: " +
@@ -80,11 +123,137 @@ bool NetworkManager::performCurlRequest(const std::string &url,
   return true;
 }
 
+// Binary protocol connection to the registry, one per thread like the curl
+// handle and kept open between requests
+static int &registrySocket() {
+  struct Socket {
+    int fd = -1;
+    ~Socket() {
+      if (fd >= 0)
+        close(fd);
+    }
+  };
+  thread_local Socket socket;
+  return socket.fd;
+}
+
+static int connectTo(const std::string &host, const std::string &port) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+    return -1;
+  }
+
+  int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+
+  if (fd >= 0) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+static bool sendAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+static bool receiveAll(int fd, char *data, size_t size) {
+  size_t received = 0;
+  while (received < size) {
+    ssize_t n = recv(fd, data + received, size - received, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    received += n;
+  }
+  return true;
+}
+
+bool NetworkManager::registryCall(RegistryOp op, const std::string &payload,
+                                  RegistryStatus &status, std::string &reply,
+                                  int timeoutSeconds) const {
+  if (!binaryRegistry) {
+    return false;
+  }
+
+  std::string request =
+      registryFrameHeader(static_cast<uint8_t>(op), payload.size()) + payload;
+  int &fd = registrySocket();
+
+  // A kept connection may have been closed by the registry meanwhile, so
+  // a failure on it is retried once on a new one
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool fresh = fd < 0;
+    if (fresh) {
+      fd = connectTo(registryHost, registryPort);
+      if (fd < 0) {
+        return false;
+      }
+    }
+
+    timeval timeout{timeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char header[REGISTRY_FRAME_HEADER];
+    if (sendAll(fd, fresh ? REGISTRY_MAGIC + request : request) &&
+        receiveAll(fd, header, sizeof(header))) {
+      if (std::string(header, 4) == "HTTP") {
+        logger.log(LogLevel::INFO, "[NEXUS] Registry only speaks JSON, "
+                                   "using it from now on.");
+        binaryRegistry = false;
+        close(fd);
+        fd = -1;
+        return false;
+      }
+
+      uint32_t length;
+      std::memcpy(&length, header, sizeof(length));
+      length = ntohl(length);
+      if (length >= 1 && length <= REGISTRY_MAX_FRAME) {
+        reply.resize(length - 1);
+        if (receiveAll(fd, &reply[0], reply.size())) {
+          status = static_cast<RegistryStatus>(header[4]);
+          return true;
+        }
+      }
+    }
+
+    close(fd);
+    fd = -1;
+    if (fresh) {
+      break;
+    }
+  }
+  return false;
+}
+
 void NetworkManager::addNode(const std::shared_ptr<Node> &node) {
   if (nodeExists(node)) {
     for (auto &existingNode : nodes) {
       if (existingNode->getName() == node->getName()) {
-        existingNode->setCoords(node->getCoords());
+        // Published snapshots may still hold the old node, so it is
+        // replaced rather than moved in place
+        existingNode = node;
         return;
       }
     }
@@ -112,6 +281,8 @@ void NetworkManager::removeNode(const std::string &id) {
 }
 
 void NetworkManager::listNodes() const {
+  auto snap = getSnapshot();
+  const auto &nodes = snap->nodes;
   if (nodes.empty()) {
     logger.log(LogLevel::INFO,
                "[NEXUS] No nodes are currently registered in the network.");
@@ -132,17 +303,55 @@ void NetworkManager::listNodes() const {
 }
 
 std::shared_ptr<Node> NetworkManager::findNode(const std::string &name) const {
-  for (auto &node : nodes) {
-    if (node->getName() == name) {
-      return node;
+  auto snap = getSnapshot();
+  int idx = snap->indexOf(name);
+  return idx < 0 ? nullptr : snap->nodes[idx];
+}
+
+std::shared_ptr<Node> NetworkManager::findNode(const sockaddr_in &addr) const {
+  auto snap = getSnapshot();
+  int idx = snap->indexOf(addr);
+  return idx < 0 ? nullptr : snap->nodes[idx];
+}
+
+std::shared_ptr<Node>
+NetworkManager::resolveTarget(const std::string &name) const {
+  auto snap = getSnapshot();
+  int idx = snap->indexOf(name);
+  if (idx >= 0) {
+    return snap->nodes[idx];
+  }
+
+  auto group = snap->groups.find(name);
+  if (group == snap->groups.end() || snap->self < 0) {
+    return nullptr;
+  }
+
+  const auto &own = snap->coords[snap->self];
+  auto distanceTo = [&](int idx) {
+    return std::hypot(snap->coords[idx].first - own.first,
+                      snap->coords[idx].second - own.second);
+  };
+
+  // Cheapest path wins; without one (e.g. geographic routing) the nearest
+  int best = -1;
+  for (int member : group->second) {
+    if (member == snap->self) {
+      continue;
+    }
+    if (best == -1 || snap->cost[member] < snap->cost[best] ||
+        (snap->cost[member] == snap->cost[best] &&
+         distanceTo(member) < distanceTo(best))) {
+      best = member;
     }
   }
-  return nullptr;
+  return best == -1 ? nullptr : snap->nodes[best];
 }
 
 std::vector<std::shared_ptr<Node>> NetworkManager::getSatelliteNodes() const {
+  auto snap = getSnapshot();
   std::vector<std::shared_ptr<Node>> satellites;
-  for (const std::shared_ptr<Node> &node : nodes) {
+  for (const std::shared_ptr<Node> &node : snap->nodes) {
     if (node->getType() == NodeType::SATELLITE) {
       satellites.push_back(node);
     }
@@ -154,6 +363,14 @@ bool NetworkManager::registerNodeWithRegistry(
     const std::shared_ptr<Node> &node) {
   logger.log(LogLevel::DEBUG,
              "[NEXUS] Registering node at NexusRegistryServer ...");
+  WireWriter out;
+  out.node(nodeInfoOf(node));
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(RegistryOp::REGISTER, out.release(), status, reply)) {
+    return status == RegistryStatus::OK;
+  }
+
   Json::Value payload = createNodePayload("register", node);
   std::string url = registryAddress + "/register";
   std::string response;
@@ -164,6 +381,14 @@ void NetworkManager::deregisterNodeWithRegistry(
     const std::shared_ptr<Node> &node) {
   logger.log(LogLevel::DEBUG,
              "[NEXUS] Deregistering node at NexusRegistryServer ...");
+  WireWriter out;
+  out.str(node->getName());
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(RegistryOp::DEREGISTER, out.release(), status, reply)) {
+    return;
+  }
+
   Json::Value payload = createNodePayload("deregister", node);
   std::string url = registryAddress + "/deregister";
   std::string response;
@@ -183,20 +408,216 @@ NetworkManager::createNodePayload(const std::string &action,
   payload["x"] = coords.first;
   payload["y"] = coords.second;
   payload["publicKey"] = node->getPublicKey();
+  for (const auto &group : node->getGroups()) {
+    payload["groups"].append(group);
+  }
   return payload;
 }
 
 bool NetworkManager::updateNodeInRegistry(
     const std::shared_ptr<Node> &node) const {
-  // logger.log(LogLevel::DEBUG,
-  //            "[NEXUS] Updating node at NexusRegistryServer ...");
+  {
+    std::lock_guard<std::mutex> lock(updatesMutex);
+    queuedUpdates[node->getName()] = node;
+    if (sendingUpdates) {
+      return true;
+    }
+    sendingUpdates = true;
+  }
+
+  bool sent = true;
+  while (true) {
+    std::vector<std::shared_ptr<Node>> batch;
+    {
+      std::lock_guard<std::mutex> lock(updatesMutex);
+      if (queuedUpdates.empty()) {
+        sendingUpdates = false;
+        break;
+      }
+      while (!queuedUpdates.empty() && batch.size() < REGISTRY_MAX_BATCH) {
+        batch.push_back(queuedUpdates.begin()->second);
+        queuedUpdates.erase(queuedUpdates.begin());
+      }
+    }
+    sent = sendNodeUpdates(batch) && sent;
+  }
+  return sent;
+}
+
+bool NetworkManager::sendNodeUpdates(
+    const std::vector<std::shared_ptr<Node>> &batch) const {
+  if (batch.size() > 1 && binaryRegistry && batchRegistry) {
+    WireWriter out;
+    out.u32(static_cast<uint32_t>(batch.size()));
+    for (const auto &node : batch) {
+      WireWriter move;
+      move.str(node->getName());
+      auto coords = node->getCoords();
+      move.f64(coords.first);
+      move.f64(coords.second);
+      std::string payload = move.release();
+      out.u8(static_cast<uint8_t>(RegistryOp::MOVE));
+      out.u32(static_cast<uint32_t>(payload.size()));
+      out.bytes(payload);
+    }
+    RegistryStatus status;
+    std::string reply;
+    if (registryCall(RegistryOp::BATCH, out.release(), status, reply)) {
+      if (status == RegistryStatus::OK) {
+        return true;
+      }
+      batchRegistry = false; // Registry predates batches
+    }
+  }
+
+  bool sent = true;
+  for (const auto &node : batch) {
+    sent = sendNodeUpdate(node) && sent;
+  }
+  return sent;
+}
+
+bool NetworkManager::sendNodeUpdate(const std::shared_ptr<Node> &node) const {
+  // Only the position changes, so that is all the binary update carries
+  WireWriter out;
+  out.str(node->getName());
+  auto coords = node->getCoords();
+  out.f64(coords.first);
+  out.f64(coords.second);
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(RegistryOp::MOVE, out.release(), status, reply)) {
+    return status == RegistryStatus::OK;
+  }
+
   Json::Value payload = createNodePayload("update", node);
   std::string url = registryAddress + "/update";
   std::string response;
   return performCurlRequest(url, payload.toStyledString(), response);
 }
 
+void NetworkManager::renewRegistryLease(const std::shared_ptr<Node> &node) {
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastLeaseRenewal < std::chrono::seconds(REGISTRY_RENEW_SECONDS)) {
+    return;
+  }
+  lastLeaseRenewal = now;
+
+  bool expired = false;
+  WireWriter out;
+  out.str(node->getName());
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(RegistryOp::RENEW, out.release(), status, reply)) {
+    // Registries without leases answer BAD_REQUEST and never expire us
+    expired = status == RegistryStatus::NOT_FOUND;
+  } else {
+    Json::Value payload;
+    payload["action"] = "renew";
+    payload["name"] = node->getName();
+    std::string response;
+    expired = performCurlRequest(registryAddress + "/renew",
+                                 payload.toStyledString(), response) &&
+              response.find("Node not found") != std::string::npos;
+  }
+
+  if (expired) {
+    logger.log(LogLevel::WARNING,
+               "[NEXUS] Registry lease ran out, registering again ...");
+    registerNodeWithRegistry(node);
+  }
+}
+
+bool NetworkManager::findNodesNear(const std::pair<double, double> &center,
+                                   double radius,
+                                   std::vector<NodeInfo> &result) const {
+  WireWriter out;
+  out.f64(center.first);
+  out.f64(center.second);
+  out.f64(radius);
+  Json::Value request;
+  request["action"] = "near";
+  request["x"] = center.first;
+  request["y"] = center.second;
+  request["radius"] = radius;
+  return queryRegistryNodes(RegistryOp::NEAR, out.release(), request, result);
+}
+
+bool NetworkManager::findNearestNodes(const std::pair<double, double> &center,
+                                      uint32_t k,
+                                      std::vector<NodeInfo> &result) const {
+  WireWriter out;
+  out.f64(center.first);
+  out.f64(center.second);
+  out.u32(k);
+  Json::Value request;
+  request["action"] = "nearest";
+  request["x"] = center.first;
+  request["y"] = center.second;
+  request["k"] = k;
+  return queryRegistryNodes(RegistryOp::NEAREST, out.release(), request,
+                            result);
+}
+
+bool NetworkManager::queryRegistryNodes(RegistryOp op,
+                                        const std::string &payload,
+                                        const Json::Value &request,
+                                        std::vector<NodeInfo> &result) const {
+  result.clear();
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(op, payload, status, reply)) {
+    WireReader in(reply.data(), reply.size());
+    uint32_t count = 0;
+    if (status != RegistryStatus::OK || !in.u32(count)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+      NodeInfo info{};
+      if (in.node(info)) {
+        result.push_back(std::move(info));
+      }
+    }
+    return in.ok() && in.done();
+  }
+
+  std::string response;
+  if (!performCurlRequest(registryAddress, request.toStyledString(),
+                          response)) {
+    return false;
+  }
+  Json::Value root;
+  Json::CharReaderBuilder reader;
+  std::istringstream responseStream(response);
+  std::string errs;
+  // Registries without spatial queries answer with an error object
+  if (!Json::parseFromStream(reader, responseStream, &root, &errs) ||
+      !root.isArray()) {
+    return false;
+  }
+  for (const auto &nodeJson : root) {
+    NodeInfo info{};
+    if (nodeJson.isObject() && parseNodeInfo(nodeJson, info)) {
+      result.push_back(std::move(info));
+    }
+  }
+  return true;
+}
+
 std::string NetworkManager::getNodePublicKey(const std::string &nodeName) {
+  WireWriter out;
+  out.str(nodeName);
+  RegistryStatus status;
+  std::string reply;
+  if (registryCall(RegistryOp::GET_PUBLIC_KEY, out.release(), status, reply)) {
+    std::string key;
+    WireReader in(reply.data(), reply.size());
+    if (status != RegistryStatus::OK || !in.str(key)) {
+      throw std::runtime_error("No public key found for node: " + nodeName);
+    }
+    return key;
+  }
+
   Json::Value payload;
   payload["action"] = "getPublicKey";
   payload["name"] = nodeName;
@@ -225,167 +646,953 @@ std::string NetworkManager::getNodePublicKey(const std::string &nodeName) {
   return jsonResponse["publicKey"].asString();
 }
 
-void NetworkManager::fetchNodesFromRegistry() {
+void NetworkManager::watchRegistry(const std::atomic<bool> &running) {
+  while (running) {
+    if (!pollRegistry(REGISTRY_WATCH_MS)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(REGISTRY_RETRY_MS));
+    }
+  }
+}
+
+// Asks for what changed since the last poll, letting the registry hold the
+// request up to waitMs until something does. Returns false if the poll
+// failed or the registry can not hold it.
+bool NetworkManager::pollRegistry(int waitMs) {
+  WireWriter out;
+  out.u64(registryEpoch);
+  out.u64(registryVersion);
+  out.u32(static_cast<uint32_t>(waitMs));
+  RegistryStatus status;
+  std::string reply;
+  NodeChanges changes;
+  bool delta = true;
+
+  if (registryCall(RegistryOp::LIST, out.release(), status, reply,
+                   waitMs / 1000 + 10)) {
+    WireReader in(reply.data(), reply.size());
+    if (status != RegistryStatus::OK || !in.changes(changes)) {
+      logger.log(LogLevel::ERROR, "Failed to parse node list.");
+      return false;
+    }
+  } else if (binaryRegistry) {
+    return false;
+  } else {
+    changes.epoch = registryEpoch;
+    changes.version = registryVersion;
+    delta = pollRegistryJson(waitMs, changes);
+  }
+
+  registryEpoch = changes.epoch;
+  registryVersion = changes.version;
+  if (!changes.nodes.empty() || !changes.removed.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      pendingChanges.push_back(std::move(changes));
+    }
+    pendingReady.notify_one();
+  }
+  return delta;
+}
+
+// The same over JSON. Returns false if the poll failed or the registry
+// answered with a plain node list, i.e. has no delta sync.
+bool NetworkManager::pollRegistryJson(int waitMs, NodeChanges &changes) {
   Json::Value payload;
   payload["action"] = "list";
+  payload["epoch"] = Json::UInt64(registryEpoch);
+  payload["since"] = Json::UInt64(registryVersion);
+  if (waitMs > 0) {
+    payload["wait"] = waitMs;
+  }
   std::string response;
-  performCurlRequest(registryAddress, payload.toStyledString(), response);
+  if (!performCurlRequest(registryAddress, payload.toStyledString(), response,
+                          waitMs / 1000 + 10)) {
+    return false;
+  }
 
-  Json::Value nodeListJson;
+  Json::Value root;
   Json::CharReaderBuilder reader;
   std::istringstream responseStream(response);
   std::string errs;
 
-  if (!Json::parseFromStream(reader, responseStream, &nodeListJson, &errs)) {
+  if (!Json::parseFromStream(reader, responseStream, &root, &errs)) {
     logger.log(LogLevel::ERROR, "Failed to parse node list: " + errs);
-    return;
+    return false;
   }
 
-  if (!nodeListJson.isArray()) {
+  // Registries without delta sync answer with the plain node list
+  bool delta = root.isObject();
+  const Json::Value &nodeList = delta ? root["nodes"] : root;
+  if (!nodeList.isArray()) {
     logger.log(LogLevel::ERROR,
                "Unexpected response format: Expected an array.");
-    return;
+    return false;
   }
 
-  for (const auto &nodeJson : nodeListJson) {
+  for (const auto &nodeJson : nodeList) {
+    NodeInfo info{};
     if (!nodeJson.isObject()) {
       logger.log(LogLevel::ERROR, "Malformed node entry in response.");
-      continue;
+    } else if (parseNodeInfo(nodeJson, info)) {
+      changes.nodes.push_back(std::move(info));
     }
+  }
+  if (delta) {
+    for (const auto &name : root["removed"]) {
+      changes.removed.push_back(name.asString());
+    }
+    changes.epoch = root["epoch"].asUInt64();
+    changes.version = root["version"].asUInt64();
+    changes.full = root["full"].asBool();
+  }
+  return delta;
+}
+
+void NetworkManager::applyRegistryChanges() {
+  std::vector<NodeChanges> changes;
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    changes.swap(pendingChanges);
+  }
 
-    auto node = parseNodeFromJson(nodeJson);
-    if (node) {
-      addNode(node);
+  for (const auto &delta : changes) {
+    // A full list carries no removals, so registry nodes missing from it
+    // left in between
+    if (delta.full) {
+      std::unordered_set<std::string> listed;
+      for (const auto &info : delta.nodes) {
+        listed.insert(info.name);
+      }
+      for (const auto &name : lsdb.seededNames()) {
+        if (listed.count(name) == 0) {
+          forgetNode(name);
+        }
+      }
+    }
+    for (const auto &info : delta.nodes) {
+      learnNode(info);
+    }
+    for (const auto &name : delta.removed) {
+      forgetNode(name);
     }
   }
 }
 
-std::shared_ptr<Node>
-NetworkManager::parseNodeFromJson(const Json::Value &nodeJson) const {
+void NetworkManager::waitForRegistryChanges(std::chrono::milliseconds timeout) {
+  {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    if (!pendingReady.wait_for(lock, timeout,
+                               [this]() { return !pendingChanges.empty(); })) {
+      return;
+    }
+  }
+  // Let the rest of a burst of joins or moves arrive with it
+  std::this_thread::sleep_for(std::chrono::milliseconds(REGISTRY_SETTLE_MS));
+}
+
+void NetworkManager::learnNode(const NodeInfo &info) {
+  auto node = makeNode(info);
+  if (node) {
+    addNode(node);
+    // Flooding may never reach us from far away nodes, so registry nodes
+    // stay until the registry drops them
+    LinkStateAdvertisement seed{node->getName(), node->getType(),
+                                node->getIP(),   node->getPort(),
+                                node->getCoords(), 0, 0};
+    seed.groups = node->getGroups();
+    lsdb.seed(seed);
+  }
+}
+
+void NetworkManager::forgetNode(const std::string &name) {
+  lsdb.remove(name);
+  for (const auto &node : nodes) {
+    if (node->getName() == name) {
+      removeNode(node->getId());
+      break;
+    }
+  }
+}
+
+bool NetworkManager::handleLinkState(const LinkStateAdvertisement &lsa) const {
+  return lsdb.update(lsa);
+}
+
+void NetworkManager::applyLinkState() {
+  for (const auto &name : lsdb.expire(std::chrono::seconds(LSA_MAX_AGE))) {
+    for (const auto &node : nodes) {
+      if (node->getName() == name) {
+        logger.log(LogLevel::INFO, "[NEXUS] Link state of " + name +
+                                       " expired, dropping node.");
+        removeNode(node->getId());
+        break;
+      }
+    }
+  }
+
+  std::unordered_map<std::string, int> index;
+  for (int i = 0; i < nodes.size(); i++) {
+    index.emplace(nodes[i]->getName(), i);
+  }
+
+  linkStates = lsdb.entries();
+  for (const auto &lsa : linkStates) {
+    auto it = index.find(lsa.name);
+    if (it != index.end()) {
+      std::shared_ptr<Node> &node = nodes[it->second];
+      if (node->getCoords() != lsa.coords || node->getGroups() != lsa.groups) {
+        node = copyNode(node, lsa.coords, lsa.groups);
+      }
+      continue;
+    }
+
+    auto node = std::make_shared<Node>(lsa.type, lsa.name, lsa.ip, lsa.port,
+                                       lsa.coords, *this);
+    node->setGroups(lsa.groups);
+    addNode(node);
+  }
+}
+
+std::vector<std::pair<std::string, sockaddr_in>>
+NetworkManager::getNeighborLinks() const {
+  auto snap = getSnapshot();
+  std::vector<std::pair<std::string, sockaddr_in>> result;
+  result.reserve(snap->neighbors.size());
+  for (int idx : snap->neighbors) {
+    result.emplace_back(snap->nodes[idx]->getName(), snap->addrs[idx]);
+  }
+  return result;
+}
+
+bool NetworkManager::parseNodeInfo(const Json::Value &nodeJson,
+                                   NodeInfo &info) {
   if (!nodeJson.isMember("name") || !nodeJson.isMember("ip") ||
       !nodeJson.isMember("port")) {
     logger.log(LogLevel::ERROR, "Missing required fields in node JSON.");
-    return nullptr;
+    return false;
   }
 
-  double x = nodeJson.get("x", 0.0).asDouble();
-  double y = nodeJson.get("y", 0.0).asDouble();
-  NodeType::Type type = NodeType::fromString(nodeJson["type"].asString());
+  info.type = nodeJson["type"].asString();
+  info.name = nodeJson["name"].asString();
+  info.ip = nodeJson["ip"].asString();
+  info.port = nodeJson["port"].asInt();
+  info.coords = {nodeJson.get("x", 0.0).asDouble(),
+                 nodeJson.get("y", 0.0).asDouble()};
+  info.publicKey = nodeJson["publicKey"].asString();
+  info.groups.clear();
+  if (nodeJson["groups"].isArray()) {
+    for (const auto &group : nodeJson["groups"]) {
+      info.groups.push_back(group.asString());
+    }
+  }
+  return true;
+}
 
-  std::shared_ptr<Node> node = std::make_shared<Node>(
-      type, nodeJson["name"].asString(), nodeJson["ip"].asString(),
-      nodeJson["port"].asInt(), std::make_pair(x, y), *this);
+NodeInfo NetworkManager::nodeInfoOf(const std::shared_ptr<Node> &node) {
+  NodeInfo info{};
+  info.type = NodeType::toString(node->getType());
+  info.name = node->getName();
+  info.ip = node->getIP();
+  info.coords = node->getCoords();
+  info.port = node->getPort();
+  info.publicKey = node->getPublicKey();
+  info.groups = node->getGroups();
+  return info;
+}
 
+std::shared_ptr<Node> NetworkManager::makeNode(const NodeInfo &info) const {
+  std::shared_ptr<Node> node =
+      std::make_shared<Node>(NodeType::fromString(info.type), info.name,
+                             info.ip, info.port, info.coords, *this);
+  node->setGroups(info.groups);
   return node;
 }
 
-void NetworkManager::createRoutingTable() {
-  topology.clear();
-  topology.resize(nodes.size());
+std::shared_ptr<Node>
+NetworkManager::copyNode(const std::shared_ptr<Node> &node,
+                         const std::pair<double, double> &coords,
+                         const std::vector<std::string> &groups) const {
+  std::shared_ptr<Node> copy =
+      std::make_shared<Node>(node->getType(), node->getName(), node->getIP(),
+                             node->getPort(), coords, *this);
+  copy->setGroups(groups);
+  return copy;
+}
+
+void NetworkManager::setRoutingMode(RoutingMode::Mode mode) {
+  routingMode = mode;
+}
+
+RoutingMode::Mode NetworkManager::getRoutingMode() const { return routingMode; }
 
+// Whether two nodes can talk directly in geographic mode
+static bool inRadioRange(const LinkEndpoint &a, const LinkEndpoint &b) {
+  return linkDistance(a, b) <= GEO_LINK_RANGE &&
+         LinkCost::weight(a, b) != LONG_LONG_MAX;
+}
+
+static LinkEndpoint endpointOf(const std::shared_ptr<Node> &node) {
+  auto coords = node->getCoords();
+  return {coords.first, coords.second, node->getType()};
+}
+
+void NetworkManager::updateRoutingTable(const std::shared_ptr<Node> &src) {
+  int self = 0;
   for (int i = 0; i < nodes.size(); i++) {
-    topology[i] = std::vector<long long>(nodes.size(), 0);
+    if (nodes[i]->getName() == src->getName()) {
+      self = i;
+      break;
+    }
   }
+
+  selectMembers(self);
+  if (members.size() != topology.size()) {
+    topology.assign(members.size(), std::vector<long long>(members.size(), 0));
+  }
+
+  std::vector<LinkEndpoint> endpoints;
+  endpoints.reserve(members.size());
+  int localSelf = 0;
+  for (int i = 0; i < members.size(); i++) {
+    auto coords = nodes[members[i]]->getCoords();
+    endpoints.push_back(
+        {coords.first, coords.second, nodes[members[i]]->getType()});
+    if (members[i] == self) {
+      localSelf = i;
+    }
+  }
+
+  buildTopology<LinkCost>(endpoints, topology);
+  applyLinkCosts();
+
+  route(localSelf);
+  summarizeAreas(self);
+  publishSnapshot();
 }
 
-void NetworkManager::updateRoutingTable(const std::shared_ptr<Node> &src) {
-  if (nodes.size() != topology.size()) {
-    createRoutingTable();
+// Grid cell a position falls in, packed into a single key
+static long long areaKey(long long ax, long long ay) {
+  return (ax << 32) | (ay & 0xffffffffLL);
+}
+
+static long long areaOf(const std::pair<double, double> &coords) {
+  return areaKey(static_cast<long long>(std::floor(coords.first / AREA_SIZE)),
+                 static_cast<long long>(std::floor(coords.second / AREA_SIZE)));
+}
+
+static long long areaX(long long key) { return key >> 32; }
+static long long areaY(long long key) {
+  return static_cast<int32_t>(key & 0xffffffffLL);
+}
+
+void NetworkManager::selectMembers(int self) {
+  members.clear();
+
+  if (routingMode == RoutingMode::GEO && !nodes.empty()) {
+    // Only the radio neighborhood, for probing and flooding
+    LinkEndpoint own = endpointOf(nodes[self]);
+    for (int i = 0; i < nodes.size(); i++) {
+      if (i == self || inRadioRange(own, endpointOf(nodes[i]))) {
+        members.push_back(i);
+      }
+    }
+    return;
   }
 
+  if (routingMode != RoutingMode::AREA || nodes.empty()) {
+    for (int i = 0; i < nodes.size(); i++) {
+      members.push_back(i);
+    }
+    return;
+  }
+
+  // Our own area and the ones around it get the detailed topology
+  long long own = areaOf(nodes[self]->getCoords());
   for (int i = 0; i < nodes.size(); i++) {
-    for (int j = 0; j < nodes.size(); j++) {
-      auto i_coords = nodes[i]->getCoords();
-      auto j_coords = nodes[j]->getCoords();
+    long long area = areaOf(nodes[i]->getCoords());
+    if (std::abs(areaX(area) - areaX(own)) <= 1 &&
+        std::abs(areaY(area) - areaY(own)) <= 1) {
+      members.push_back(i);
+    }
+  }
+}
+
+// Decides, for every node, which member's path packets towards it follow.
+// Members are their own gateway. In area mode, nodes further away are
+// reached through the member the area-level shortest path to their area
+// leaves from, which then routes them onward.
+void NetworkManager::summarizeAreas(int self) {
+  gateway.assign(nodes.size(), -1);
+  for (int i = 0; i < members.size(); i++) {
+    if (!pathsTo[i].empty()) {
+      gateway[members[i]] = i;
+    }
+  }
+
+  if (routingMode != RoutingMode::AREA || nodes.empty()) {
+    return;
+  }
+
+  std::vector<bool> isMember(nodes.size(), false);
+  for (int idx : members) {
+    isMember[idx] = true;
+  }
+
+  // Summaries of the areas outside the detailed window: population centroid
+  struct AreaSummary {
+    double x = 0, y = 0;
+    int count = 0;
+  };
+  std::unordered_map<long long, AreaSummary> areas;
+  for (int i = 0; i < nodes.size(); i++) {
+    if (isMember[i]) {
+      continue;
+    }
+    auto coords = nodes[i]->getCoords();
+    AreaSummary &area = areas[areaOf(coords)];
+    area.x += coords.first;
+    area.y += coords.second;
+    area.count++;
+  }
+  for (auto &entry : areas) {
+    entry.second.x /= entry.second.count;
+    entry.second.y /= entry.second.count;
+  }
 
-      int x_diff = std::pow(i_coords.first - j_coords.first, 2);
-      int y_diff = std::pow(i_coords.second - j_coords.second, 2);
-      long long weight = std::sqrt(x_diff + y_diff);
+  // Dijkstra over the areas, starting from every member we can route to at
+  // the cost of getting there, and remembering which member each area is
+  // reached through. Members link to every area and areas to each other by
+  // the cost between positions and centroids rather than only to
+  // neighbouring areas, so an empty area in between does not cut the way.
+  std::unordered_map<long long, long long> dist;
+  std::unordered_map<long long, int> via;
+  typedef std::pair<long long, long long> QueueEntry; // (dist, area)
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry>>
+      queue;
 
-      auto i_isGround = (nodes[i]->getType() == NodeType::GROUND);
-      auto j_isGround = (nodes[j]->getType() == NodeType::GROUND);
+  for (int i = 0; i < members.size(); i++) {
+    if (pathsTo[i].empty()) {
+      continue;
+    }
+    LinkEndpoint border = endpointOf(nodes[members[i]]);
+    for (const auto &area : areas) {
+      long long weight = LinkCost::weight(
+          border, {area.second.x, area.second.y, NodeType::SATELLITE});
+      if (weight == LONG_LONG_MAX) {
+        continue;
+      }
+      auto known = dist.find(area.first);
+      if (known == dist.end() || distances[i] + weight < known->second) {
+        dist[area.first] = distances[i] + weight;
+        via[area.first] = i;
+      }
+    }
+  }
+  for (const auto &entry : dist) {
+    queue.push({entry.second, entry.first});
+  }
+
+  while (!queue.empty()) {
+    QueueEntry top = queue.top();
+    queue.pop();
+    if (top.first > dist[top.second]) {
+      continue;
+    }
 
-      if (i_isGround && j_isGround) {
-        topology[i][j] = LONG_LONG_MAX;
-        topology[j][i] = LONG_LONG_MAX;
+    const AreaSummary &from = areas[top.second];
+    for (const auto &area : areas) {
+      if (area.first == top.second) {
         continue;
-      } else if (i_isGround) {
-        weight += 1000;
-      } else if (j_isGround) {
-        weight += 1000;
       }
 
-      // Applying a quadratic penalty when exceeding 500 units
-      if (weight > 500) {
-        weight = 500 + (weight - 500) * (weight - 500);
+      long long weight =
+          LinkCost::weight({from.x, from.y, NodeType::SATELLITE},
+                           {area.second.x, area.second.y, NodeType::SATELLITE});
+      if (weight == LONG_LONG_MAX) {
+        continue;
       }
 
-      topology[i][j] = weight;
-      topology[j][i] = weight;
+      auto known = dist.find(area.first);
+      if (known == dist.end() || top.first + weight < known->second) {
+        dist[area.first] = top.first + weight;
+        via[area.first] = via[top.second];
+        queue.push({top.first + weight, area.first});
+      }
     }
   }
 
-  int src_idx = 0;
   for (int i = 0; i < nodes.size(); i++) {
-    if (nodes[i]->getName() == src->getName()) {
-      src_idx = i;
-      break;
+    if (isMember[i]) {
+      continue;
+    }
+    auto it = via.find(areaOf(nodes[i]->getCoords()));
+    if (it != via.end()) {
+      gateway[i] = it->second;
+    }
+  }
+}
+
+// Scales the geometric weight of every link an origin has measured by the
+// congestion it reported. When both ends report, the worse estimate wins.
+void NetworkManager::applyLinkCosts() {
+  if (linkStates.empty()) {
+    return;
+  }
+
+  std::unordered_map<std::string, int> index;
+  for (int i = 0; i < members.size(); i++) {
+    index.emplace(nodes[members[i]]->getName(), i);
+  }
+
+  // Worst reported factor per undirected link, keyed by (lower, higher) idx
+  std::unordered_map<long long, int> factors;
+  for (const auto &lsa : linkStates) {
+    auto from = index.find(lsa.name);
+    if (from == index.end()) {
+      continue;
+    }
+
+    for (const auto &link : lsa.links) {
+      auto to = index.find(link.first);
+      if (to == index.end()) {
+        continue;
+      }
+
+      long long i = std::min(from->second, to->second);
+      long long j = std::max(from->second, to->second);
+      int &factor = factors[i * members.size() + j];
+      factor = std::max(factor, std::min(std::max(link.second, 100),
+                                         LINK_MAX_FACTOR));
     }
   }
 
-  route(src_idx);
+  for (const auto &entry : factors) {
+    int i = entry.first / members.size(), j = entry.first % members.size();
+    long long weight = topology[i][j];
+    if (weight == LONG_LONG_MAX) {
+      continue;
+    }
+    // Saturates rather than overflowing on links that are long already
+    topology[i][j] = weight > LONG_LONG_MAX / entry.second
+                         ? LONG_LONG_MAX / 100
+                         : weight * entry.second / 100;
+    topology[j][i] = topology[i][j];
+  }
 }
 
 void NetworkManager::route(int src_idx) {
-  if (nextHop.size() != nodes.size())
-    nextHop.resize(nodes.size());
+  const int n = topology.size();
+  if (nextHop.size() != n)
+    nextHop.resize(n);
+  srcIdx = src_idx;
+  trees.clear();
+  pathsTo.assign(n, {});
+  neighbors.clear();
 
-  for (int i = 0; i < nodes.size(); i++) {
+  for (int i = 0; i < n; i++) {
     nextHop[i] = i;
   }
 
-  std::vector<bool> visited(nodes.size(), false);
-  std::vector<int> minDist(nodes.size(), INT_MAX);
-  minDist[src_idx] = 0;
+  if (n == 0)
+    return;
 
-  for (int i = 0; i < nodes.size(); i++) {
-    int minUnvisited = INT_MAX, minUnvIdx;
+  std::vector<long long> &minDist = distances;
+  trees.push_back({src_idx, {}});
+  shortestPaths(src_idx, minDist, trees[0].prevHop, nextHop);
+
+  for (int d = 0; d < n; d++) {
+    if (d != src_idx && minDist[d] != LLONG_MAX) {
+      pathsTo[d].push_back(0);
+    }
+  }
+
+  // The cheapest links out of this node are both the flood targets and the
+  // candidate first hops for alternate paths
+  const auto &row = topology[src_idx];
+  for (int i = 0; i < row.size(); i++) {
+    if (i != src_idx && row[i] != LONG_LONG_MAX) {
+      neighbors.push_back(i);
+    }
+  }
+  auto fanout = std::min<size_t>(LSA_FANOUT, neighbors.size());
+  std::partial_sort(neighbors.begin(), neighbors.begin() + fanout,
+                    neighbors.end(),
+                    [&row](int a, int b) { return row[a] < row[b]; });
+  neighbors.resize(fanout);
+
+  std::vector<long long> altDist;
+  std::vector<int> altFirstHop;
+  for (int c : neighbors) {
+    PathTree tree{c, {}};
+    shortestPaths(c, altDist, tree.prevHop, altFirstHop);
 
-    for (int j = 0; j < nodes.size(); j++) {
-      if (!visited[j] && minDist[j] <= minUnvisited) {
-        minUnvisited = minDist[j];
-        minUnvIdx = j;
+    for (int d = 0; d < n; d++) {
+      if (pathsTo[d].empty() || pathsTo[d].size() >= ECMP_MAX_PATHS ||
+          nextHop[d] == c || altDist[d] == LLONG_MAX) {
+        continue;
+      }
+      // Only accept first hops strictly closer to d than we are, which keeps
+      // the alternate loop-free and never bounces back through us
+      if (altDist[d] >= minDist[d]) {
+        continue;
+      }
+      long long cost = row[c] + altDist[d];
+      if (cost <= minDist[d] + minDist[d] * ECMP_COST_TOLERANCE_PERCENT / 100) {
+        pathsTo[d].push_back(trees.size());
       }
     }
+    trees.push_back(std::move(tree));
+  }
+}
+
+// Dijkstra over the topology matrix. prev[j] is the node before j on its
+// shortest path and firstHop[j] the node right after src, -1 / j if none.
+void NetworkManager::shortestPaths(int src, std::vector<long long> &dist,
+                                   std::vector<int> &prev,
+                                   std::vector<int> &firstHop) const {
+  const int n = topology.size();
+  dist.assign(n, LLONG_MAX);
+  prev.assign(n, -1);
+  firstHop.resize(n);
+  for (int i = 0; i < n; i++) {
+    firstHop[i] = i;
+  }
 
+  std::vector<char> visited(n, false);
+  dist[src] = 0;
+
+  // Relaxing and picking the next closest node share one pass over the row
+  int minUnvIdx = src;
+  while (minUnvIdx != -1 && dist[minUnvIdx] != LLONG_MAX) {
     visited[minUnvIdx] = true;
+    const long long base = dist[minUnvIdx];
+    const std::vector<long long> &row = topology[minUnvIdx];
+    int next = -1;
 
-    for (int j = 0; j < nodes.size(); j++) {
-      if (!visited[j] && topology[minUnvIdx][j] != LONG_LONG_MAX &&
-          minDist[minUnvIdx] + topology[minUnvIdx][j] < minDist[j]) {
-        minDist[j] = minDist[minUnvIdx] + topology[minUnvIdx][j];
-        if (minUnvIdx == src_idx)
-          continue;
-        nextHop[j] = minUnvIdx;
+    for (int j = 0; j < n; j++) {
+      if (visited[j]) {
+        continue;
+      }
+      if (row[j] != LONG_LONG_MAX && base + row[j] < dist[j]) {
+        dist[j] = base + row[j];
+        prev[j] = minUnvIdx;
+        // The first hop is inherited from the node we were reached through
+        firstHop[j] = (minUnvIdx == src) ? j : firstHop[minUnvIdx];
+      }
+      if (next == -1 || dist[j] < dist[next]) {
+        next = j;
       }
     }
+
+    // Everything left is unreachable once next is at LLONG_MAX
+    minUnvIdx = next;
   }
 }
 
-std::shared_ptr<Node>
-NetworkManager::getNextHop(const std::string &name) const {
-  int n_idx = -1;
+void NetworkManager::allPairsNextHops(std::vector<std::vector<int>> &table,
+                                      unsigned threads) const {
+  const int n = topology.size();
+  table.assign(n, std::vector<int>());
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Sources are independent, workers pull the next one off a shared counter
+  std::atomic<int> nextSource{0};
+  auto worker = [&]() {
+    std::vector<long long> dist;
+    std::vector<int> prev, firstHop;
+    for (int src = nextSource++; src < n; src = nextSource++) {
+      shortestPaths(src, dist, prev, firstHop);
+      for (int d = 0; d < n; d++) {
+        if (dist[d] == LLONG_MAX) {
+          firstHop[d] = -1;
+        }
+      }
+      table[src].swap(firstHop);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < std::min<unsigned>(threads, n); i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+}
+
+void NetworkManager::publishSnapshot() {
+  auto snap = std::make_shared<RoutingSnapshot>();
+  const int n = nodes.size();
+  snap->nodes = nodes;
+
+  // Routing state is computed over members, translate it to node indices
+  snap->self = members.empty() ? -1 : members[srcIdx];
+  for (int idx : neighbors) {
+    snap->neighbors.push_back(members[idx]);
+  }
+  for (const auto &tree : trees) {
+    PathTree global{members[tree.root], std::vector<int>(n, -1)};
+    for (int i = 0; i < tree.prevHop.size(); i++) {
+      if (tree.prevHop[i] != -1) {
+        global.prevHop[members[i]] = members[tree.prevHop[i]];
+      }
+    }
+    snap->trees.push_back(std::move(global));
+  }
+
+  snap->nextHop.resize(n);
+  snap->gateway.resize(n);
+  snap->pathsTo.resize(n);
+  snap->cost.resize(n);
+  for (int i = 0; i < n; i++) {
+    int via = gateway[i];
+    snap->nextHop[i] = (via == -1) ? i : members[nextHop[via]];
+    snap->gateway[i] = (via == -1) ? i : members[via];
+    // Beyond our areas only the cost up to the entry node is known
+    snap->cost[i] = (via == -1) ? LLONG_MAX : distances[via];
+    if (via != -1) {
+      // Beyond the gateway only the primary path is known
+      snap->pathsTo[i] =
+          (members[via] == i) ? pathsTo[via] : std::vector<int>{0};
+    }
+  }
+
+  snap->index.reserve(nodes.size());
+  snap->addrs.resize(nodes.size());
 
   for (int i = 0; i < nodes.size(); i++) {
-    if (nodes[i]->getName() == name) {
-      n_idx = i;
-      break;
+    snap->index.emplace(nodes[i]->getName(), i);
+
+    sockaddr_in &addr = snap->addrs[i];
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(nodes[i]->getPort());
+    inet_pton(AF_INET, nodes[i]->getIP().c_str(), &addr.sin_addr);
+    snap->addrIndex.emplace(RoutingSnapshot::addressKey(addr), i);
+  }
+
+  snap->coords.reserve(n);
+  for (int i = 0; i < n; i++) {
+    snap->coords.push_back(nodes[i]->getCoords());
+    for (const auto &group : nodes[i]->getGroups()) {
+      snap->groups[group].push_back(i);
+    }
+  }
+  if (snap->self >= 0) {
+    LinkEndpoint own = endpointOf(nodes[snap->self]);
+    for (int i = 0; i < n; i++) {
+      if (i != snap->self && inRadioRange(own, endpointOf(nodes[i]))) {
+        snap->inRange.push_back(i);
+      }
     }
   }
 
-  if (n_idx == -1 || n_idx >= nodes.size()) {
-    return nullptr;
-  } else {
-    return nodes[nextHop[n_idx]];
+  std::atomic_store(&snapshot,
+                    std::shared_ptr<const RoutingSnapshot>(std::move(snap)));
+}
+
+std::shared_ptr<const RoutingSnapshot> NetworkManager::getSnapshot() const {
+  return std::atomic_load(&snapshot);
+}
+
+bool NetworkManager::getNextHopAddress(const std::string &name,
+                                       sockaddr_in &addr, size_t flow) const {
+  auto snap = getSnapshot();
+  int n_idx = snap->indexOf(name);
+
+  if (n_idx == -1 || n_idx >= snap->pathsTo.size() ||
+      snap->pathsTo[n_idx].empty()) {
+    return false;
+  }
+
+  const auto &options = snap->pathsTo[n_idx];
+  const PathTree &tree = snap->trees[options[flow % options.size()]];
+  int hop = (tree.root == snap->self) ? snap->nextHop[snap->gateway[n_idx]]
+                                      : tree.root;
+  addr = snap->addrs[hop];
+  return true;
+}
+
+bool NetworkManager::getSourceRoute(const std::string &name,
+                                    std::vector<sockaddr_in> &hops,
+                                    size_t flow) const {
+  auto snap = getSnapshot();
+  int n_idx = snap->indexOf(name);
+  hops.clear();
+
+  if (n_idx == -1 || n_idx >= snap->pathsTo.size() ||
+      snap->pathsTo[n_idx].empty()) {
+    return false;
   }
+
+  // Flows are spread over the near-equal-cost paths, each path being the
+  // tree rooted at its first hop (or at us for the primary path)
+  const auto &options = snap->pathsTo[n_idx];
+  const PathTree &tree = snap->trees[options[flow % options.size()]];
+
+  // Walk the predecessor chain back to the root, bounded by the node count
+  for (int cur = snap->gateway[n_idx]; cur != tree.root;
+       cur = tree.prevHop[cur]) {
+    if (cur == -1 || hops.size() >= snap->nodes.size()) {
+      hops.clear();
+      return false;
+    }
+    hops.push_back(snap->addrs[cur]);
+  }
+  if (tree.root != snap->self) {
+    hops.push_back(snap->addrs[tree.root]);
+  }
+
+  std::reverse(hops.begin(), hops.end());
+  return true;
+}
+
+static double distanceBetween(const std::pair<double, double> &a,
+                              const std::pair<double, double> &b) {
+  return std::hypot(a.first - b.first, a.second - b.second);
+}
+
+static double bearing(const std::pair<double, double> &from,
+                      const std::pair<double, double> &to) {
+  return std::atan2(to.second - from.second, to.first - from.first);
+}
+
+// Point where segments ab and cd cross, if they do
+static bool crossing(const std::pair<double, double> &a,
+                     const std::pair<double, double> &b,
+                     const std::pair<double, double> &c,
+                     const std::pair<double, double> &d,
+                     std::pair<double, double> &at) {
+  double rx = b.first - a.first, ry = b.second - a.second;
+  double sx = d.first - c.first, sy = d.second - c.second;
+  double denominator = rx * sy - ry * sx;
+  if (denominator == 0) {
+    return false; // Parallel
+  }
+  double qx = c.first - a.first, qy = c.second - a.second;
+  double t = (qx * sy - qy * sx) / denominator;
+  double u = (qx * ry - qy * rx) / denominator;
+  if (t < 0 || t > 1 || u < 0 || u > 1) {
+    return false;
+  }
+  at = {a.first + t * rx, a.second + t * ry};
+  return true;
+}
+
+// Greedy forwarding hands the packet to the neighbor closest to the target.
+// At a local minimum it switches to perimeter mode and walks the face of the
+// planarized (Gabriel) neighbor graph by the right-hand rule, returning to
+// greedy once it is closer to the target than where it got stuck (GPSR).
+bool NetworkManager::getGeographicNextHop(Packet &pkt, const sockaddr_in *prev,
+                                          sockaddr_in &addr) const {
+  auto snap = getSnapshot();
+  if (snap->self < 0 || snap->inRange.empty()) {
+    return false;
+  }
+
+  const auto &own = snap->coords[snap->self];
+  const std::pair<double, double> target(pkt.targetX, pkt.targetY);
+  const std::pair<double, double> entry(pkt.entryX, pkt.entryY);
+  double ownDistance = distanceBetween(own, target);
+
+  if (pkt.forwarding == forwardMode::PERIMETER &&
+      ownDistance < distanceBetween(entry, target)) {
+    pkt.forwarding = forwardMode::GREEDY;
+  }
+
+  if (pkt.forwarding != forwardMode::PERIMETER) {
+    pkt.forwarding = forwardMode::GREEDY;
+    int best = -1;
+    double bestDistance = ownDistance;
+    for (int idx : snap->inRange) {
+      double distance = distanceBetween(snap->coords[idx], target);
+      if (distance < bestDistance) {
+        best = idx;
+        bestDistance = distance;
+      }
+    }
+
+    if (best != -1) {
+      addr = snap->addrs[best];
+      return true;
+    }
+
+    // Local minimum, start walking the face towards the target
+    pkt.forwarding = forwardMode::PERIMETER;
+    pkt.entryX = pkt.faceX = static_cast<int32_t>(std::lround(own.first));
+    pkt.entryY = pkt.faceY = static_cast<int32_t>(std::lround(own.second));
+    prev = nullptr;
+  }
+
+  // Gabriel graph: an edge is dropped if another neighbor lies in the
+  // circle whose diameter it is
+  std::vector<int> planar;
+  for (int v : snap->inRange) {
+    std::pair<double, double> mid((own.first + snap->coords[v].first) / 2,
+                                  (own.second + snap->coords[v].second) / 2);
+    double radius = distanceBetween(own, snap->coords[v]) / 2;
+    bool keep = true;
+    for (int w : snap->inRange) {
+      if (w != v && distanceBetween(snap->coords[w], mid) < radius) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      planar.push_back(v);
+    }
+  }
+  if (planar.empty()) {
+    return false;
+  }
+
+  // Right-hand rule: first planar edge counterclockwise from the reference
+  auto rightHand = [&](double reference) {
+    int next = -1;
+    double bestTurn = 0;
+    for (int v : planar) {
+      double turn = bearing(own, snap->coords[v]) - reference;
+      while (turn <= 0) {
+        turn += 2 * M_PI;
+      }
+      if (next == -1 || turn < bestTurn) {
+        next = v;
+        bestTurn = turn;
+      }
+    }
+    return next;
+  };
+
+  // Counterclockwise from the edge we arrived on, or from the line to the
+  // target when entering the face
+  int from = prev ? snap->indexOf(*prev) : -1;
+  double reference = (from >= 0) ? bearing(own, snap->coords[from])
+                                 : bearing(own, target);
+  int next = rightHand(reference);
+
+  // Face change: an edge crossing the line from the entry point to the
+  // target closer to the target than where this face was entered leads
+  // onto the next face along the line, which is walked instead, from the
+  // edge after the crossing one. Without it the walk can circle a face
+  // that does not lead to the target. The header keeps whole units, so
+  // only a crossing more than a unit closer counts.
+  std::pair<double, double> face(pkt.faceX, pkt.faceY);
+  for (size_t changes = 0; changes < planar.size(); changes++) {
+    std::pair<double, double> at;
+    if (!crossing(own, snap->coords[next], entry, target, at) ||
+        distanceBetween(at, target) >= distanceBetween(face, target) - 1) {
+      break;
+    }
+    face = at;
+    next = rightHand(bearing(own, snap->coords[next]));
+  }
+  pkt.faceX = static_cast<int32_t>(std::lround(face.first));
+  pkt.faceY = static_cast<int32_t>(std::lround(face.second));
+
+  addr = snap->addrs[next];
+  return true;
 }
@@ -1,17 +1,82 @@
 #ifndef NETWORKMANAGER_H
 #define NETWORKMANAGER_H
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <limits.h>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <netinet/in.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <json/json.h>
 
-using matrix = std::vector<std::vector<long long>>;
+#include "LinkCostPolicy.h"
+#include "LinkState.h"
+#include "RegistryProtocol.h"
+#include "RoutingMode.h"
+
+constexpr int ECMP_MAX_PATHS = 4; // Near-equal-cost paths kept per destination
+constexpr int ECMP_COST_TOLERANCE_PERCENT = 10; // Slack over the best cost
+constexpr double AREA_SIZE = 1000; // Side of a square routing area
+constexpr double GEO_LINK_RANGE = 1000; // Radio range in geographic mode
+constexpr int REGISTRY_WATCH_MS = 30000; // Longest the registry holds a poll
+constexpr int REGISTRY_RETRY_MS = 3000;  // Pause after a failed poll
+constexpr int REGISTRY_SETTLE_MS = 250;  // Batches a burst of pushed changes
+// How often the registry lease is renewed, well inside the registry's
+// REGISTRY_LEASE_SECONDS
+constexpr int REGISTRY_RENEW_SECONDS = 10;
+constexpr size_t REGISTRY_MAX_BATCH = 1024; // Updates sent in one request
 
 class Node;
+struct Packet;
+
+// Shortest path tree rooted at root; prevHop[j] is the node before j.
+struct PathTree {
+  int root;
+  std::vector<int> prevHop;
+};
+
+// Immutable view of the network used by the data path. A new snapshot is
+// built by the refresh thread and published with an atomic pointer swap, so
+// readers never observe a half-updated node list or routing table. Nodes
+// are shared between snapshots but never changed once added; a node that
+// moves or changes groups is replaced by a copy.
+struct RoutingSnapshot {
+  std::vector<std::shared_ptr<Node>> nodes;
+  std::unordered_map<std::string, int> index; // name -> idx in nodes
+  std::vector<int> nextHop;                   // dest idx -> next hop idx
+  std::vector<int> gateway;                   // dest idx -> last routed hop
+  std::vector<PathTree> trees;                // trees[0] is rooted at self
+  std::vector<std::vector<int>> pathsTo;      // dest idx -> trees to use
+  std::vector<sockaddr_in> addrs;             // resolved address per idx
+  std::unordered_map<uint64_t, int> addrIndex; // address key -> idx
+  std::vector<int> neighbors;                 // idx of nearest link peers
+  std::vector<long long> cost;                // dest idx -> path cost
+  std::unordered_map<std::string, std::vector<int>> groups; // anycast members
+  std::vector<int> inRange;                   // idx of nodes in radio range
+  std::vector<std::pair<double, double>> coords; // position per idx
+  int self = -1;                              // idx of the routing source
+
+  int indexOf(const std::string &name) const {
+    auto it = index.find(name);
+    return it == index.end() ? -1 : it->second;
+  }
+
+  static uint64_t addressKey(const sockaddr_in &addr) {
+    return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+  }
+
+  int indexOf(const sockaddr_in &addr) const {
+    auto it = addrIndex.find(addressKey(addr));
+    return it == addrIndex.end() ? -1 : it->second;
+  }
+};
 
 class NetworkManager {
 public:
@@ -20,41 +85,155 @@ public:
   bool nodeExists(const std::shared_ptr<Node> &node) const;
   static bool performCurlRequest(const std::string &url,
                                  const std::string &payload,
-                                 std::string &response);
+                                 std::string &response,
+                                 long timeoutSeconds = 10);
   static Json::Value createNodePayload(const std::string &action,
                                        const std::shared_ptr<Node> &node);
-  std::shared_ptr<Node> parseNodeFromJson(const Json::Value &nodeJson) const;
+  static bool parseNodeInfo(const Json::Value &nodeJson, NodeInfo &info);
+  static NodeInfo nodeInfoOf(const std::shared_ptr<Node> &node);
+  std::shared_ptr<Node> makeNode(const NodeInfo &info) const;
 
   void addNode(const std::shared_ptr<Node> &node);
   void removeNode(const std::string &id);
   void listNodes() const;
   std::shared_ptr<Node> findNode(const std::string &name) const;
+  std::shared_ptr<Node> findNode(const sockaddr_in &addr) const;
+  // A node by name, or else the cheapest reachable member of the anycast
+  // group of that name
+  std::shared_ptr<Node> resolveTarget(const std::string &name) const;
 
   std::vector<std::shared_ptr<Node>> getSatelliteNodes() const;
 
-  void fetchNodesFromRegistry();
+  // Long-polls the registry until running is cleared, queueing node list
+  // changes as the registry pushes them. The refresh thread takes them in
+  // with applyRegistryChanges.
+  void watchRegistry(const std::atomic<bool> &running);
+  void applyRegistryChanges();
+  // Sleeps up to timeout, returning shortly after registry changes arrive
+  void waitForRegistryChanges(std::chrono::milliseconds timeout);
   static std::string serializeNode(const std::shared_ptr<Node> &node);
   bool registerNodeWithRegistry(const std::shared_ptr<Node> &node);
   void deregisterNodeWithRegistry(const std::shared_ptr<Node> &node);
   bool sendToRegistryServer(const std::string &endpoint,
                             const std::string &jsonPayload);
+  // Sends the node's position. Nodes of this process updating while one
+  // of them talks to the registry are sent together in a single batch.
   bool updateNodeInRegistry(const std::shared_ptr<Node> &node) const;
+  // Renews the node's registry lease when due, registering it again if the
+  // registry already let it go. Called from the refresh thread.
+  void renewRegistryLease(const std::shared_ptr<Node> &node);
 
   std::string getNodePublicKey(const std::string &nodeName);
+  // Asks the registry for the nodes within radius of center, or the k
+  // nodes nearest to it, nearest first. False if the query failed, e.g. as
+  // the registry does not support it.
+  bool findNodesNear(const std::pair<double, double> &center, double radius,
+                     std::vector<NodeInfo> &result) const;
+  bool findNearestNodes(const std::pair<double, double> &center, uint32_t k,
+                        std::vector<NodeInfo> &result) const;
+
+  // Link-state flooding; handleLinkState is called from the receiver thread
+  bool handleLinkState(const LinkStateAdvertisement &lsa) const;
+  void applyLinkState();
+  std::vector<std::pair<std::string, sockaddr_in>> getNeighborLinks() const;
+
+  void setRoutingMode(RoutingMode::Mode mode);
+  RoutingMode::Mode getRoutingMode() const;
 
-  void createRoutingTable();
   void updateRoutingTable(const std::shared_ptr<Node> &src);
   void route(int src_idx);
-  std::shared_ptr<Node> getNextHop(const std::string &name) const;
+  // Next hop from every node to every other over the current topology,
+  // table[s][d] = -1 if unreachable. Sources are spread over threads
+  // workers, 0 meaning one per hardware thread.
+  void allPairsNextHops(std::vector<std::vector<int>> &table,
+                        unsigned threads = 0) const;
+  bool getNextHopAddress(const std::string &name, sockaddr_in &addr,
+                         size_t flow = 0) const;
+  bool getSourceRoute(const std::string &name, std::vector<sockaddr_in> &hops,
+                      size_t flow = 0) const;
+  // Picks the next hop from the positions in the packet header, updating
+  // its forwarding state. prev is the hop the packet came from, if any.
+  bool getGeographicNextHop(Packet &pkt, const sockaddr_in *prev,
+                            sockaddr_in &addr) const;
 
-  std::vector<int> nextHop;
+  std::shared_ptr<const RoutingSnapshot> getSnapshot() const;
 
 private:
+  friend class NetworkManagerTest; // Routes over hand-built topologies
+
+  RoutingMode::Mode routingMode = RoutingMode::FLAT;
+  // Nodes the detailed topology is built over (all of them unless routing
+  // by area); the routing state below is indexed by position in members.
+  std::vector<int> members;
   matrix topology;
   // Holds index for next hop for given destination
   // nextHop[S3 idx] = next node in the shortest path to S3
+  std::vector<int> nextHop;
+  // Shortest path trees from us and from each candidate first hop, and per
+  // destination the trees whose paths are within the ECMP cost tolerance
+  std::vector<PathTree> trees;
+  std::vector<std::vector<int>> pathsTo;
+  std::vector<int> neighbors;
+  std::vector<long long> distances;
+  int srcIdx = -1;
+  // Node idx -> member idx whose path a destination follows, -1 if none
+  std::vector<int> gateway;
+  // Owned by the refresh thread; readers go through the snapshot instead.
+  // The nodes themselves are never changed, see RoutingSnapshot.
   std::vector<std::shared_ptr<Node>> nodes;
+  std::shared_ptr<const RoutingSnapshot> snapshot;
+  // Internally synchronized, fed by the receiver thread
+  mutable LinkStateDatabase lsdb;
+  // Advertisements merged on the last refresh, for their measured link costs
+  std::vector<LinkStateAdvertisement> linkStates;
   std::string registryAddress;
+  std::string registryHost;
+  std::string registryPort;
+  // Cleared once the registry turns out to only speak JSON
+  mutable std::atomic<bool> binaryRegistry{true};
+  // Registry store epoch and version our node list is synced up to; only
+  // touched by the thread polling the registry
+  uint64_t registryEpoch = 0;
+  uint64_t registryVersion = 0;
+  mutable std::atomic<bool> batchRegistry{true}; // Cleared if unsupported
+  // Positions waiting to be sent, by node name, and whether some thread is
+  // sending; that thread sends whatever is queued before it stops
+  mutable std::map<std::string, std::shared_ptr<Node>> queuedUpdates;
+  mutable bool sendingUpdates = false;
+  mutable std::mutex updatesMutex;
+  // Last lease renewal; only touched by the refresh thread
+  std::chrono::steady_clock::time_point lastLeaseRenewal;
+  // Deltas received from the registry, in order, for the refresh thread
+  std::vector<NodeChanges> pendingChanges;
+  std::mutex pendingMutex;
+  std::condition_variable pendingReady;
+
+  bool pollRegistry(int waitMs);
+  bool pollRegistryJson(int waitMs, NodeChanges &changes);
+  // One binary protocol request; false if it could not be made, e.g. as
+  // the registry does not support it
+  bool registryCall(RegistryOp op, const std::string &payload,
+                    RegistryStatus &status, std::string &reply,
+                    int timeoutSeconds = 10) const;
+  // Binary spatial query, else its JSON equivalent
+  bool queryRegistryNodes(RegistryOp op, const std::string &payload,
+                          const Json::Value &request,
+                          std::vector<NodeInfo> &result) const;
+  bool sendNodeUpdates(const std::vector<std::shared_ptr<Node>> &batch) const;
+  bool sendNodeUpdate(const std::shared_ptr<Node> &node) const;
+  void learnNode(const NodeInfo &info);
+  // node at a new position and with new groups, as a new object
+  std::shared_ptr<Node> copyNode(const std::shared_ptr<Node> &node,
+                                 const std::pair<double, double> &coords,
+                                 const std::vector<std::string> &groups) const;
+  void forgetNode(const std::string &name);
+
+  void selectMembers(int self);
+  void summarizeAreas(int self);
+  void applyLinkCosts();
+  void shortestPaths(int src, std::vector<long long> &dist,
+                     std::vector<int> &prev, std::vector<int> &firstHop) const;
+  void publishSnapshot();
 };
 
 #endif
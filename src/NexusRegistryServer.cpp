@@ -1,16 +1,202 @@
 #include "NexusRegistryServer.h"
 #include "NodeType.h"
 
-NexusRegistryServer::NexusRegistryServer(int port)
-    : port(port), isRunning(false) {}
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Sockets get SO_NOSIGPIPE instead
+#endif
+
+NexusRegistryServer::NexusRegistryServer(int port, int backlog,
+                                         unsigned reactors, unsigned workers,
+                                         const std::string &dataDirectory,
+                                         int leaseSeconds)
+    : port(port), backlog(backlog), reactorCount(reactors),
+      workerCount(workers), dataDirectory(dataDirectory),
+      leaseSeconds(leaseSeconds), startedAt(std::chrono::steady_clock::now()),
+      isRunning(false) {
+  if (reactorCount == 0) {
+    reactorCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
 
 NexusRegistryServer::~NexusRegistryServer() { stop(); }
 
+// gzip member of data. Fastest level: JSON squeezes well anyway, and this
+// runs on the workers.
+static bool gzipCompress(const std::string &data, std::string &out) {
+  z_stream stream{};
+  if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&stream, data.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+  stream.avail_out = out.size();
+  int result = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+// Strong ETag from a 64-bit FNV-1a hash of the body
+static std::string entityTag(const std::string &body) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : body) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  char tag[20];
+  snprintf(tag, sizeof(tag), "\"%016llx\"",
+           static_cast<unsigned long long>(hash));
+  return tag;
+}
+
+// Tag of the gzip-encoded body of the entity tagged etag
+static std::string gzipTag(const std::string &etag) {
+  return etag.substr(0, etag.size() - 1) + "-gzip\"";
+}
+
+// If-None-Match holds "*" or a comma separated list of tags
+static bool etagMatches(const std::string &ifNoneMatch,
+                        const std::string &etag) {
+  size_t start = 0;
+  while (start < ifNoneMatch.size()) {
+    size_t end = ifNoneMatch.find(',', start);
+    if (end == std::string::npos) {
+      end = ifNoneMatch.size();
+    }
+    std::string tag = ifNoneMatch.substr(start, end - start);
+    tag.erase(0, tag.find_first_not_of(" \t"));
+    tag.erase(tag.find_last_not_of(" \t") + 1);
+    if (tag.compare(0, 2, "W/") == 0) {
+      tag.erase(0, 2); // Weak comparison is all If-None-Match asks for
+    }
+    if (tag == "*" || tag == etag) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+const std::string &NexusRegistryServer::ListCache::gzipped() const {
+  std::call_once(compressOnce, [this] {
+    if (!gzipCompress(body, compressed)) {
+      compressed.clear();
+    }
+  });
+  return compressed;
+}
+
+static bool setNonBlocking(int socket) {
+  int flags = fcntl(socket, F_GETFL, 0);
+  return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
 void NexusRegistryServer::start() {
-  serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-  if (serverSocket < 0) {
+  workers.reset(new ThreadPool(workerCount));
+
+  if (!dataDirectory.empty()) {
+    log.reset(new RegistryLog(dataDirectory));
+    if (!log->open(store)) {
+      workers->stop();
+      return;
+    }
+  }
+  // Recovered nodes get a full lease to show they are still alive
+  for (const auto &node : store.snapshot()) {
+    renewLease(node.name);
+  }
+
+  for (unsigned i = 0; i < reactorCount; i++) {
+    std::unique_ptr<Reactor> reactor(new Reactor());
+    if (!openListener(*reactor)) {
+      workers->stop();
+      return;
+    }
+    reactors.push_back(std::move(reactor));
+  }
+
+  isRunning = true;
+  logger.log(LogLevel::INFO, "NexusRegistryServer is running on port " +
+                                 std::to_string(port) + " with " +
+                                 std::to_string(reactorCount) + " reactors.");
+
+  // The calling thread runs the first reactor, as start() always blocked
+  for (size_t i = 1; i < reactors.size(); i++) {
+    reactors[i]->thread =
+        std::thread(&NexusRegistryServer::runReactor, this,
+                    std::ref(*reactors[i]));
+  }
+  runReactor(*reactors[0]);
+
+  for (auto &reactor : reactors) {
+    if (reactor->thread.joinable()) {
+      reactor->thread.join();
+    }
+  }
+  workers->stop();
+  if (log) {
+    store.setJournal(nullptr);
+    log->sync();
+  }
+
+  for (auto &reactor : reactors) {
+    for (const auto &connection : reactor->connections) {
+      close(connection.first);
+    }
+    close(reactor->listenSocket);
+    close(reactor->pollFd);
+    close(reactor->wakePipe[0]);
+    close(reactor->wakePipe[1]);
+  }
+  reactors.clear();
+  logger.log(LogLevel::INFO, "NexusRegistryServer stopped.");
+}
+
+void NexusRegistryServer::stop() {
+  isRunning = false;
+  for (auto &reactor : reactors) {
+    char wake = 0;
+    if (write(reactor->wakePipe[1], &wake, 1) < 0) {
+      // Pipe full, the reactor is due to wake up anyway
+    }
+  }
+}
+
+bool NexusRegistryServer::openListener(Reactor &reactor) {
+  reactor.listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (reactor.listenSocket < 0) {
     logger.log(LogLevel::ERROR, "Failed to create socket.");
-    return;
+    return false;
+  }
+
+  // Every reactor binds the same port, the kernel balances between them
+  int enable = 1;
+  setsockopt(reactor.listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable,
+             sizeof(enable));
+  if (setsockopt(reactor.listenSocket, SOL_SOCKET, SO_REUSEPORT, &enable,
+                 sizeof(enable)) < 0) {
+    logger.log(LogLevel::ERROR, "Failed to set SO_REUSEPORT.");
+    close(reactor.listenSocket);
+    return false;
   }
 
   sockaddr_in serverAddr{};
@@ -18,80 +204,679 @@ void NexusRegistryServer::start() {
   serverAddr.sin_addr.s_addr = INADDR_ANY;
   serverAddr.sin_port = htons(port);
 
-  if (bind(serverSocket, reinterpret_cast<struct sockaddr *>(&serverAddr),
+  if (bind(reactor.listenSocket,
+           reinterpret_cast<struct sockaddr *>(&serverAddr),
            sizeof(serverAddr)) < 0) {
     logger.log(LogLevel::ERROR, "Failed to bind socket.");
-    close(serverSocket);
-    return;
+    close(reactor.listenSocket);
+    return false;
   }
 
-  if (listen(serverSocket, 10) < 0) {
+  if (listen(reactor.listenSocket, backlog) < 0 ||
+      !setNonBlocking(reactor.listenSocket)) {
     logger.log(LogLevel::ERROR, "Failed to listen on socket.");
-    close(serverSocket);
-    return;
+    close(reactor.listenSocket);
+    return false;
   }
 
-  isRunning = true;
-  logger.log(LogLevel::INFO, "NexusRegistryServer is running on port " +
-                                 std::to_string(port) + ".");
+  if (pipe(reactor.wakePipe) < 0 || !setNonBlocking(reactor.wakePipe[0]) ||
+      !setNonBlocking(reactor.wakePipe[1])) {
+    logger.log(LogLevel::ERROR, "Failed to create reactor wake-up pipe.");
+    close(reactor.listenSocket);
+    return false;
+  }
+
+#ifdef __linux__
+  reactor.pollFd = epoll_create1(0);
+  if (reactor.pollFd < 0) {
+    logger.log(LogLevel::ERROR, "Failed to create epoll instance.");
+    close(reactor.listenSocket);
+    return false;
+  }
+  for (int socket : {reactor.listenSocket, reactor.wakePipe[0]}) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = socket;
+    epoll_ctl(reactor.pollFd, EPOLL_CTL_ADD, socket, &event);
+  }
+#endif
+  return true;
+}
 
+// Write while a response is pending, read otherwise. Reading goes on while a
+// worker has the request, buffering whatever the client pipelines behind it.
+void NexusRegistryServer::watch(Reactor &reactor, int socket, bool added) {
+#ifdef __linux__
+  const Connection &connection = reactor.connections[socket];
+  epoll_event event{};
+  event.data.fd = socket;
+  event.events = connection.outHeader.empty() ? EPOLLIN : EPOLLOUT;
+  epoll_ctl(reactor.pollFd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, socket,
+            &event);
+#else
+  // poll() rebuilds its interest set from the connections on every wait
+  (void)reactor;
+  (void)socket;
+  (void)added;
+#endif
+}
+
+void NexusRegistryServer::runReactor(Reactor &reactor) {
+  auto lastSweep = std::chrono::steady_clock::now();
+  // The first reactor also answers the held lists once changes settled
+  bool first = &reactor == reactors[0].get();
   while (isRunning) {
-    sockaddr_in clientAddr{};
-    socklen_t clientLen = sizeof(clientAddr);
-    int clientSocket =
-        accept(serverSocket, reinterpret_cast<struct sockaddr *>(&clientAddr),
-               &clientLen);
+    int timeout = first ? flushTimeout() : REGISTRY_SWEEP_MS;
+#ifdef __linux__
+    epoll_event events[64];
+    int ready = epoll_wait(reactor.pollFd, events, 64, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logger.log(LogLevel::ERROR, "epoll_wait failed: " +
+                                      std::string(strerror(errno)));
+      break;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      uint32_t flags = events[i].events;
+      handleEvent(reactor, events[i].data.fd,
+                  flags & (EPOLLIN | EPOLLHUP | EPOLLERR), flags & EPOLLOUT);
+    }
+#else
+    std::vector<pollfd> fds;
+    fds.push_back({reactor.listenSocket, POLLIN, 0});
+    fds.push_back({reactor.wakePipe[0], POLLIN, 0});
+    for (const auto &entry : reactor.connections) {
+      const Connection &connection = entry.second;
+      short interest = connection.outHeader.empty() ? POLLIN : POLLOUT;
+      fds.push_back({entry.first, interest, 0});
+    }
+
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logger.log(LogLevel::ERROR,
+                 "poll failed: " + std::string(strerror(errno)));
+      break;
+    }
 
+    for (const auto &fd : fds) {
+      if (fd.revents) {
+        handleEvent(reactor, fd.fd, fd.revents & (POLLIN | POLLHUP | POLLERR),
+                    fd.revents & POLLOUT);
+      }
+    }
+#endif
+
+    if (first) {
+      flushSubscribers();
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastSweep >= std::chrono::milliseconds(REGISTRY_SWEEP_MS)) {
+      closeIdleClients(reactor);
+      expireSubscriptions(reactor);
+      if (&reactor == reactors[0].get()) {
+        expireLeases();
+        if (log) {
+          persistLog();
+        }
+      }
+      lastSweep = now;
+    }
+  }
+}
+
+void NexusRegistryServer::expireLeases() {
+  std::vector<std::string> expired;
+  {
+    std::lock_guard<std::mutex> lock(leasesMutex);
+    expired = leases.advance(leaseTick());
+  }
+  if (expired.empty()) {
+    return;
+  }
+
+  workers->submit([this, expired] {
+    bool removed = false;
+    {
+      std::lock_guard<std::mutex> lock(leasesMutex);
+      for (const auto &name : expired) {
+        // Renewed since it expired on the wheel
+        if (leases.scheduled(name)) {
+          continue;
+        }
+        if (store.remove(name)) {
+          logger.log(LogLevel::INFO, "Lease expired for node: " + name);
+          removed = true;
+        }
+      }
+    }
+    if (removed) {
+      notifySubscribers();
+    }
+  });
+}
+
+uint64_t NexusRegistryServer::leaseTick() const {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now() - startedAt)
+      .count();
+}
+
+void NexusRegistryServer::renewLease(const std::string &name) {
+  uint64_t expiry = leaseTick() + leaseSeconds;
+  std::lock_guard<std::mutex> lock(leasesMutex);
+  leases.schedule(name, expiry);
+}
+
+void NexusRegistryServer::persistLog() {
+  // Off the reactor, the disk may be slow
+  workers->submit([this] {
+    log->sync();
+    if (log->compactDue()) {
+      log->compact(store);
+    }
+  });
+}
+
+void NexusRegistryServer::handleEvent(Reactor &reactor, int socket,
+                                      bool readable, bool writable) {
+  if (socket == reactor.listenSocket) {
+    acceptClients(reactor);
+  } else if (socket == reactor.wakePipe[0]) {
+    char drain[64];
+    while (read(socket, drain, sizeof(drain)) > 0) {
+    }
+    deliverResponses(reactor);
+  } else if (reactor.connections.count(socket)) {
+    if (readable) {
+      readClient(reactor, socket);
+    } else if (writable) {
+      writeClient(reactor, socket);
+    }
+  }
+}
+
+void NexusRegistryServer::acceptClients(Reactor &reactor) {
+  while (true) {
+    int clientSocket = accept(reactor.listenSocket, nullptr, nullptr);
     if (clientSocket < 0) {
-      logger.log(LogLevel::ERROR, "Failed to accept connection.");
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        logger.log(LogLevel::ERROR, "Failed to accept connection: " +
+                                        std::string(strerror(errno)));
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    if (!setNonBlocking(clientSocket)) {
+      close(clientSocket);
       continue;
     }
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(clientSocket, SOL_SOCKET, SO_NOSIGPIPE, &enable,
+               sizeof(enable));
+#endif
 
-    std::thread(&NexusRegistryServer::handleClient, this, clientSocket)
-        .detach();
+    Connection &connection = reactor.connections[clientSocket];
+    connection = Connection();
+    connection.id = reactor.nextId++;
+    connection.lastActive = std::chrono::steady_clock::now();
+    watch(reactor, clientSocket, true);
+    metrics.connectionOpened();
   }
 }
 
-void NexusRegistryServer::stop() {
-  isRunning = false;
-  close(serverSocket);
-  logger.log(LogLevel::INFO, "NexusRegistryServer stopped.");
+void NexusRegistryServer::readClient(Reactor &reactor, int clientSocket) {
+  Connection &connection = reactor.connections[clientSocket];
+  connection.lastActive = std::chrono::steady_clock::now();
+  char buffer[16384];
+
+  while (true) {
+    ssize_t bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0);
+    if (bytesRead > 0) {
+      connection.in.append(buffer, bytesRead);
+      if (connection.in.size() > REGISTRY_MAX_REQUEST) {
+        logger.log(LogLevel::WARNING, "Dropping oversized request.");
+        closeClient(reactor, clientSocket);
+        return;
+      }
+      continue;
+    }
+    if (bytesRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    closeClient(reactor, clientSocket); // Peer closed or failed
+    return;
+  }
+
+  dispatchRequest(reactor, clientSocket);
 }
 
-void NexusRegistryServer::processRequest(const std::string &request,
-                                         std::string &response) {
+// Hands the next buffered request to the workers. Requests on a connection
+// are handled one at a time, so pipelined responses go out in order.
+void NexusRegistryServer::dispatchRequest(Reactor &reactor, int clientSocket) {
+  Connection &connection = reactor.connections[clientSocket];
+  if (connection.busy || !connection.outHeader.empty()) {
+    return;
+  }
+
+  // Binary clients open with the magic, anything else is taken as HTTP
+  if (connection.protocol == Connection::UNKNOWN) {
+    size_t seen = std::min(connection.in.size(), REGISTRY_MAGIC_SIZE);
+    if (connection.in.compare(0, seen, REGISTRY_MAGIC, seen) != 0) {
+      connection.protocol = Connection::HTTP;
+    } else if (seen < REGISTRY_MAGIC_SIZE) {
+      return;
+    } else {
+      connection.protocol = Connection::BINARY;
+      connection.parsed = REGISTRY_MAGIC_SIZE;
+    }
+  }
+  if (connection.protocol == Connection::BINARY) {
+    dispatchFrame(reactor, clientSocket);
+    return;
+  }
+
+  HttpParser::Result result =
+      connection.parser.parse(connection.in, connection.parsed);
+  if (result == HttpParser::NEED_MORE) {
+    return;
+  }
+
+  if (result == HttpParser::BAD) {
+    connection.outBody = std::make_shared<const std::string>(
+        R"({"error": "Malformed HTTP request"})");
+    connection.outHeader = buildResponseHeader(
+        "400 Bad Request", connection.outBody->size(), false);
+    connection.keepAlive = false;
+    connection.sent = 0;
+    metrics.observe(RegistryAction::INVALID, false,
+                    std::chrono::steady_clock::duration::zero(),
+                    connection.outHeader.size() + connection.outBody->size());
+    writeClient(reactor, clientSocket);
+    return;
+  }
+
+  const HttpRequest &request = connection.parser.request();
+  std::string body = request.body;
+  bool keepAlive = request.keepAlive;
+  // Everything else is posted to the root as JSON, whatever the path
+  bool scrape = request.target == "/metrics";
+  bool gzip = request.header("accept-encoding").find("gzip") !=
+              std::string::npos;
+  std::string ifNoneMatch = request.header("if-none-match");
+  connection.in.erase(0, connection.parsed);
+  connection.parsed = 0;
+  connection.parser.reset();
+  connection.busy = true;
+
+  Reactor *owner = &reactor;
+  uint64_t id = connection.id;
+  auto received = std::chrono::steady_clock::now();
+  workers->submit([this, owner, clientSocket, id, body, keepAlive, scrape,
+                   received, gzip, ifNoneMatch]() {
+    Subscription origin{owner, clientSocket, id, keepAlive};
+    origin.received = received;
+    origin.gzip = gzip;
+    origin.ifNoneMatch = ifNoneMatch;
+    if (scrape) {
+      origin.action = RegistryAction::METRICS;
+      respond(origin, std::make_shared<const std::string>(buildMetrics()),
+              RegistryStatus::OK, "text/plain; version=0.0.4");
+      return;
+    }
+    std::shared_ptr<const std::string> response;
+    RegistryStatus status = RegistryStatus::OK;
+    try {
+      response = processRequest(body, origin, status);
+    } catch (const std::exception &e) {
+      // Answered, not left hanging, if a handler throws on odd input
+      logger.log(LogLevel::WARNING,
+                 "Failed to handle request: " + std::string(e.what()));
+      origin.action = RegistryAction::INVALID;
+      status = RegistryStatus::BAD_REQUEST;
+      response = std::make_shared<const std::string>(
+          R"({"error": "Malformed request"})");
+    }
+    if (response) { // Otherwise held until the node list changes
+      respond(origin, response, status);
+    }
+  });
+}
+
+void NexusRegistryServer::dispatchFrame(Reactor &reactor, int clientSocket) {
+  Connection &connection = reactor.connections[clientSocket];
+  size_t size = 0;
+  if (!registryFrameSize(connection.in, connection.parsed, size)) {
+    connection.outBody = std::make_shared<const std::string>();
+    connection.outHeader = registryFrameHeader(
+        static_cast<uint8_t>(RegistryStatus::BAD_REQUEST), 0);
+    connection.keepAlive = false;
+    connection.sent = 0;
+    metrics.observe(RegistryAction::INVALID, true,
+                    std::chrono::steady_clock::duration::zero(),
+                    connection.outHeader.size());
+    writeClient(reactor, clientSocket);
+    return;
+  }
+  if (size == 0) {
+    return;
+  }
+
+  std::string frame =
+      connection.in.substr(connection.parsed + 4, size - 4); // Op onwards
+  connection.in.erase(0, connection.parsed + size);
+  connection.parsed = 0;
+  connection.busy = true;
+
+  Reactor *owner = &reactor;
+  uint64_t id = connection.id;
+  auto received = std::chrono::steady_clock::now();
+  workers->submit([this, owner, clientSocket, id, frame, received]() {
+    Subscription origin{owner, clientSocket, id, true};
+    origin.binary = true;
+    origin.received = received;
+    RegistryStatus status = RegistryStatus::OK;
+    std::shared_ptr<const std::string> response;
+    try {
+      response = processFrame(frame, origin, status);
+    } catch (const std::exception &e) {
+      logger.log(LogLevel::WARNING,
+                 "Failed to handle request: " + std::string(e.what()));
+      origin.action = RegistryAction::INVALID;
+      status = RegistryStatus::BAD_REQUEST;
+      response = std::make_shared<const std::string>();
+    }
+    if (response) { // Otherwise held until the node list changes
+      respond(origin, response, status);
+    }
+  });
+}
+
+void NexusRegistryServer::respond(const Subscription &client,
+                                  std::shared_ptr<const std::string> body,
+                                  RegistryStatus status,
+                                  const char *contentType) {
+  Response response{client.socket, client.id, "", std::move(body),
+                    client.keepAlive};
+  if (client.binary) {
+    response.header = registryFrameHeader(static_cast<uint8_t>(status),
+                                          response.body->size());
+  } else {
+    std::string httpStatus = status == RegistryStatus::BAD_REQUEST
+                                 ? "400 Bad Request"
+                                 : "200 OK";
+    // Any body may go out compressed, so caches have to key on the coding
+    std::string extraHeaders = "Vary: Accept-Encoding\r\n";
+    bool encoded = false;
+    if (client.gzip && response.body->size() >= REGISTRY_GZIP_MIN_BYTES) {
+      std::shared_ptr<const std::string> compressed;
+      if (client.list) {
+        compressed = std::shared_ptr<const std::string>(
+            client.list, &client.list->gzipped());
+      } else {
+        auto encoding = std::make_shared<std::string>();
+        if (gzipCompress(*response.body, *encoding)) {
+          compressed = encoding;
+        }
+      }
+      if (compressed && !compressed->empty()) {
+        response.body = compressed;
+        encoded = true;
+      }
+    }
+
+    // The full list carries an ETag, one per coding as the bytes differ, so
+    // unchanged polls get just a 304
+    if (client.list) {
+      std::string etag = encoded ? gzipTag(client.list->etag)
+                                 : client.list->etag;
+      extraHeaders += "ETag: " + etag + "\r\n";
+      if (!client.ifNoneMatch.empty() &&
+          etagMatches(client.ifNoneMatch, etag)) {
+        httpStatus = "304 Not Modified";
+        response.body = std::make_shared<const std::string>();
+        encoded = false;
+      }
+    }
+    if (encoded) {
+      extraHeaders += "Content-Encoding: gzip\r\n";
+    }
+    response.header =
+        buildResponseHeader(httpStatus, response.body->size(),
+                            client.keepAlive, contentType, extraHeaders);
+  }
+  metrics.observe(client.action, client.binary,
+                  std::chrono::steady_clock::now() - client.received,
+                  response.header.size() + response.body->size());
+  {
+    std::lock_guard<std::mutex> lock(client.reactor->responsesMutex);
+    client.reactor->responses.push_back(std::move(response));
+  }
+  char wake = 0;
+  if (write(client.reactor->wakePipe[1], &wake, 1) < 0) {
+    // Pipe full, a wake-up is already pending
+  }
+}
+
+void NexusRegistryServer::deliverResponses(Reactor &reactor) {
+  std::vector<Response> ready;
+  {
+    std::lock_guard<std::mutex> lock(reactor.responsesMutex);
+    ready.swap(reactor.responses);
+  }
+
+  for (auto &response : ready) {
+    auto it = reactor.connections.find(response.socket);
+    // The client may have gone, and its fd been reused, in the meantime
+    if (it == reactor.connections.end() || it->second.id != response.id) {
+      continue;
+    }
+    it->second.busy = false;
+    it->second.outHeader = std::move(response.header);
+    it->second.outBody = std::move(response.body);
+    it->second.keepAlive = response.keepAlive;
+    it->second.sent = 0;
+    writeClient(reactor, response.socket);
+  }
+}
+
+void NexusRegistryServer::writeClient(Reactor &reactor, int clientSocket) {
+  Connection &connection = reactor.connections[clientSocket];
+  const std::string &body = *connection.outBody;
+  const size_t total = connection.outHeader.size() + body.size();
+
+  // Header and body go out in one sendmsg, without copying them together.
+  // MSG_NOSIGNAL keeps a client resetting mid-response from raising SIGPIPE.
+  while (connection.sent < total) {
+    struct iovec parts[2];
+    int count = 0;
+    size_t headerLeft = connection.sent < connection.outHeader.size()
+                            ? connection.outHeader.size() - connection.sent
+                            : 0;
+    if (headerLeft > 0) {
+      parts[count].iov_base =
+          const_cast<char *>(connection.outHeader.data()) + connection.sent;
+      parts[count++].iov_len = headerLeft;
+    }
+    size_t bodyOffset =
+        connection.sent + headerLeft - connection.outHeader.size();
+    if (bodyOffset < body.size()) {
+      parts[count].iov_base = const_cast<char *>(body.data()) + bodyOffset;
+      parts[count++].iov_len = body.size() - bodyOffset;
+    }
+
+    struct msghdr message {};
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+    ssize_t bytesSent = sendmsg(clientSocket, &message, MSG_NOSIGNAL);
+    if (bytesSent > 0) {
+      connection.sent += bytesSent;
+      continue;
+    }
+    if (bytesSent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      watch(reactor, clientSocket, false);
+      return;
+    }
+    closeClient(reactor, clientSocket);
+    return;
+  }
+
+  if (!connection.keepAlive) {
+    closeClient(reactor, clientSocket);
+    return;
+  }
+
+  connection.outHeader.clear();
+  connection.outBody.reset();
+  connection.sent = 0;
+  connection.lastActive = std::chrono::steady_clock::now();
+  watch(reactor, clientSocket, false);
+  // A pipelined request may already be waiting in the buffer
+  dispatchRequest(reactor, clientSocket);
+}
+
+void NexusRegistryServer::closeIdleClients(Reactor &reactor) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<int> idle;
+  for (const auto &entry : reactor.connections) {
+    const Connection &connection = entry.second;
+    if (!connection.busy && connection.outHeader.empty() &&
+        now - connection.lastActive > REGISTRY_IDLE_TIMEOUT) {
+      idle.push_back(entry.first);
+    }
+  }
+  for (int clientSocket : idle) {
+    closeClient(reactor, clientSocket);
+  }
+}
+
+void NexusRegistryServer::closeClient(Reactor &reactor, int clientSocket) {
+  // Closing the fd also drops it from the epoll set
+  close(clientSocket);
+  if (reactor.connections.erase(clientSocket)) {
+    metrics.connectionClosed();
+  }
+}
+
+std::shared_ptr<const std::string>
+NexusRegistryServer::processRequest(const std::string &request,
+                                    Subscription &origin,
+                                    RegistryStatus &status) {
+  std::string response;
   Json::Reader reader;
   Json::Value root;
-  if (!reader.parse(request, root)) {
+  if (!reader.parse(request, root) || !root.isObject()) {
+    origin.action = RegistryAction::INVALID;
     response = R"({"error": "Invalid JSON format"})";
-    return;
+    return std::make_shared<const std::string>(std::move(response));
   }
 
   std::string action = root["action"].asString();
+  origin.action = RegistryMetrics::actionNamed(action);
 
-  if (action == "register") {
-    std::pair<double, double> coords = {
-        roundToTwoDecimalPlaces(std::stod(root["x"].asString())),
-        roundToTwoDecimalPlaces(std::stod(root["y"].asString()))};
-
-    NodeInfo node = {root["type"].asString(), root["name"].asString(),
-                     root["ip"].asString(),   coords,
-                     root["port"].asInt(),    root["publicKey"].asString()};
+  NodeInfo node{};
+  if ((action == "register" || action == "update") &&
+      !parseNode(root, action == "register", node)) {
+    status = RegistryStatus::BAD_REQUEST;
+    response = R"({"error": "Invalid node"})";
+  } else if (action == "register") {
     registerNode(node);
     response = R"({"message": "Node registered successfully"})";
   } else if (action == "deregister") {
     deregisterNode(root["name"].asString());
     response = R"({"message": "Node deregistered successfully"})";
   } else if (action == "list") {
-    response = getNodeList();
+    // as*() throws on values of the wrong type, so those are turned away
+    const Json::Value &epoch = root["epoch"];
+    const Json::Value &wait = root["wait"];
+    if (root.isMember("since") &&
+        (!root["since"].isUInt64() || !(epoch.isNull() || epoch.isUInt64()) ||
+         !(wait.isNull() || wait.isInt()))) {
+      status = RegistryStatus::BAD_REQUEST;
+      response = R"({"error": "Invalid list request"})";
+    } else if (root.isMember("since")) {
+      origin.epoch = root["epoch"].asUInt64();
+      origin.since = root["since"].asUInt64();
+      int wait = std::min(root["wait"].asInt(), REGISTRY_MAX_WAIT_MS);
+      if (wait > 0 && subscribe(origin, wait)) {
+        return nullptr;
+      }
+      response = getNodeChanges(origin.epoch, origin.since, false);
+    } else {
+      origin.list = getNodeList();
+      return std::shared_ptr<const std::string>(origin.list,
+                                                &origin.list->body);
+    }
   } else if (action == "update") {
-    NodeInfo node = {
-        root["type"].asString(), root["name"].asString(),
-        root["ip"].asString(),   {root["x"].asDouble(), root["y"].asDouble()},
-        root["port"].asInt(),    root["publicKey"].asString()};
-    ;
     updateNode(node);
     response = R"({"message":"Node updated successfully"})";
+  } else if (action == "renew") {
+    if (renewNode(root["name"].asString())) {
+      response = R"({"message": "Lease renewed"})";
+    } else {
+      response = R"({"error": "Node not found"})";
+    }
+  } else if (action == "batch") {
+    std::vector<NodeMutation> batch;
+    std::vector<size_t> positions; // Of each valid request in the batch
+    const Json::Value &requests = root["requests"];
+    for (Json::ArrayIndex i = 0; requests.isArray() && i < requests.size();
+         i++) {
+      NodeMutation mutation;
+      if (parseMutation(requests[i], mutation)) {
+        batch.push_back(std::move(mutation));
+        positions.push_back(i);
+      }
+    }
+
+    std::vector<bool> results = applyBatch(batch);
+    Json::Value reply;
+    reply["results"] = Json::Value(Json::arrayValue);
+    for (Json::ArrayIndex i = 0; requests.isArray() && i < requests.size();
+         i++) {
+      reply["results"][i] = "bad request";
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+      reply["results"][static_cast<Json::ArrayIndex>(positions[i])] =
+          results[i] ? "ok" : "not found";
+    }
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    response = Json::writeString(writer, reply);
+  } else if (action == "near" || action == "nearest") {
+    const Json::Value &x = root["x"];
+    const Json::Value &y = root["y"];
+    const Json::Value &radius = root["radius"];
+    bool near = action == "near";
+    if (!x.isNumeric() || !y.isNumeric() ||
+        !(near ? radius.isNumeric() : root["k"].isUInt()) ||
+        !validQuery({x.asDouble(), y.asDouble()},
+                    near ? radius.asDouble() : 0)) {
+      status = RegistryStatus::BAD_REQUEST;
+      response = R"({"error": "Invalid spatial query"})";
+    } else if (near) {
+      response = serializeNodes(
+          store.within({x.asDouble(), y.asDouble()}, radius.asDouble()),
+          false);
+    } else {
+      uint32_t k = std::min(root["k"].asUInt(), REGISTRY_MAX_NEAREST);
+      response = serializeNodes(
+          store.nearest({x.asDouble(), y.asDouble()}, k), false);
+    }
   } else if (action == "getPublicKey") {
     std::string nodeName = root["name"].asString();
     auto node = findNodeByName(nodeName);
@@ -103,80 +888,530 @@ void NexusRegistryServer::processRequest(const std::string &request,
   } else {
     response = R"({"error": "Unknown action"})";
   }
+  return std::make_shared<const std::string>(std::move(response));
 }
 
 void NexusRegistryServer::registerNode(const NodeInfo &node) {
-  std::lock_guard<std::mutex> lock(nodesMutex);
-  nodes.push_back(node);
-  logger.log(LogLevel::INFO, "Registered node: " + node.type + " " + node.name +
-                                 " (" + node.ip + ":" +
-                                 std::to_string(node.port) + ")" + " at [" +
-                                 std::to_string(node.coords.first) + ", " +
-                                 std::to_string(node.coords.second) + "].");
+  bool inserted = store.upsert(node);
+  renewLease(node.name);
+  logger.log(LogLevel::INFO,
+             std::string(inserted ? "Registered" : "Re-registered") +
+                 " node: " + node.type + " " + node.name + " (" + node.ip +
+                 ":" + std::to_string(node.port) + ")" + " at [" +
+                 std::to_string(node.coords.first) + ", " +
+                 std::to_string(node.coords.second) + "].");
+  notifySubscribers();
 }
 
 void NexusRegistryServer::deregisterNode(const std::string &name) {
-  std::lock_guard<std::mutex> lock(nodesMutex);
-  nodes.erase(std::remove_if(
-                  nodes.begin(), nodes.end(),
-                  [&name](const NodeInfo &node) { return node.name == name; }),
-              nodes.end());
+  if (store.remove(name)) {
+    notifySubscribers();
+  }
+  {
+    std::lock_guard<std::mutex> lock(leasesMutex);
+    leases.cancel(name);
+  }
   logger.log(LogLevel::INFO, "Deregistered node: " + name);
 }
 
 void NexusRegistryServer::updateNode(const NodeInfo &node) {
-  std::lock_guard<std::mutex> lock(nodesMutex);
-  bool nodeUpdated = false;
-
-  for (auto &existingNode : nodes) {
-    if (existingNode.name == node.name) {
-      existingNode.type = node.type;
-      existingNode.ip = node.ip;
-      existingNode.coords = node.coords;
-      existingNode.port = node.port;
-      existingNode.publicKey = node.publicKey;
-      nodeUpdated = true;
-      logger.log(LogLevel::INFO, "Updated node: " + node.name + " (" + node.ip +
-                                     ":" + std::to_string(node.port) +
-                                     ") at [" +
-                                     std::to_string(node.coords.first) + ", " +
-                                     std::to_string(node.coords.second) + "].");
+  if (store.update(node)) {
+    renewLease(node.name);
+    logger.log(LogLevel::INFO, "Updated node: " + node.name + " (" + node.ip +
+                                   ":" + std::to_string(node.port) + ") at [" +
+                                   std::to_string(node.coords.first) + ", " +
+                                   std::to_string(node.coords.second) + "].");
+    notifySubscribers();
+  } else {
+    logger.log(LogLevel::WARNING,
+               "Node not found for update: " + node.name + ".");
+  }
+}
+
+bool NexusRegistryServer::moveNode(const std::string &name,
+                                   const std::pair<double, double> &coords) {
+  if (!store.move(name, coords)) {
+    logger.log(LogLevel::WARNING, "Node not found for move: " + name + ".");
+    return false;
+  }
+  renewLease(name);
+  notifySubscribers();
+  return true;
+}
+
+std::vector<bool>
+NexusRegistryServer::applyBatch(const std::vector<NodeMutation> &batch) {
+  std::vector<bool> results = store.apply(batch);
+  bool changed = false;
+  {
+    uint64_t expiry = leaseTick() + leaseSeconds;
+    std::lock_guard<std::mutex> lock(leasesMutex);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!results[i]) {
+        continue;
+      }
+      if (batch[i].kind == NodeMutation::REMOVE) {
+        leases.cancel(batch[i].node.name);
+      } else {
+        leases.schedule(batch[i].node.name, expiry);
+      }
+      changed = changed || batch[i].kind != NodeMutation::TOUCH;
+    }
+  }
+
+  logger.log(LogLevel::DEBUG, "Applied a batch of " +
+                                  std::to_string(batch.size()) + " changes.");
+  if (changed) {
+    notifySubscribers();
+  }
+  return results;
+}
+
+bool NexusRegistryServer::parseMutation(uint8_t op, const std::string &payload,
+                                        NodeMutation &mutation) {
+  WireReader in(payload.data(), payload.size());
+  mutation.node = NodeInfo{};
+  switch (static_cast<RegistryOp>(op)) {
+  case RegistryOp::REGISTER:
+    mutation.kind = NodeMutation::UPSERT;
+    in.node(mutation.node);
+    break;
+  case RegistryOp::MOVE:
+    mutation.kind = NodeMutation::MOVE;
+    in.str(mutation.node.name);
+    in.f64(mutation.node.coords.first);
+    in.f64(mutation.node.coords.second);
+    break;
+  case RegistryOp::DEREGISTER:
+    mutation.kind = NodeMutation::REMOVE;
+    in.str(mutation.node.name);
+    break;
+  case RegistryOp::RENEW:
+    mutation.kind = NodeMutation::TOUCH;
+    in.str(mutation.node.name);
+    break;
+  default:
+    return false;
+  }
+  return in.ok() && in.done();
+}
+
+bool NexusRegistryServer::parseMutation(const Json::Value &request,
+                                        NodeMutation &mutation) {
+  if (!request.isObject() || !request["action"].isString()) {
+    return false;
+  }
+  std::string action = request["action"].asString();
+  mutation.node = NodeInfo{};
+  if (action == "register" || action == "update") {
+    mutation.kind = action == "register" ? NodeMutation::UPSERT
+                                         : NodeMutation::UPDATE;
+    if (!parseNode(request, action == "register", mutation.node)) {
+      return false;
+    }
+  } else if (action == "deregister" || action == "renew") {
+    mutation.kind = action == "deregister" ? NodeMutation::REMOVE
+                                           : NodeMutation::TOUCH;
+    if (!request["name"].isString()) {
+      return false;
+    }
+    mutation.node.name = request["name"].asString();
+  } else {
+    return false;
+  }
+  return !mutation.node.name.empty();
+}
+
+bool NexusRegistryServer::renewNode(const std::string &name) {
+  // An expiry racing this may still drop the node; the client then sees
+  // it gone on its next renewal and registers again
+  if (!store.contains(name)) {
+    return false;
+  }
+  renewLease(name);
+  return true;
+}
+
+std::shared_ptr<const std::string>
+NexusRegistryServer::processFrame(const std::string &frame,
+                                  Subscription &origin,
+                                  RegistryStatus &status) {
+  WireReader in(frame.data(), frame.size());
+  WireWriter out;
+  uint8_t op = 0;
+  in.u8(op);
+  origin.action = RegistryMetrics::actionForOp(op);
+
+  // Every field is read before acting, so a short frame changes nothing
+  switch (static_cast<RegistryOp>(op)) {
+  case RegistryOp::REGISTER: {
+    NodeInfo node{};
+    if (in.node(node) && in.done()) {
+      registerNode(node);
+      return std::make_shared<const std::string>();
+    }
+    break;
+  }
+  case RegistryOp::MOVE: {
+    std::string name;
+    std::pair<double, double> coords;
+    in.str(name);
+    in.f64(coords.first);
+    if (in.f64(coords.second) && in.done()) {
+      if (!moveNode(name, coords)) {
+        status = RegistryStatus::NOT_FOUND;
+      }
+      return std::make_shared<const std::string>();
+    }
+    break;
+  }
+  case RegistryOp::DEREGISTER: {
+    std::string name;
+    if (in.str(name) && in.done()) {
+      deregisterNode(name);
+      return std::make_shared<const std::string>();
+    }
+    break;
+  }
+  case RegistryOp::LIST: {
+    uint32_t wait = 0;
+    in.u64(origin.epoch);
+    in.u64(origin.since);
+    if (in.u32(wait) && in.done()) {
+      int waitMs = static_cast<int>(std::min<uint32_t>(
+          wait, static_cast<uint32_t>(REGISTRY_MAX_WAIT_MS)));
+      if (waitMs > 0 && subscribe(origin, waitMs)) {
+        return nullptr;
+      }
+      return std::make_shared<const std::string>(
+          getNodeChanges(origin.epoch, origin.since, true));
+    }
+    break;
+  }
+  case RegistryOp::RENEW: {
+    std::string name;
+    if (in.str(name) && in.done()) {
+      if (!renewNode(name)) {
+        status = RegistryStatus::NOT_FOUND;
+      }
+      return std::make_shared<const std::string>();
+    }
+    break;
+  }
+  case RegistryOp::BATCH: {
+    uint32_t count = 0;
+    in.u32(count);
+    std::vector<NodeMutation> batch;
+    std::vector<RegistryStatus> statuses;
+    std::vector<size_t> positions; // Of each valid request in statuses
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+      uint8_t requestOp = 0;
+      uint32_t length = 0;
+      std::string payload;
+      in.u8(requestOp);
+      in.u32(length);
+      NodeMutation mutation;
+      if (in.bytes(payload, length) &&
+          parseMutation(requestOp, payload, mutation)) {
+        positions.push_back(statuses.size());
+        batch.push_back(std::move(mutation));
+      }
+      statuses.push_back(RegistryStatus::BAD_REQUEST);
+    }
+    if (!in.ok() || !in.done()) {
       break;
     }
+
+    std::vector<bool> results = applyBatch(batch);
+    for (size_t i = 0; i < batch.size(); i++) {
+      statuses[positions[i]] =
+          results[i] ? RegistryStatus::OK : RegistryStatus::NOT_FOUND;
+    }
+    out.u32(static_cast<uint32_t>(statuses.size()));
+    for (auto requestStatus : statuses) {
+      out.u8(static_cast<uint8_t>(requestStatus));
+    }
+    return std::make_shared<const std::string>(out.release());
+  }
+  case RegistryOp::NEAR: {
+    std::pair<double, double> center;
+    double radius = 0;
+    in.f64(center.first);
+    in.f64(center.second);
+    if (in.f64(radius) && in.done() && validQuery(center, radius)) {
+      return std::make_shared<const std::string>(
+          serializeNodes(store.within(center, radius), true));
+    }
+    break;
+  }
+  case RegistryOp::NEAREST: {
+    std::pair<double, double> center;
+    uint32_t k = 0;
+    in.f64(center.first);
+    in.f64(center.second);
+    if (in.u32(k) && in.done() && validQuery(center, 0)) {
+      k = std::min(k, REGISTRY_MAX_NEAREST);
+      return std::make_shared<const std::string>(
+          serializeNodes(store.nearest(center, k), true));
+    }
+    break;
+  }
+  case RegistryOp::GET_PUBLIC_KEY: {
+    std::string name;
+    NodeInfo node{};
+    if (in.str(name) && in.done()) {
+      if (store.find(name, node)) {
+        out.str(node.publicKey);
+      } else {
+        status = RegistryStatus::NOT_FOUND;
+      }
+      return std::make_shared<const std::string>(out.release());
+    }
+    break;
+  }
   }
 
-  if (!nodeUpdated) {
-    logger.log(LogLevel::WARNING,
-               "Node not found for update: " + node.name + ".");
+  origin.action = RegistryAction::INVALID;
+  status = RegistryStatus::BAD_REQUEST;
+  return std::make_shared<const std::string>();
+}
+
+// Holds a list request that has nothing new to return yet, or that is
+// behind while changes are about to be sent to the held lists anyway.
+// Checked under subscriptionsMutex, which notifySubscribers takes after
+// every mutation, so a change can not slip in between the check and the
+// wait.
+bool NexusRegistryServer::subscribe(Subscription subscription, int waitMs) {
+  std::lock_guard<std::mutex> lock(subscriptionsMutex);
+  if ((subscription.epoch != store.epoch() ||
+       subscription.since != store.currentVersion()) &&
+      !notifyPending) {
+    return false;
+  }
+  subscription.deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+  subscription.action = RegistryAction::WATCH;
+  subscriptions.push_back(subscription);
+  return true;
+}
+
+// Called after every mutation. Held lists are answered
+// REGISTRY_WATCH_COALESCE_MS after the first change rather than on each, as
+// every answer brings its client straight back with a new poll.
+void NexusRegistryServer::notifySubscribers() {
+  {
+    std::lock_guard<std::mutex> lock(subscriptionsMutex);
+    if (notifyPending || subscriptions.empty()) {
+      return;
+    }
+    notifyAt = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(REGISTRY_WATCH_COALESCE_MS);
+    notifyPending = true;
+  }
+  // The first reactor may be asleep for a whole sweep
+  char wake = 0;
+  if (write(reactors[0]->wakePipe[1], &wake, 1) < 0) {
+    // Pipe full, a wake-up is already pending
+  }
+}
+
+int NexusRegistryServer::flushTimeout() {
+  if (!notifyPending) {
+    return REGISTRY_SWEEP_MS;
+  }
+  std::lock_guard<std::mutex> lock(subscriptionsMutex);
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  notifyAt - std::chrono::steady_clock::now())
+                  .count();
+  // Rounded up, so the reactor does not spin just before notifyAt
+  return static_cast<int>(
+      std::max<long long>(0, std::min<long long>(left + 1, REGISTRY_SWEEP_MS)));
+}
+
+// Most subscribers are at the same version, so each distinct delta is built
+// once. Lists held since the last change stay held.
+void NexusRegistryServer::flushSubscribers() {
+  if (!notifyPending) {
+    return;
+  }
+  auto ready = std::make_shared<std::vector<Subscription>>();
+  {
+    std::lock_guard<std::mutex> lock(subscriptionsMutex);
+    if (std::chrono::steady_clock::now() < notifyAt) {
+      return;
+    }
+    notifyPending = false;
+    uint64_t epoch = store.epoch();
+    uint64_t version = store.currentVersion();
+    auto it = std::partition(subscriptions.begin(), subscriptions.end(),
+                             [&](const Subscription &subscription) {
+                               return subscription.epoch == epoch &&
+                                      subscription.since == version;
+                             });
+    ready->assign(it, subscriptions.end());
+    subscriptions.erase(it, subscriptions.end());
+  }
+  if (ready->empty()) {
+    return;
+  }
+
+  workers->submit([this, ready]() {
+    std::map<std::pair<uint64_t, bool>, std::shared_ptr<const std::string>>
+        deltas;
+    for (const auto &subscription : *ready) {
+      auto &body = deltas[std::make_pair(subscription.since,
+                                         subscription.binary)];
+      if (!body) {
+        body = std::make_shared<const std::string>(getNodeChanges(
+            subscription.epoch, subscription.since, subscription.binary));
+      }
+      respond(subscription, body);
+    }
+  });
+}
+
+// Held requests that saw no change in time get an empty delta back
+void NexusRegistryServer::expireSubscriptions(Reactor &reactor) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<Subscription> expired;
+  {
+    std::lock_guard<std::mutex> lock(subscriptionsMutex);
+    auto it = std::partition(subscriptions.begin(), subscriptions.end(),
+                             [&](const Subscription &subscription) {
+                               return subscription.reactor != &reactor ||
+                                      subscription.deadline > now;
+                             });
+    expired.assign(it, subscriptions.end());
+    subscriptions.erase(it, subscriptions.end());
+  }
+
+  for (const auto &subscription : expired) {
+    NodeChanges none;
+    none.epoch = subscription.epoch;
+    none.version = subscription.since;
+    respond(subscription, std::make_shared<const std::string>(serializeChanges(
+                              none, subscription.binary)));
   }
 }
 
 NodeInfo NexusRegistryServer::findNodeByName(const std::string &name) {
-  std::lock_guard<std::mutex> lock(nodesMutex);
+  NodeInfo node{"", "", "", {0.0, 0.0}, 0, ""};
+  store.find(name, node);
+  return node;
+}
 
-  for (const auto &node : nodes) {
-    if (node.name == name) {
-      return node;
+// Numbers, or numbers in strings as registrations have always been sent
+static bool parseCoordinate(const Json::Value &value, double &coordinate) {
+  if (value.isNumeric()) {
+    coordinate = value.asDouble();
+  } else if (value.isString()) {
+    std::string text = value.asString();
+    char *end = nullptr;
+    coordinate = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0') {
+      return false;
     }
+  } else {
+    return false;
   }
+  return std::isfinite(coordinate);
+}
 
-  return NodeInfo{"", "", "", {0.0, 0.0}, 0, ""};
+// Strings, or absent; numbers still read as their text
+static bool parseText(const Json::Value &value, std::string &text) {
+  if (!value.isConvertibleTo(Json::stringValue)) {
+    return false;
+  }
+  text = value.asString();
+  return true;
+}
+
+bool NexusRegistryServer::parseNode(const Json::Value &root, bool registering,
+                                    NodeInfo &node) {
+  const Json::Value &port = root["port"];
+  if (!parseText(root["type"], node.type) ||
+      !parseText(root["name"], node.name) || !parseText(root["ip"], node.ip) ||
+      !parseText(root["publicKey"], node.publicKey) ||
+      !parseCoordinate(root["x"], node.coords.first) ||
+      !parseCoordinate(root["y"], node.coords.second) ||
+      !(port.isNull() || port.isInt()) || !parseGroups(root, node.groups)) {
+    return false;
+  }
+  node.port = port.asInt();
+  // Registrations have always been rounded
+  if (registering) {
+    node.coords = {roundToTwoDecimalPlaces(node.coords.first),
+                   roundToTwoDecimalPlaces(node.coords.second)};
+  }
+  return !node.name.empty();
+}
+
+bool NexusRegistryServer::parseGroups(const Json::Value &root,
+                                      std::vector<std::string> &groups) {
+  groups.clear();
+  const Json::Value &list = root["groups"];
+  if (!list.isArray()) {
+    return true; // Anything else has always been taken as no groups
+  }
+  for (const auto &group : list) {
+    if (!group.isString()) {
+      return false;
+    }
+    groups.push_back(group.asString());
+  }
+  return true;
 }
 
-std::string NexusRegistryServer::getNodeList() {
-  std::lock_guard<std::mutex> lock(nodesMutex);
+static Json::Value nodeToJson(const NodeInfo &node) {
+  Json::Value n;
+  n["type"] = node.type;
+  n["name"] = node.name;
+  n["ip"] = node.ip;
+  n["port"] = node.port;
+  n["x"] = node.coords.first;
+  n["y"] = node.coords.second;
+  n["publicKey"] = node.publicKey;
+  for (const auto &group : node.groups) {
+    n["groups"].append(group);
+  }
+  return n;
+}
+
+// Serialized list shared by every reader until the store changes. Rebuilds
+// happen one at a time and at most every REGISTRY_LIST_CACHE_MS, so polls
+// that pile up during a burst of updates are served from one build.
+std::shared_ptr<const NexusRegistryServer::ListCache>
+NexusRegistryServer::getNodeList() {
+  auto now = std::chrono::steady_clock::now();
+  auto fresh = [&](const std::shared_ptr<const ListCache> &cache) {
+    return cache && (cache->version >= store.currentVersion() ||
+                     now - cache->builtAt <
+                         std::chrono::milliseconds(REGISTRY_LIST_CACHE_MS));
+  };
+
+  auto cache = std::atomic_load(&listCache);
+  if (!fresh(cache)) {
+    std::lock_guard<std::mutex> lock(listCacheMutex);
+    cache = std::atomic_load(&listCache);
+    if (!fresh(cache)) {
+      auto rebuilt = std::make_shared<ListCache>();
+      // Taken before the snapshot, which thus holds at least this version
+      rebuilt->version = store.currentVersion();
+      rebuilt->builtAt = std::chrono::steady_clock::now();
+      rebuilt->body = buildNodeList();
+      rebuilt->etag = entityTag(rebuilt->body);
+      cache = rebuilt;
+      std::atomic_store(&listCache, cache);
+    }
+  }
+  return cache;
+}
+
+std::string NexusRegistryServer::buildNodeList() {
   Json::Value root;
   try {
-    for (const auto &node : nodes) {
-      Json::Value n;
-      n["type"] = node.type;
-      n["name"] = node.name;
-      n["ip"] = node.ip;
-      n["port"] = node.port;
-      n["x"] = node.coords.first;
-      n["y"] = node.coords.second;
-      n["publicKey"] = node.publicKey;
-      root.append(n);
+    for (const auto &node : store.snapshot()) {
+      root.append(nodeToJson(node));
     }
   } catch (const std::exception &e) {
     logger.log(LogLevel::ERROR,
@@ -187,41 +1422,109 @@ std::string NexusRegistryServer::getNodeList() {
   return Json::writeString(writer, root);
 }
 
-std::string NexusRegistryServer::readFromSocket(int socket) {
-  char buffer[4096]; // Increased buffer size for larger requests
-  int bytesRead = recv(socket, buffer, sizeof(buffer) - 1, 0);
-  if (bytesRead <= 0)
-    return "";
+std::string NexusRegistryServer::buildMetrics() {
+  size_t leaseCount;
+  {
+    std::lock_guard<std::mutex> lock(leasesMutex);
+    leaseCount = leases.size();
+  }
+  size_t watchCount;
+  {
+    std::lock_guard<std::mutex> lock(subscriptionsMutex);
+    watchCount = subscriptions.size();
+  }
+
+  // Queued work and lock waits climb before requests start timing out
+  std::vector<RegistryMetrics::Sample> samples = {
+      {"nexus_registry_nodes", "gauge", "Registered nodes.",
+       static_cast<double>(store.size())},
+      {"nexus_registry_leases", "gauge", "Node leases not yet expired.",
+       static_cast<double>(leaseCount)},
+      {"nexus_registry_watches", "gauge",
+       "List requests held until the nodes change.",
+       static_cast<double>(watchCount)},
+      {"nexus_registry_worker_queue", "gauge",
+       "Requests waiting for a worker thread.",
+       static_cast<double>(workers->queued())},
+      {"nexus_registry_store_lock_waits_total", "counter",
+       "Node store shard locks found already held.",
+       static_cast<double>(store.lockWaits())},
+      {"nexus_registry_store_lock_wait_seconds_total", "counter",
+       "Time spent waiting for node store shard locks.",
+       store.lockWaitNanos() / 1e9},
+      {"nexus_registry_uptime_seconds", "gauge",
+       "Seconds since the registry started.",
+       static_cast<double>(leaseTick())}};
+  return metrics.render(samples);
+}
+
+std::string NexusRegistryServer::getNodeChanges(uint64_t epoch, uint64_t since,
+                                                bool binary) {
+  return serializeChanges(store.changesSince(epoch, since), binary);
+}
 
-  buffer[bytesRead] = '\0'; // Null-terminate the string
-  std::string request(buffer);
+bool NexusRegistryServer::validQuery(const std::pair<double, double> &center,
+                                     double radius) {
+  // Comparisons with NaN are false, so NaN fails too
+  return std::fabs(center.first) <= REGISTRY_MAX_EXTENT &&
+         std::fabs(center.second) <= REGISTRY_MAX_EXTENT && radius >= 0 &&
+         radius <= REGISTRY_MAX_EXTENT;
+}
 
-  // Find the double CRLF that separates headers from the body
-  size_t bodyPos = request.find("\r\n\r\n");
-  if (bodyPos != std::string::npos) {
-    return request.substr(bodyPos + 4); // Extract the body
+std::string
+NexusRegistryServer::serializeNodes(const std::vector<NodeInfo> &nodes,
+                                    bool binary) {
+  if (binary) {
+    WireWriter out;
+    out.u32(static_cast<uint32_t>(nodes.size()));
+    for (const auto &node : nodes) {
+      out.node(node);
+    }
+    return out.release();
   }
 
-  return ""; // No request body found
+  Json::Value root(Json::arrayValue);
+  for (const auto &node : nodes) {
+    root.append(nodeToJson(node));
+  }
+  Json::StreamWriterBuilder writer;
+  return Json::writeString(writer, root);
 }
 
-void NexusRegistryServer::writeToSocket(int socket,
-                                        const std::string &response) {
-  std::string httpResponse = "HTTP/1.1 200 OK\r\n"
-                             "Content-Type: application/json\r\n"
-                             "Content-Length: " +
-                             std::to_string(response.size()) +
-                             "\r\n"
-                             "\r\n" +
-                             response;
+std::string NexusRegistryServer::serializeChanges(const NodeChanges &changes,
+                                                  bool binary) {
+  if (binary) {
+    WireWriter out;
+    out.changes(changes);
+    return out.release();
+  }
 
-  send(socket, httpResponse.c_str(), httpResponse.size(), 0);
+  Json::Value root;
+  root["epoch"] = Json::UInt64(changes.epoch);
+  root["version"] = Json::UInt64(changes.version);
+  root["full"] = changes.full;
+  root["nodes"] = Json::Value(Json::arrayValue);
+  root["removed"] = Json::Value(Json::arrayValue);
+  for (const auto &node : changes.nodes) {
+    root["nodes"].append(nodeToJson(node));
+  }
+  for (const auto &name : changes.removed) {
+    root["removed"].append(name);
+  }
+  Json::StreamWriterBuilder writer;
+  return Json::writeString(writer, root);
 }
 
-void NexusRegistryServer::handleClient(int clientSocket) {
-  std::string request = readFromSocket(clientSocket);
-  std::string response;
-  processRequest(request, response);
-  writeToSocket(clientSocket, response);
-  close(clientSocket);
+std::string NexusRegistryServer::buildResponseHeader(const std::string &status,
+                                                     size_t contentLength,
+                                                     bool keepAlive,
+                                                     const char *contentType,
+                                                     const std::string
+                                                         &extraHeaders) {
+  return "HTTP/1.1 " + status + "\r\n" + "Content-Type: " + contentType +
+         "\r\n"
+         "Content-Length: " +
+         std::to_string(contentLength) + "\r\n" + extraHeaders +
+         (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+         "\r\n";
 }
@@ -1,8 +1,11 @@
 #ifndef NEXUS_REGISTRY_SERVER_H
 #define NEXUS_REGISTRY_SERVER_H
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <json/json.h>
+#include <memory>
 #include <mutex>
 #include <netinet/in.h>
 #include <string>
@@ -11,43 +14,215 @@
 #include <unordered_map>
 #include <vector>
 
+#include "HttpParser.h"
 #include "Logger.h"
+#include "NodeStore.h"
+#include "RegistryLog.h"
+#include "RegistryMetrics.h"
+#include "ThreadPool.h"
+#include "TimerWheel.h"
 #include "Utility.h"
 
-struct NodeInfo {
-  std::string type;
-  std::string name;
-  std::string ip;
-  std::pair<double, double> coords;
-  int port;
-  std::string publicKey;
-};
+constexpr int REGISTRY_DEFAULT_BACKLOG = 1024;
+constexpr size_t REGISTRY_MAX_REQUEST = 1 << 20; // Larger requests are dropped
+constexpr std::chrono::seconds REGISTRY_IDLE_TIMEOUT(30); // Keep-alive limit
+constexpr int REGISTRY_SWEEP_MS = 1000; // How often idle clients are swept
+constexpr int REGISTRY_LIST_CACHE_MS = 5; // How far list may lag mutations
+constexpr int REGISTRY_MAX_WAIT_MS = 60000; // Longest a list may be held
+// Held lists are answered this long after the first change, so a burst of
+// moves reaches each of them as one reply
+constexpr int REGISTRY_WATCH_COALESCE_MS = 100;
+// Nodes not heard from for this long are dropped, by default; any
+// register, update, move or renew extends the lease
+constexpr int REGISTRY_LEASE_SECONDS = 30;
+constexpr uint32_t REGISTRY_MAX_NEAREST = 10000; // Largest k of a query
+constexpr double REGISTRY_MAX_EXTENT = 1e9; // Largest |x|, |y| or radius
+// Smaller HTTP bodies are sent as they are even to clients taking gzip
+constexpr size_t REGISTRY_GZIP_MIN_BYTES = 1024;
 
 class NexusRegistryServer {
 public:
-  explicit NexusRegistryServer(int port);
+  // 0 reactors / workers means one per hardware thread. With a data
+  // directory the nodes are kept there and survive a restart.
+  explicit NexusRegistryServer(int port, int backlog = REGISTRY_DEFAULT_BACKLOG,
+                               unsigned reactors = 0, unsigned workers = 0,
+                               const std::string &dataDirectory = "",
+                               int leaseSeconds = REGISTRY_LEASE_SECONDS);
   ~NexusRegistryServer();
 
   void start();
   void stop();
 
 private:
-  int serverSocket{};
+  struct Reactor;
+
+  // Connection owned by a reactor; id tells apart sockets reusing an fd
+  struct Connection {
+    enum Protocol { UNKNOWN, HTTP, BINARY };
+
+    uint64_t id;
+    Protocol protocol = UNKNOWN; // Set from the first bytes received
+    std::string in;
+    size_t parsed = 0; // Bytes of in the parser has consumed
+    HttpParser parser;
+    std::string outHeader;
+    std::shared_ptr<const std::string> outBody; // May be shared with others
+    size_t sent = 0;
+    bool keepAlive = true;
+    bool busy = false; // Request handed to a worker
+    std::chrono::steady_clock::time_point lastActive;
+  };
+
+  struct Response {
+    int socket;
+    uint64_t id;
+    std::string header;
+    std::shared_ptr<const std::string> body;
+    bool keepAlive;
+  };
+
+  struct ListCache {
+    uint64_t version; // Store version the body is at least up to date with
+    std::chrono::steady_clock::time_point builtAt;
+    std::string body;
+    std::string etag; // Quoted hash of body
+    // body gzip-encoded, made by the first client that takes gzip
+    mutable std::once_flag compressOnce;
+    mutable std::string compressed;
+
+    const std::string &gzipped() const;
+  };
+
+  // Client waiting on a list request; epoch and since are the store version
+  // it has seen, deadline when to answer even if nothing changed
+  struct Subscription {
+    Reactor *reactor;
+    int socket;
+    uint64_t id;
+    bool keepAlive;
+    uint64_t epoch;
+    uint64_t since;
+    std::chrono::steady_clock::time_point deadline;
+    bool binary; // Answered in binary frames rather than HTTP
+    RegistryAction action;
+    std::chrono::steady_clock::time_point received; // When it was read
+    bool gzip;               // HTTP client accepts gzip-encoded bodies
+    std::string ifNoneMatch; // ETags the HTTP client already has
+    std::shared_ptr<const ListCache> list; // Set if answered with the list
+  };
+
+  // One event loop per core, each with its own SO_REUSEPORT listener so the
+  // kernel spreads accepts between them. Requests are parsed on the reactor,
+  // handled on the worker pool and the responses handed back to be written.
+  struct Reactor {
+    int listenSocket = -1;
+    int pollFd = -1;
+    int wakePipe[2] = {-1, -1};
+    std::thread thread;
+    std::unordered_map<int, Connection> connections;
+    uint64_t nextId = 0;
+    std::vector<Response> responses;
+    std::mutex responsesMutex;
+  };
+
   int port;
-  std::vector<NodeInfo> nodes;
-  std::mutex nodesMutex;
-  bool isRunning;
+  int backlog;
+  unsigned reactorCount;
+  unsigned workerCount;
+  std::vector<std::unique_ptr<Reactor>> reactors;
+  std::unique_ptr<ThreadPool> workers;
+  std::string dataDirectory;
+  int leaseSeconds;
+  NodeStore store;
+  std::unique_ptr<RegistryLog> log; // Journals store, if persistent
+  std::shared_ptr<const ListCache> listCache; // Swapped atomically
+  std::mutex listCacheMutex;                  // Held while rebuilding
+  std::vector<Subscription> subscriptions;
+  std::mutex subscriptionsMutex;
+  // Set while changes wait to be sent to the held lists, which the first
+  // reactor does at notifyAt (guarded by subscriptionsMutex)
+  std::atomic<bool> notifyPending{false};
+  std::chrono::steady_clock::time_point notifyAt;
+  TimerWheel leases; // Node name -> expiry, in seconds since startedAt
+  std::mutex leasesMutex;
+  RegistryMetrics metrics;
+  const std::chrono::steady_clock::time_point startedAt;
+  std::atomic<bool> isRunning;
+
+  bool openListener(Reactor &reactor);
+  void runReactor(Reactor &reactor);
+  void acceptClients(Reactor &reactor);
+  void readClient(Reactor &reactor, int clientSocket);
+  void dispatchRequest(Reactor &reactor, int clientSocket);
+  void writeClient(Reactor &reactor, int clientSocket);
+  void closeClient(Reactor &reactor, int clientSocket);
+  void closeIdleClients(Reactor &reactor);
+  void persistLog(); // Syncs the log and compacts it when due
+  void deliverResponses(Reactor &reactor);
+  void watch(Reactor &reactor, int socket, bool added);
+  void handleEvent(Reactor &reactor, int socket, bool readable, bool writable);
+  void dispatchFrame(Reactor &reactor, int clientSocket);
+  void respond(const Subscription &client,
+               std::shared_ptr<const std::string> body,
+               RegistryStatus status = RegistryStatus::OK,
+               const char *contentType = "application/json");
 
-  void handleClient(int clientSocket);
-  void processRequest(const std::string &request, std::string &response);
+  // Returns nullptr when the request was held as a subscription
+  std::shared_ptr<const std::string> processRequest(const std::string &request,
+                                                    Subscription &origin,
+                                                    RegistryStatus &status);
+  std::shared_ptr<const std::string> processFrame(const std::string &frame,
+                                                  Subscription &origin,
+                                                  RegistryStatus &status);
   void registerNode(const NodeInfo &node);
   void deregisterNode(const std::string &name);
   void updateNode(const NodeInfo &node);
+  bool moveNode(const std::string &name,
+                const std::pair<double, double> &coords);
+  bool renewNode(const std::string &name);
+  // Applies a batch request, renewing the leases of the nodes it touches
+  std::vector<bool> applyBatch(const std::vector<NodeMutation> &batch);
+  // Change carried by one request of a batch; false if it is not one
+  static bool parseMutation(uint8_t op, const std::string &payload,
+                            NodeMutation &mutation);
+  static bool parseMutation(const Json::Value &request,
+                            NodeMutation &mutation);
+  // False if a field has the wrong type or a coordinate is not finite
+  static bool parseNode(const Json::Value &root, bool registering,
+                        NodeInfo &node);
+  void renewLease(const std::string &name);
+  void expireLeases(); // Drops the nodes whose lease ran out
+  uint64_t leaseTick() const;
   NodeInfo findNodeByName(const std::string &name);
-  std::string getNodeList();
+  static bool parseGroups(const Json::Value &root,
+                          std::vector<std::string> &groups);
+  bool subscribe(Subscription subscription, int waitMs);
+  void notifySubscribers();
+  // Answers the held lists behind the store once notifyAt has passed
+  void flushSubscribers();
+  // How long the first reactor may wait for events, in milliseconds
+  int flushTimeout();
+  void expireSubscriptions(Reactor &reactor);
+  std::shared_ptr<const ListCache> getNodeList();
+  std::string buildNodeList();
+  // Prometheus text exposition of the request metrics and registry state
+  std::string buildMetrics();
+  // Nodes upserted and names removed after version since, as a JSON object
+  // or a binary LIST payload
+  std::string getNodeChanges(uint64_t epoch, uint64_t since, bool binary);
+  static std::string serializeChanges(const NodeChanges &changes, bool binary);
+  // Whether a spatial query's center and radius are finite and in range
+  static bool validQuery(const std::pair<double, double> &center,
+                         double radius);
+  // Answer to a spatial query, a JSON array or a binary count and nodes
+  static std::string serializeNodes(const std::vector<NodeInfo> &nodes,
+                                    bool binary);
 
-  static std::string readFromSocket(int socket);
-  static void writeToSocket(int socket, const std::string &response);
+  static std::string
+  buildResponseHeader(const std::string &status, size_t contentLength,
+                      bool keepAlive,
+                      const char *contentType = "application/json",
+                      const std::string &extraHeaders = "");
 };
 
 #endif // NEXUS_REGISTRY_SERVER_H
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <memory>
 
 #include "Logger.h"
@@ -8,14 +9,22 @@ Node::Node(NodeType::Type nodeType, std::string name, const std::string &ip,
            int port, std::pair<double, double> coords,
            const NetworkManager &networkManager)
     : type(nodeType), id(generateUUID()), name(std::move(name)), ip(ip),
-      port(port), coords(std::move(coords)), networkManager{networkManager},
-      cryptoManager(std::unique_ptr<CryptoManager>(new CryptoManager())) {
+      port(port), coords(std::move(coords)), networkManager{networkManager} {
   socket_fd = -1;
   std::memset(&addr, 0, sizeof(addr));
   addr.sin_family = AF_INET;
   addr.sin_port = htons(port);
   inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
   delay = 0;
+  // Start from wall-clock seconds so a restarted node outranks its old LSAs
+  lsaSequence = static_cast<uint32_t>(std::time(nullptr));
+  transferCount = 0;
+}
+
+CryptoManager &Node::crypto() const {
+  std::call_once(cryptoInit,
+                 [this]() { cryptoManager.reset(new CryptoManager()); });
+  return *cryptoManager;
 }
 
 std::string Node::getId() const { return id; }
@@ -23,13 +32,32 @@ std::string Node::getName() const { return name; }
 std::string Node::getIP() const { return ip; }
 int Node::getPort() const { return port; }
 
-std::pair<double, double> Node::getCoords() const { return coords; }
+std::pair<double, double> Node::getCoords() const {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  return coords;
+}
 void Node::setCoords(const std::pair<double, double> &newCoords) {
+  std::lock_guard<std::mutex> lock(stateMutex);
   coords = newCoords;
 }
 
 NodeType::Type Node::getType() const { return type; }
 
+std::vector<std::string> Node::getGroups() const {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  return groups;
+}
+void Node::setGroups(const std::vector<std::string> &newGroups) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  groups = newGroups;
+}
+
+std::string Node::addressToString(const struct sockaddr_in &addr) {
+  char ipStr[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr.sin_addr, ipStr, sizeof(ipStr));
+  return std::string(ipStr) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
 bool Node::bind() {
   // Create a UDP socket
   socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -58,19 +86,25 @@ bool Node::bind() {
 void Node::updatePosition() {
   if (type == NodeType::Type::SATELLITE) {
     // Satellite nodes move based on below logic
-    coords.first = roundToTwoDecimalPlaces(coords.first + 0.05);
-    coords.second = roundToTwoDecimalPlaces(coords.second + 0.075);
+    std::pair<double, double> position;
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      coords.first = roundToTwoDecimalPlaces(coords.first + 0.05);
+      coords.second = roundToTwoDecimalPlaces(coords.second + 0.075);
+      position = coords;
+    }
     logger.log(LogLevel::INFO, "[NEXUS] Satellite " + name +
                                    " new position: (" +
-                                   std::to_string(coords.first) + ", " +
-                                   std::to_string(coords.second) + ")");
+                                   std::to_string(position.first) + ", " +
+                                   std::to_string(position.second) + ")");
     networkManager.updateNodeInRegistry(shared_from_this());
   } else if (type == NodeType::Type::GROUND) {
     // Ground nodes are stationary
+    auto position = getCoords();
     logger.log(LogLevel::INFO, "[NEXUS] Ground node " + name +
                                    " remains stationary at (" +
-                                   std::to_string(coords.first) + ", " +
-                                   std::to_string(coords.second) + ")");
+                                   std::to_string(position.first) + ", " +
+                                   std::to_string(position.second) + ")");
   }
 }
 
@@ -81,8 +115,8 @@ void Node::receiveMessage(std::string &message) {
     return;
   }
 
-  // Added extra 32 for non payload data
-  constexpr size_t bufferSize = MAX_BUFFER_SIZE + 32;
+  // Added extra room for the header and source route
+  constexpr size_t bufferSize = MAX_BUFFER_SIZE + MAX_HEADER_SIZE;
   char buffer[bufferSize];
 
   struct sockaddr_in senderAddr {};
@@ -100,43 +134,80 @@ void Node::receiveMessage(std::string &message) {
 
   // Null-terminate the buffer to treat it as a string
   buffer[bytesReceived] = '\0';
-  std::vector<uint8_t> receivedMessage(buffer, buffer + bufferSize);
-  // logger.log(LogLevel::DEBUG,
-  //            "[NEXUS] Buffer size: " +
-  //            std::to_string(receivedMessage.size()));
-
-  char senderIP[INET_ADDRSTRLEN];
-  inet_ntop(AF_INET, &senderAddr.sin_addr, senderIP, sizeof(senderIP));
-  int senderPort = ntohs(senderAddr.sin_port);
-
-  std::string senderName, targetIP;
-  int targetPort = 0;
-  logger.log(LogLevel::INFO, "[NEXUS] Received packet from " +
-                                 std::string(senderIP) + ":" +
-                                 std::to_string(senderPort));
-  Packet pkt = pkt.deserialize(receivedMessage);
+  std::vector<uint8_t> receivedMessage(buffer, buffer + bytesReceived);
+
+  // Anything malformed, foreign or from another build is dropped here
+  Packet pkt;
+  if (!Packet::deserialize(receivedMessage, pkt)) {
+    logger.log(LogLevel::WARNING, "[NEXUS] Dropping malformed packet from " +
+                                      addressToString(senderAddr) + ".");
+    return;
+  }
+  if (pkt.type == packetType::LSA) {
+    handleLinkState(pkt, senderAddr);
+    return;
+  }
+  if (pkt.type == packetType::PROBE || pkt.type == packetType::PROBE_REPLY) {
+    handleProbe(pkt, senderAddr);
+    return;
+  }
+
+  logger.log(LogLevel::INFO,
+             "[NEXUS] Received packet from " + addressToString(senderAddr));
 
   if ((pkt.tAddress == addr.sin_addr.s_addr) && (pkt.tPort == htons(port))) {
     processMessage(pkt);
   } else {
-    char nextIP[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(pkt.tAddress), nextIP, sizeof(nextIP));
-    int nextPort = ntohs(pkt.tPort);
+    if (pkt.ttl <= 1) {
+      logger.log(LogLevel::WARNING, "[NEXUS] Hop limit reached, dropping packet.");
+      return;
+    }
+    pkt.ttl--;
+
+    struct sockaddr_in nextAddr = {};
+    nextAddr.sin_family = AF_INET;
+    if (pkt.forwarding != forwardMode::ROUTED) {
+      if (!networkManager.getGeographicNextHop(pkt, &senderAddr, nextAddr)) {
+        logger.log(LogLevel::WARNING,
+                   "[NEXUS] No neighbor to forward to, dropping packet.");
+        return;
+      }
+    } else if (!pkt.popNextHop(nextAddr.sin_addr.s_addr, nextAddr.sin_port)) {
+      // The route ended at us: we are the entry into the destination's area,
+      // or the sender had no path. Route onward from our own view if we can,
+      // else hand it straight to the final receiver.
+      struct sockaddr_in targetAddr = {};
+      targetAddr.sin_family = AF_INET;
+      targetAddr.sin_addr.s_addr = pkt.tAddress;
+      targetAddr.sin_port = pkt.tPort;
+
+      auto target = networkManager.findNode(targetAddr);
+      size_t flow = std::hash<uint64_t>()(
+          (static_cast<uint64_t>(pkt.sAddress) << 16) | pkt.sPort);
+      if (target == nullptr ||
+          !stampRoute(target->getName(), pkt, nextAddr, flow)) {
+        nextAddr = targetAddr;
+      }
+    }
 
-    logger.log(LogLevel::INFO, "[NEXUS] Forwarding to " + std::string(nextIP) +
-                                   ":" + std::to_string(nextPort));
-    sendTo(nextIP, nextPort, pkt);
+    logger.log(LogLevel::INFO,
+               "[NEXUS] Forwarding to " + addressToString(nextAddr));
+    sendTo(nextAddr, pkt);
   }
 }
 
 void Node::sendMessage(const std::string &targetName,
                        const std::string &message) {
-  auto targetNode = networkManager.findNode(targetName);
+  auto targetNode = networkManager.resolveTarget(targetName);
 
   if (targetNode == nullptr) {
     logger.log(LogLevel::ERROR, "[NEXUS] Node " + targetName + " not found.");
     return;
   }
+  if (targetNode->getName() != targetName) {
+    logger.log(LogLevel::INFO, "[NEXUS] Anycast " + targetName +
+                                   " resolved to " + targetNode->getName());
+  }
 
   logger.log(LogLevel::INFO, "[NEXUS] Node " + name + " sending message from " +
                                  ip + ":" + std::to_string(port));
@@ -165,15 +236,15 @@ void Node::sendMessage(const std::string &targetName,
     return;
   }
 
-  auto nextHop = networkManager.getNextHop(targetName);
-  if (!nextHop) {
+  struct sockaddr_in nextAddr = {};
+  size_t flow = flowKey(targetNode->getName(), ++transferCount);
+  if (!stampRoute(targetNode->getName(), pkt, nextAddr, flow)) {
     logger.log(LogLevel::ERROR, "No path to target found");
     return;
   }
-  std::cout << "Sending to " << nextHop->name << " " << nextHop->ip << ":"
-            << nextHop->port << std::endl;
+  std::cout << "Sending to " << addressToString(nextAddr) << std::endl;
 
-  sendTo(nextHop->getIP(), nextHop->getPort(), pkt);
+  sendTo(nextAddr, pkt);
 }
 
 void Node::sendTo(const std::string &targetIP, int targetPort, Packet &pkt) {
@@ -182,28 +253,149 @@ void Node::sendTo(const std::string &targetIP, int targetPort, Packet &pkt) {
   targetAddr.sin_port = htons(targetPort);
   inet_pton(AF_INET, targetIP.c_str(), &targetAddr.sin_addr);
 
+  sendTo(targetAddr, pkt);
+}
+
+void Node::sendTo(const struct sockaddr_in &targetAddr, Packet &pkt) {
+  if (transmit(targetAddr, pkt)) {
+    logger.log(LogLevel::INFO,
+               "[NEXUS] Sent packet to " + addressToString(targetAddr));
+  }
+}
+
+bool Node::transmit(const struct sockaddr_in &targetAddr, const Packet &pkt) {
   auto pkt_data = pkt.serialize();
 
-  const int bytesSent = sendto(socket_fd, pkt_data.data(), pkt_data.size(), 0,
-                               reinterpret_cast<struct sockaddr *>(&targetAddr),
-                               sizeof(targetAddr));
+  const int bytesSent =
+      sendto(socket_fd, pkt_data.data(), pkt_data.size(), 0,
+             reinterpret_cast<const struct sockaddr *>(&targetAddr),
+             sizeof(targetAddr));
 
   if (bytesSent < 0) {
     logger.log(LogLevel::ERROR,
                "Failed to send data: " + std::string(strerror(errno)));
-  } else {
-    logger.log(LogLevel::INFO, "[NEXUS] Sent packet to " + targetIP + ":" +
-                                   std::to_string(targetPort));
+    return false;
   }
+  return true;
+}
+
+void Node::advertiseLinkState() {
+  if (socket_fd < 0) {
+    return;
+  }
+
+  // The position thread may be moving us meanwhile
+  LinkStateAdvertisement lsa{name, type, ip, port, getCoords(), ++lsaSequence,
+                             LSA_MAX_TTL};
+  lsa.groups = getGroups();
+  std::vector<std::string> peers;
+  for (const auto &link : networkManager.getNeighborLinks()) {
+    peers.push_back(link.first);
+  }
+  lsa.links = linkMonitor.congestionFactors(peers);
+  // Keep our own entry fresh so it never ages out of the local view
+  networkManager.handleLinkState(lsa);
+  floodLinkState(lsa, nullptr);
+}
+
+void Node::handleLinkState(const Packet &pkt,
+                           const struct sockaddr_in &sender) {
+  LinkStateAdvertisement lsa;
+
+  if (!LinkStateAdvertisement::deserialize(pkt.payload(), lsa)) {
+    logger.log(LogLevel::WARNING, "[NEXUS] Malformed link state from " +
+                                      addressToString(sender));
+    return;
+  }
+
+  // Duplicates and stale copies stop here, which bounds the flood
+  if (lsa.name == name || !networkManager.handleLinkState(lsa) ||
+      lsa.ttl <= 1) {
+    return;
+  }
+
+  lsa.ttl--;
+  floodLinkState(lsa, &sender);
+}
+
+void Node::floodLinkState(const LinkStateAdvertisement &lsa,
+                          const struct sockaddr_in *exclude) {
+  std::string payload = lsa.serialize();
+
+  for (const auto &link : networkManager.getNeighborLinks()) {
+    const struct sockaddr_in &neighbor = link.second;
+    if ((neighbor.sin_addr.s_addr == addr.sin_addr.s_addr &&
+         neighbor.sin_port == addr.sin_port) ||
+        (exclude && neighbor.sin_addr.s_addr == exclude->sin_addr.s_addr &&
+         neighbor.sin_port == exclude->sin_port)) {
+      continue;
+    }
+
+    Packet pkt(addr.sin_addr.s_addr, addr.sin_port, neighbor.sin_addr.s_addr,
+               neighbor.sin_port, packetType::LSA);
+    pkt.setPayload(payload);
+    transmit(neighbor, pkt);
+  }
+}
+
+void Node::probeNeighbors() {
+  if (socket_fd < 0) {
+    return;
+  }
+
+  for (const auto &link : networkManager.getNeighborLinks()) {
+    // Payload format: sequence sentAtMicros peerName, echoed back verbatim
+    uint32_t sequence = linkMonitor.startProbe(link.first);
+    std::string payload = std::to_string(sequence) + " " +
+                          std::to_string(steadyMicros()) + " " + link.first;
+
+    Packet pkt(addr.sin_addr.s_addr, addr.sin_port,
+               link.second.sin_addr.s_addr, link.second.sin_port,
+               packetType::PROBE);
+    pkt.setPayload(payload);
+    transmit(link.second, pkt);
+  }
+}
+
+void Node::handleProbe(const Packet &pkt, const struct sockaddr_in &sender) {
+  if (pkt.type == packetType::PROBE) {
+    Packet reply(addr.sin_addr.s_addr, addr.sin_port, sender.sin_addr.s_addr,
+                 sender.sin_port, packetType::PROBE_REPLY);
+    reply.setPayload(pkt.payload());
+    transmit(sender, reply);
+    return;
+  }
+
+  std::istringstream iss(pkt.payload());
+  uint32_t sequence;
+  int64_t sentAt;
+  std::string peer;
+  if (!(iss >> sequence >> sentAt >> peer)) {
+    logger.log(LogLevel::WARNING, "[NEXUS] Malformed probe reply from " +
+                                      addressToString(sender));
+    return;
+  }
+
+  linkMonitor.recordReply(peer, sequence, (steadyMicros() - sentAt) / 1000.0);
+}
+
+int64_t Node::steadyMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
 void Node::sendFile(const std::string &targetName,
                     const std::string &fileName) {
-  auto targetNode = networkManager.findNode(targetName);
+  auto targetNode = networkManager.resolveTarget(targetName);
   if (targetNode == nullptr) {
     logger.log(LogLevel::ERROR, "[NEXUS] Node " + targetName + " not found.");
     return;
   }
+  if (targetNode->getName() != targetName) {
+    logger.log(LogLevel::INFO, "[NEXUS] Anycast " + targetName +
+                                   " resolved to " + targetNode->getName());
+  }
   logger.log(LogLevel::INFO, "[NEXUS] Node " + name + " sending message from " +
                                  ip + ":" + std::to_string(port));
 
@@ -230,6 +422,8 @@ void Node::sendFile(const std::string &targetName,
 
   fileHandle.seekg(0, std::ios::beg);
   int fragNumber = 1;
+  // One flow per file keeps all fragments on the same path
+  size_t flow = flowKey(targetNode->getName(), ++transferCount);
   std::array<uint8_t, MAX_BUFFER_SIZE> buffer;
 
   for (int i = 0; i < fragCount; i++) {
@@ -243,8 +437,12 @@ void Node::sendFile(const std::string &targetName,
     pkt.fragmentNumber = fragNumber++;
     pkt.data = buffer;
 
-    auto nextHop = networkManager.getNextHop(targetName);
-    sendTo(nextHop->getIP(), nextHop->getPort(), pkt);
+    struct sockaddr_in nextAddr = {};
+    if (!stampRoute(targetNode->getName(), pkt, nextAddr, flow)) {
+      logger.log(LogLevel::ERROR, "No path to target found");
+      break;
+    }
+    sendTo(nextAddr, pkt);
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 
@@ -252,6 +450,53 @@ void Node::sendFile(const std::string &targetName,
   logger.log(LogLevel::INFO, "[NEXUS] File sent.");
 }
 
+// Hashes (source, destination, transfer id) to pick one of the near-equal
+// cost paths for a flow.
+size_t Node::flowKey(const std::string &targetName, uint32_t transferId) const {
+  return std::hash<std::string>()(name + ">" + targetName + "#" +
+                                  std::to_string(transferId));
+}
+
+// Stamps the full path onto the packet so relays only pop the next hop.
+// Falls back to hop-by-hop forwarding when the path does not fit the header.
+// In geographic mode only the target's position is stamped.
+bool Node::stampRoute(const std::string &targetName, Packet &pkt,
+                      struct sockaddr_in &nextAddr, size_t flow) const {
+  if (networkManager.getRoutingMode() == RoutingMode::GEO) {
+    auto target = networkManager.findNode(targetName);
+    if (target == nullptr) {
+      return false;
+    }
+
+    // Relays only need where the target is
+    auto coords = target->getCoords();
+    pkt.setSourceRoute({});
+    pkt.forwarding = forwardMode::GREEDY;
+    pkt.targetX = static_cast<int32_t>(std::lround(coords.first));
+    pkt.targetY = static_cast<int32_t>(std::lround(coords.second));
+    nextAddr = {};
+    nextAddr.sin_family = AF_INET;
+    return networkManager.getGeographicNextHop(pkt, nullptr, nextAddr);
+  }
+
+  std::vector<struct sockaddr_in> path;
+  std::vector<RouteHop> hops;
+
+  if (networkManager.getSourceRoute(targetName, path, flow)) {
+    for (const auto &hop : path) {
+      hops.push_back({hop.sin_addr.s_addr, hop.sin_port});
+    }
+  }
+
+  if (pkt.setSourceRoute(hops)) {
+    nextAddr = {};
+    nextAddr.sin_family = AF_INET;
+    return pkt.popNextHop(nextAddr.sin_addr.s_addr, nextAddr.sin_port);
+  }
+
+  return networkManager.getNextHopAddress(targetName, nextAddr, flow);
+}
+
 std::string Node::extractMessage(const std::string &payload,
                                  std::string &senderName, std::string &targetIP,
                                  int &targetPort) {
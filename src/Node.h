@@ -2,6 +2,7 @@
 #define NODE_H
 
 #include "CryptoManager.h"
+#include "LinkMonitor.h"
 #include "NetworkManager.h"
 #include "NodeType.h"
 #include "Packet.hpp"
@@ -9,10 +10,12 @@
 #include <arpa/inet.h>
 #include <chrono>
 #include <cstring>
+#include <ctime>
 #include <dirent.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <netinet/in.h>
 #include <random>
 #include <sstream>
@@ -37,6 +40,10 @@ public:
 
   NodeType::Type getType() const;
 
+  // Anycast groups this node answers for
+  std::vector<std::string> getGroups() const;
+  void setGroups(const std::vector<std::string> &newGroups);
+
   bool bind();
   void updatePosition();
 
@@ -44,23 +51,27 @@ public:
   void sendMessage(const std::string &targetName, const std::string &message);
 
   void sendTo(const std::string &targetIP, int targetPort, Packet &pkt);
+  void sendTo(const struct sockaddr_in &targetAddr, Packet &pkt);
 
   void sendFile(const std::string &targetName, const std::string &fileName);
 
+  void advertiseLinkState();
+  void probeNeighbors();
+
   static std::string extractMessage(const std::string &payload,
                                     std::string &senderName,
                                     std::string &targetIP, int &targetPort);
 
-  std::string getPublicKey() const { return cryptoManager->getPublicKey(); }
+  std::string getPublicKey() const { return crypto().getPublicKey(); }
 
   std::vector<uint8_t>
   encryptMessage(const std::string &message,
                  const std::string &recipientPublicKey) const {
-    return cryptoManager->encrypt(message, recipientPublicKey);
+    return crypto().encrypt(message, recipientPublicKey);
   }
 
   std::string decryptMessage(const std::vector<uint8_t> &ciphertext) const {
-    return cryptoManager->decrypt(ciphertext);
+    return crypto().decrypt(ciphertext);
   }
 
 protected:
@@ -70,20 +81,41 @@ protected:
   std::string name;
   std::string ip;
   int port;
+  // Guarded by stateMutex, the position thread moves the node while
+  // others read it
   std::pair<double, double> coords; // Coordinates (x, y)
+  std::vector<std::string> groups;
+  mutable std::mutex stateMutex;
 
   const NetworkManager &networkManager;
 
   int socket_fd;
   struct sockaddr_in addr {};
   double delay; // delay in seconds
+  uint32_t lsaSequence;
+  uint32_t transferCount; // Ids transfers so their flows can be hashed
 
 private:
-  std::unique_ptr<CryptoManager> cryptoManager;
+  // Generated on first use, peers learned from the network never need keys
+  mutable std::unique_ptr<CryptoManager> cryptoManager;
+  mutable std::once_flag cryptoInit;
+  LinkMonitor linkMonitor;
+
+  CryptoManager &crypto() const;
 
   void simulateSignalDelay();
+  bool transmit(const struct sockaddr_in &targetAddr, const Packet &pkt);
+  void handleLinkState(const Packet &pkt, const struct sockaddr_in &sender);
+  void floodLinkState(const LinkStateAdvertisement &lsa,
+                      const struct sockaddr_in *exclude);
+  void handleProbe(const Packet &pkt, const struct sockaddr_in &sender);
+  static int64_t steadyMicros();
+  size_t flowKey(const std::string &targetName, uint32_t transferId) const;
+  bool stampRoute(const std::string &targetName, Packet &pkt,
+                  struct sockaddr_in &nextAddr, size_t flow) const;
 
   static std::string generateUUID();
+  static std::string addressToString(const struct sockaddr_in &addr);
   static void processMessage(Packet &pkt);
   static void writeToFile(Packet &pkt);
   static void reassembleFile(Packet &pkt);
@@ -0,0 +1,420 @@
+#include "NodeStore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+// Beyond this many rings a nearest query scans every node instead
+static const long long MAX_NEAREST_RINGS = 16;
+
+// Clamped, so far out or non-finite positions still get a cell whose index
+// fits a cell key; NaN lands at the low edge
+static long long cellOf(double position) {
+  const double edge = 1 << 30;
+  double cell = std::floor(position / NODE_STORE_CELL_SIZE);
+  if (!(cell > -edge)) {
+    return -(1LL << 30);
+  }
+  return cell < edge ? static_cast<long long>(cell) : (1LL << 30);
+}
+
+static long long cellKey(long long cx, long long cy) {
+  return static_cast<long long>((static_cast<unsigned long long>(cx) << 32) |
+                                (static_cast<unsigned long long>(cy) &
+                                 0xffffffffULL));
+}
+
+static double squaredDistance(const std::pair<double, double> &a,
+                              const std::pair<double, double> &b) {
+  double dx = a.first - b.first;
+  double dy = a.second - b.second;
+  return dx * dx + dy * dy;
+}
+
+// Sorts nearest first and drops repeats, which a node moving between the
+// rings of a nearest query can leave
+static void sortByDistance(std::vector<NodeInfo> &nodes,
+                           const std::pair<double, double> &center) {
+  std::sort(nodes.begin(), nodes.end(),
+            [&center](const NodeInfo &a, const NodeInfo &b) {
+              return squaredDistance(a.coords, center) <
+                     squaredDistance(b.coords, center);
+            });
+  std::unordered_set<std::string> seen;
+  nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                             [&seen](const NodeInfo &node) {
+                               return !seen.insert(node.name).second;
+                             }),
+              nodes.end());
+}
+
+void NodeStore::Shard::place(const NodeInfo &node) {
+  cells[cellKey(cellOf(node.coords.first), cellOf(node.coords.second))]
+      .push_back(&node);
+}
+
+void NodeStore::Shard::unplace(const NodeInfo &node) {
+  auto cell = cells.find(
+      cellKey(cellOf(node.coords.first), cellOf(node.coords.second)));
+  if (cell == cells.end()) {
+    return;
+  }
+  auto &members = cell->second;
+  auto it = std::find(members.begin(), members.end(), &node);
+  if (it != members.end()) {
+    *it = members.back();
+    members.pop_back();
+  }
+  if (members.empty()) {
+    cells.erase(cell);
+  }
+}
+
+NodeStore::NodeStore()
+    : storeEpoch(std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count()) {}
+
+std::unique_lock<std::mutex> NodeStore::lockShard(const Shard &shard) const {
+  std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    auto started = std::chrono::steady_clock::now();
+    lock.lock();
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started);
+    contendedLocks.fetch_add(1, std::memory_order_relaxed);
+    waitNanos.fetch_add(waited.count(), std::memory_order_relaxed);
+  }
+  return lock;
+}
+
+bool NodeStore::upsert(const NodeInfo &node) {
+  Shard &shard = shardFor(node.name);
+  auto lock = lockShard(shard);
+  return upsertLocked(shard, node);
+}
+
+bool NodeStore::update(const NodeInfo &node) {
+  Shard &shard = shardFor(node.name);
+  auto lock = lockShard(shard);
+  return updateLocked(shard, node);
+}
+
+bool NodeStore::move(const std::string &name,
+                     const std::pair<double, double> &coords) {
+  Shard &shard = shardFor(name);
+  auto lock = lockShard(shard);
+  return moveLocked(shard, name, coords);
+}
+
+bool NodeStore::remove(const std::string &name) {
+  Shard &shard = shardFor(name);
+  auto lock = lockShard(shard);
+  return removeLocked(shard, name);
+}
+
+std::vector<bool> NodeStore::apply(const std::vector<NodeMutation> &batch) {
+  // Group by shard, keeping the batch order within each
+  std::array<std::vector<size_t>, NODE_STORE_SHARDS> byShard;
+  for (size_t i = 0; i < batch.size(); i++) {
+    byShard[shardIndex(batch[i].node.name)].push_back(i);
+  }
+
+  std::vector<bool> results(batch.size(), false);
+  for (size_t s = 0; s < NODE_STORE_SHARDS; s++) {
+    if (byShard[s].empty()) {
+      continue;
+    }
+    Shard &shard = shards[s];
+    auto lock = lockShard(shard);
+    for (size_t i : byShard[s]) {
+      const NodeInfo &node = batch[i].node;
+      switch (batch[i].kind) {
+      case NodeMutation::UPSERT:
+        upsertLocked(shard, node);
+        results[i] = true;
+        break;
+      case NodeMutation::UPDATE:
+        results[i] = updateLocked(shard, node);
+        break;
+      case NodeMutation::MOVE:
+        results[i] = moveLocked(shard, node.name, node.coords);
+        break;
+      case NodeMutation::REMOVE:
+        results[i] = removeLocked(shard, node.name);
+        break;
+      case NodeMutation::TOUCH:
+        results[i] = shard.nodes.count(node.name) != 0;
+        break;
+      }
+    }
+  }
+  return results;
+}
+
+bool NodeStore::upsertLocked(Shard &shard, const NodeInfo &node) {
+  // Versions are taken under the shard lock, so a reader that saw version V
+  // finds every change up to V once it locks the shard
+  auto result = shard.nodes.emplace(node.name, node);
+  if (!result.second) {
+    shard.unplace(result.first->second);
+    result.first->second = node;
+  } else {
+    nodeCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  shard.place(result.first->second);
+  result.first->second.version = ++version;
+  shard.removed.erase(node.name);
+  if (journal) {
+    journal->upserted(result.first->second);
+  }
+  return result.second;
+}
+
+bool NodeStore::updateLocked(Shard &shard, const NodeInfo &node) {
+  auto it = shard.nodes.find(node.name);
+  if (it == shard.nodes.end()) {
+    return false;
+  }
+  shard.unplace(it->second);
+  it->second = node;
+  shard.place(it->second);
+  it->second.version = ++version;
+  if (journal) {
+    journal->upserted(it->second);
+  }
+  return true;
+}
+
+bool NodeStore::moveLocked(Shard &shard, const std::string &name,
+                           const std::pair<double, double> &coords) {
+  auto it = shard.nodes.find(name);
+  if (it == shard.nodes.end()) {
+    return false;
+  }
+  shard.unplace(it->second);
+  it->second.coords = coords;
+  shard.place(it->second);
+  it->second.version = ++version;
+  if (journal) {
+    journal->moved(name, coords);
+  }
+  return true;
+}
+
+bool NodeStore::removeLocked(Shard &shard, const std::string &name) {
+  auto it = shard.nodes.find(name);
+  if (it == shard.nodes.end()) {
+    return false;
+  }
+  shard.unplace(it->second);
+  shard.nodes.erase(it);
+  nodeCount.fetch_sub(1, std::memory_order_relaxed);
+
+  shard.removed[name] = ++version;
+  if (journal) {
+    journal->removed(name);
+  }
+  if (shard.removed.size() > NODE_STORE_TOMBSTONES) {
+    forgetOldestRemoval(shard);
+  }
+  return true;
+}
+
+void NodeStore::forgetOldestRemoval(Shard &shard) {
+  auto oldest = shard.removed.begin();
+  for (auto it = shard.removed.begin(); it != shard.removed.end(); ++it) {
+    if (it->second < oldest->second) {
+      oldest = it;
+    }
+  }
+
+  uint64_t pruned = oldest->second;
+  shard.removed.erase(oldest);
+  uint64_t current = prunedVersion.load();
+  while (current < pruned &&
+         !prunedVersion.compare_exchange_weak(current, pruned)) {
+  }
+}
+
+bool NodeStore::find(const std::string &name, NodeInfo &node) const {
+  const Shard &shard = shardFor(name);
+  auto lock = lockShard(shard);
+  auto it = shard.nodes.find(name);
+  if (it == shard.nodes.end()) {
+    return false;
+  }
+  node = it->second;
+  return true;
+}
+
+bool NodeStore::contains(const std::string &name) const {
+  const Shard &shard = shardFor(name);
+  auto lock = lockShard(shard);
+  return shard.nodes.count(name) != 0;
+}
+
+std::vector<NodeInfo> NodeStore::snapshot() const {
+  std::vector<NodeInfo> result;
+  for (const auto &shard : shards) {
+    auto lock = lockShard(shard);
+    for (const auto &entry : shard.nodes) {
+      result.push_back(entry.second);
+    }
+  }
+  return result;
+}
+
+std::vector<NodeInfo> NodeStore::within(const std::pair<double, double> &center,
+                                        double radius) const {
+  std::vector<NodeInfo> result;
+  double limit = radius * radius;
+  long long x0 = cellOf(center.first - radius);
+  long long x1 = cellOf(center.first + radius);
+  long long y0 = cellOf(center.second - radius);
+  long long y1 = cellOf(center.second + radius);
+  double area = static_cast<double>(x1 - x0 + 1) * (y1 - y0 + 1);
+
+  for (const auto &shard : shards) {
+    auto lock = lockShard(shard);
+    // A radius spanning more cells than the shard fills scans it whole
+    if (area > shard.cells.size()) {
+      for (const auto &cell : shard.cells) {
+        for (const NodeInfo *node : cell.second) {
+          if (squaredDistance(node->coords, center) <= limit) {
+            result.push_back(*node);
+          }
+        }
+      }
+      continue;
+    }
+    for (long long cx = x0; cx <= x1; cx++) {
+      for (long long cy = y0; cy <= y1; cy++) {
+        auto cell = shard.cells.find(cellKey(cx, cy));
+        if (cell == shard.cells.end()) {
+          continue;
+        }
+        for (const NodeInfo *node : cell->second) {
+          if (squaredDistance(node->coords, center) <= limit) {
+            result.push_back(*node);
+          }
+        }
+      }
+    }
+  }
+  sortByDistance(result, center);
+  return result;
+}
+
+std::vector<NodeInfo>
+NodeStore::nearest(const std::pair<double, double> &center, size_t k) const {
+  std::vector<NodeInfo> result;
+  if (k == 0) {
+    return result;
+  }
+
+  // Nodes outside the rings scanned so far are at least ring cell sizes
+  // away, so rings grow until k nodes are found that close
+  long long cx = cellOf(center.first);
+  long long cy = cellOf(center.second);
+  for (long long ring = 0; ring <= MAX_NEAREST_RINGS; ring++) {
+    collectRing(cx, cy, ring, center, std::numeric_limits<double>::infinity(),
+                result);
+    if (result.size() < k) {
+      continue;
+    }
+    std::nth_element(result.begin(), result.begin() + (k - 1), result.end(),
+                     [&center](const NodeInfo &a, const NodeInfo &b) {
+                       return squaredDistance(a.coords, center) <
+                              squaredDistance(b.coords, center);
+                     });
+    double reach = ring * NODE_STORE_CELL_SIZE;
+    if (squaredDistance(result[k - 1].coords, center) <= reach * reach) {
+      result.resize(k);
+      sortByDistance(result, center);
+      return result;
+    }
+  }
+
+  // Sparse or far apart nodes: fall back to looking at all of them
+  result = snapshot();
+  sortByDistance(result, center);
+  if (result.size() > k) {
+    result.resize(k);
+  }
+  return result;
+}
+
+void NodeStore::collectRing(long long cx, long long cy, long long ring,
+                            const std::pair<double, double> &center,
+                            double radius,
+                            std::vector<NodeInfo> &result) const {
+  std::vector<long long> keys;
+  for (long long dx = -ring; dx <= ring; dx++) {
+    // Full columns at the ring's left and right edges, end cells between
+    long long step = (dx == -ring || dx == ring) ? 1 : 2 * ring;
+    for (long long dy = -ring; dy <= ring; dy += step) {
+      keys.push_back(cellKey(cx + dx, cy + dy));
+    }
+  }
+
+  double limit = radius * radius;
+  for (const auto &shard : shards) {
+    auto lock = lockShard(shard);
+    for (long long key : keys) {
+      auto cell = shard.cells.find(key);
+      if (cell == shard.cells.end()) {
+        continue;
+      }
+      for (const NodeInfo *node : cell->second) {
+        if (squaredDistance(node->coords, center) <= limit) {
+          result.push_back(*node);
+        }
+      }
+    }
+  }
+}
+
+void NodeStore::collect(uint64_t since, bool withRemoved,
+                        NodeChanges &changes) const {
+  for (const auto &shard : shards) {
+    auto lock = lockShard(shard);
+    for (const auto &entry : shard.nodes) {
+      if (entry.second.version > since) {
+        changes.nodes.push_back(entry.second);
+      }
+    }
+    if (!withRemoved) {
+      continue;
+    }
+    for (const auto &entry : shard.removed) {
+      if (entry.second > since) {
+        changes.removed.push_back(entry.first);
+      }
+    }
+  }
+}
+
+NodeChanges NodeStore::changesSince(uint64_t epoch, uint64_t since) const {
+  NodeChanges changes;
+  changes.epoch = storeEpoch;
+  // Read before scanning: changes newer than this may be included too, which
+  // is harmless as applying them again is idempotent
+  changes.version = version.load();
+
+  if (epoch == storeEpoch && since != 0 && since <= changes.version) {
+    collect(since, true, changes);
+    // A removal after since may have been dropped while scanning
+    if (since >= prunedVersion.load()) {
+      return changes;
+    }
+    changes.nodes.clear();
+    changes.removed.clear();
+  }
+
+  changes.full = true;
+  collect(0, false, changes);
+  return changes;
+}
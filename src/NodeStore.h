@@ -0,0 +1,132 @@
+#ifndef NODE_STORE_H
+#define NODE_STORE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "RegistryProtocol.h"
+
+constexpr size_t NODE_STORE_SHARDS = 64;
+constexpr size_t NODE_STORE_TOMBSTONES = 256; // Removals kept per shard
+constexpr double NODE_STORE_CELL_SIZE = 500;  // Side of a spatial grid cell
+
+// Told about every mutation while its shard is still locked, so the changes
+// to any one node reach the journal in the order they were applied.
+class NodeJournal {
+public:
+  virtual ~NodeJournal() = default;
+  virtual void upserted(const NodeInfo &node) = 0;
+  virtual void moved(const std::string &name,
+                     const std::pair<double, double> &coords) = 0;
+  virtual void removed(const std::string &name) = 0;
+};
+
+// One change in a NodeStore::apply batch. MOVE, REMOVE and TOUCH only use
+// node.name, and MOVE node.coords.
+struct NodeMutation {
+  enum Kind { UPSERT, UPDATE, MOVE, REMOVE, TOUCH } kind;
+  NodeInfo node;
+};
+
+// Registry nodes keyed by name. Names hash to one of NODE_STORE_SHARDS
+// independently locked maps, so updates and lookups of different nodes
+// rarely wait on each other. Every mutation takes the next store version,
+// so readers can ask for just what changed since the version they last saw.
+class NodeStore {
+public:
+  NodeStore();
+
+  // Inserts or replaces the node; returns true if it was not there before
+  bool upsert(const NodeInfo &node);
+  // Replaces an existing node; returns false if it is unknown
+  bool update(const NodeInfo &node);
+  // Moves an existing node; returns false if it is unknown
+  bool move(const std::string &name, const std::pair<double, double> &coords);
+  bool remove(const std::string &name);
+  // Applies the batch taking each shard lock once. results[i] tells if
+  // batch[i] found its node (always for UPSERT), so it took effect.
+  std::vector<bool> apply(const std::vector<NodeMutation> &batch);
+  bool find(const std::string &name, NodeInfo &node) const;
+  bool contains(const std::string &name) const;
+  // Copy of every node, taken one shard at a time
+  std::vector<NodeInfo> snapshot() const;
+  // Nodes within radius of center, and the k nodes nearest to it, nearest
+  // first. Each shard keeps its nodes in a grid of NODE_STORE_CELL_SIZE
+  // cells, so queries only look at the cells around center.
+  std::vector<NodeInfo> within(const std::pair<double, double> &center,
+                               double radius) const;
+  std::vector<NodeInfo> nearest(const std::pair<double, double> &center,
+                                size_t k) const;
+  // Changes after version since of the given epoch. Versions only order
+  // changes within one epoch (one run of the store), so a reader from
+  // another epoch, or with since 0, gets everything.
+  NodeChanges changesSince(uint64_t epoch, uint64_t since) const;
+  uint64_t currentVersion() const { return version.load(); }
+  size_t size() const { return nodeCount.load(std::memory_order_relaxed); }
+  // Times a shard lock was contended, and the total time spent waiting
+  uint64_t lockWaits() const {
+    return contendedLocks.load(std::memory_order_relaxed);
+  }
+  uint64_t lockWaitNanos() const {
+    return waitNanos.load(std::memory_order_relaxed);
+  }
+  uint64_t epoch() const { return storeEpoch; }
+  // Journal for later mutations, or nullptr; set before the store is shared
+  void setJournal(NodeJournal *journal) { this->journal = journal; }
+
+private:
+  struct Shard {
+    std::unordered_map<std::string, NodeInfo> nodes;
+    std::unordered_map<std::string, uint64_t> removed; // name -> version
+    // Grid cell -> nodes in it; map entries do not move once inserted
+    std::unordered_map<long long, std::vector<const NodeInfo *>> cells;
+    mutable std::mutex mutex;
+
+    void place(const NodeInfo &node);
+    void unplace(const NodeInfo &node);
+  };
+
+  std::array<Shard, NODE_STORE_SHARDS> shards;
+  const uint64_t storeEpoch; // Start time, distinct across restarts
+  std::atomic<uint64_t> version{0};
+  // Newest version whose tombstone was dropped; deltas from before it
+  // would miss removals
+  std::atomic<uint64_t> prunedVersion{0};
+  NodeJournal *journal = nullptr;
+  std::atomic<size_t> nodeCount{0};
+  mutable std::atomic<uint64_t> contendedLocks{0};
+  mutable std::atomic<uint64_t> waitNanos{0};
+
+  // Locks shard, timing the wait only when it is already held
+  std::unique_lock<std::mutex> lockShard(const Shard &shard) const;
+
+  bool upsertLocked(Shard &shard, const NodeInfo &node);
+  bool updateLocked(Shard &shard, const NodeInfo &node);
+  bool moveLocked(Shard &shard, const std::string &name,
+                  const std::pair<double, double> &coords);
+  bool removeLocked(Shard &shard, const std::string &name);
+  void forgetOldestRemoval(Shard &shard);
+  void collect(uint64_t since, bool withRemoved, NodeChanges &changes) const;
+  // Nodes of the cells in the square ring ring cells out from the one at
+  // (cx, cy), within radius of center
+  void collectRing(long long cx, long long cy, long long ring,
+                   const std::pair<double, double> &center, double radius,
+                   std::vector<NodeInfo> &result) const;
+
+  static size_t shardIndex(const std::string &name) {
+    return std::hash<std::string>()(name) % NODE_STORE_SHARDS;
+  }
+  Shard &shardFor(const std::string &name) { return shards[shardIndex(name)]; }
+  const Shard &shardFor(const std::string &name) const {
+    return shards[shardIndex(name)];
+  }
+};
+
+#endif // NODE_STORE_H
@@ -1,18 +1,60 @@
 #include "Packet.hpp"
+#include <algorithm>
 #include <arpa/inet.h> // For htonl, ntohl, etc.
-#include <stdexcept>
+#include <initializer_list>
 
-Packet::Packet() : version{PKT_VERSION}, errorCorrectionCode{0} {
+Packet::Packet()
+    : version{PKT_VERSION}, routeLength{0}, routeIndex{0}, ttl{DEFAULT_TTL},
+      forwarding{forwardMode::ROUTED}, targetX{0}, targetY{0}, entryX{0},
+      entryY{0}, faceX{0}, faceY{0}, dataLength{MAX_BUFFER_SIZE},
+      errorCorrectionCode{0} {
   std::fill(data.begin(), data.end(), 0);
 }
 
 Packet::Packet(uint32_t sAddr, uint16_t sPort, uint32_t tAddr, uint16_t tPort,
                packetType type)
     : version{PKT_VERSION}, sAddress{sAddr}, sPort{sPort}, tAddress{tAddr},
-      tPort{tPort}, type{type}, errorCorrectionCode(0) {
+      tPort{tPort}, type{type}, routeLength{0}, routeIndex{0}, ttl{DEFAULT_TTL},
+      forwarding{forwardMode::ROUTED}, targetX{0}, targetY{0}, entryX{0},
+      entryY{0}, faceX{0}, faceY{0}, dataLength{MAX_BUFFER_SIZE},
+      errorCorrectionCode(0) {
   std::fill(data.begin(), data.end(), 0);
 }
 
+void Packet::setPayload(const std::string &payload) {
+  size_t length = std::min<size_t>(payload.size(), MAX_BUFFER_SIZE);
+  std::copy(payload.begin(), payload.begin() + length, data.begin());
+  dataLength = static_cast<uint16_t>(length);
+}
+
+std::string Packet::payload() const {
+  return std::string(data.begin(), data.begin() + dataLength);
+}
+
+bool Packet::setSourceRoute(const std::vector<RouteHop> &hops) {
+  if (hops.empty() || hops.size() > MAX_SOURCE_ROUTE_HOPS) {
+    routeLength = 0;
+    routeIndex = 0;
+    return false;
+  }
+
+  std::copy(hops.begin(), hops.end(), route.begin());
+  routeLength = static_cast<uint8_t>(hops.size());
+  routeIndex = 0;
+  return true;
+}
+
+bool Packet::popNextHop(uint32_t &address, uint16_t &port) {
+  if (routeIndex >= routeLength) {
+    return false;
+  }
+
+  address = route[routeIndex].address;
+  port = route[routeIndex].port;
+  routeIndex++;
+  return true;
+}
+
 std::vector<uint8_t> Packet::serialize() const {
   std::vector<uint8_t> buffer;
   buffer.reserve(sizeof(Packet));
@@ -47,7 +89,32 @@ std::vector<uint8_t> Packet::serialize() const {
                 reinterpret_cast<const uint8_t *>(&fragCount) +
                     sizeof(fragCount));
 
-  buffer.insert(buffer.end(), data.begin(), data.end());
+  buffer.push_back(routeLength);
+  buffer.push_back(routeIndex);
+  buffer.push_back(ttl);
+  buffer.push_back(static_cast<uint8_t>(forwarding));
+  for (int32_t coord : {targetX, targetY, entryX, entryY, faceX, faceY}) {
+    uint32_t value = htonl(static_cast<uint32_t>(coord));
+    buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(&value),
+                  reinterpret_cast<const uint8_t *>(&value) + sizeof(value));
+  }
+  for (int i = 0; i < routeLength; i++) {
+    uint32_t hopAddr = htonl(route[i].address);
+    buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(&hopAddr),
+                  reinterpret_cast<const uint8_t *>(&hopAddr) +
+                      sizeof(hopAddr));
+
+    uint16_t hopPort = htons(route[i].port);
+    buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(&hopPort),
+                  reinterpret_cast<const uint8_t *>(&hopPort) +
+                      sizeof(hopPort));
+  }
+
+  uint16_t dataLen = htons(dataLength);
+  buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(&dataLen),
+                reinterpret_cast<const uint8_t *>(&dataLen) + sizeof(dataLen));
+
+  buffer.insert(buffer.end(), data.begin(), data.begin() + dataLength);
 
   // Compute and append the CRC
   uint32_t crc = calculateCRC(buffer);
@@ -60,55 +127,88 @@ std::vector<uint8_t> Packet::serialize() const {
   return buffer;
 }
 
-Packet Packet::deserialize(const std::vector<uint8_t> &buffer) {
-
-  Packet packet;
+bool Packet::deserialize(const std::vector<uint8_t> &buffer, Packet &packet) {
   size_t offset = 0;
+  // Copies the next size bytes out, false once the buffer runs short
+  auto take = [&buffer, &offset](void *out, size_t size) {
+    if (buffer.size() - offset < size) {
+      return false;
+    }
+    std::memcpy(out, buffer.data() + offset, size);
+    offset += size;
+    return true;
+  };
+
+  // Other versions lay the header out differently
+  if (!take(&packet.version, sizeof(packet.version)) ||
+      packet.version != PKT_VERSION) {
+    return false;
+  }
 
-  packet.version = buffer[offset++];
-  std::memcpy(&packet.sAddress, &buffer[offset], sizeof(packet.sAddress));
+  uint8_t typeByte = 0;
+  uint8_t forwardingByte = 0;
+  if (!take(&packet.sAddress, sizeof(packet.sAddress)) ||
+      !take(&packet.sPort, sizeof(packet.sPort)) ||
+      !take(&packet.tAddress, sizeof(packet.tAddress)) ||
+      !take(&packet.tPort, sizeof(packet.tPort)) ||
+      !take(&typeByte, sizeof(typeByte)) ||
+      !take(&packet.fragmentNumber, sizeof(packet.fragmentNumber)) ||
+      !take(&packet.fragmentCount, sizeof(packet.fragmentCount)) ||
+      !take(&packet.routeLength, sizeof(packet.routeLength)) ||
+      !take(&packet.routeIndex, sizeof(packet.routeIndex)) ||
+      !take(&packet.ttl, sizeof(packet.ttl)) ||
+      !take(&forwardingByte, sizeof(forwardingByte))) {
+    return false;
+  }
+  if (typeByte > static_cast<uint8_t>(packetType::PROBE_REPLY) ||
+      forwardingByte > static_cast<uint8_t>(forwardMode::PERIMETER) ||
+      packet.routeLength > MAX_SOURCE_ROUTE_HOPS) {
+    return false;
+  }
   packet.sAddress = ntohl(packet.sAddress);
-  offset += sizeof(packet.sAddress);
-
-  std::memcpy(&packet.sPort, &buffer[offset], sizeof(packet.sPort));
   packet.sPort = ntohs(packet.sPort);
-  offset += sizeof(packet.sPort);
-
-  std::memcpy(&packet.tAddress, &buffer[offset], sizeof(packet.tAddress));
   packet.tAddress = ntohl(packet.tAddress);
-  offset += sizeof(packet.tAddress);
-
-  std::memcpy(&packet.tPort, &buffer[offset], sizeof(packet.tPort));
   packet.tPort = ntohs(packet.tPort);
-  offset += sizeof(packet.tPort);
-
-  packet.type = static_cast<packetType>(buffer[offset++]);
-
-  std::memcpy(&packet.fragmentNumber, &buffer[offset],
-              sizeof(packet.fragmentNumber));
+  packet.type = static_cast<packetType>(typeByte);
   packet.fragmentNumber = ntohs(packet.fragmentNumber);
-  offset += sizeof(packet.fragmentNumber);
-
-  std::memcpy(&packet.fragmentCount, &buffer[offset],
-              sizeof(packet.fragmentCount));
   packet.fragmentCount = ntohs(packet.fragmentCount);
-  offset += sizeof(packet.fragmentCount);
-
-  std::fill(packet.data.begin(), packet.data.end(), 0);
-  std::memcpy(packet.data.data(), &buffer[offset], packet.data.size());
-  offset += packet.data.size();
+  packet.forwarding = static_cast<forwardMode>(forwardingByte);
 
-  std::memcpy(&packet.errorCorrectionCode, &buffer[offset],
-              sizeof(packet.errorCorrectionCode));
-  packet.errorCorrectionCode = ntohl(packet.errorCorrectionCode);
+  for (int32_t *coord : {&packet.targetX, &packet.targetY, &packet.entryX,
+                         &packet.entryY, &packet.faceX, &packet.faceY}) {
+    uint32_t value;
+    if (!take(&value, sizeof(value))) {
+      return false;
+    }
+    *coord = static_cast<int32_t>(ntohl(value));
+  }
+  for (int i = 0; i < packet.routeLength; i++) {
+    RouteHop &hop = packet.route[i];
+    if (!take(&hop.address, sizeof(hop.address)) ||
+        !take(&hop.port, sizeof(hop.port))) {
+      return false;
+    }
+    hop.address = ntohl(hop.address);
+    hop.port = ntohs(hop.port);
+  }
 
-  // Verify CRC after deserialization
-  if (!packet.verifyCRC()) {
-    throw std::runtime_error("CRC verification failed! Integrity of the "
-                             "message might be compromised.");
+  if (!take(&packet.dataLength, sizeof(packet.dataLength))) {
+    return false;
   }
+  packet.dataLength = ntohs(packet.dataLength);
+  if (packet.dataLength > MAX_BUFFER_SIZE) {
+    return false;
+  }
+  std::fill(packet.data.begin(), packet.data.end(), 0);
+  if (!take(packet.data.data(), packet.dataLength) ||
+      !take(&packet.errorCorrectionCode,
+            sizeof(packet.errorCorrectionCode))) {
+    return false;
+  }
+  packet.errorCorrectionCode = ntohl(packet.errorCorrectionCode);
 
-  return packet;
+  // A packet damaged on the way fails its CRC
+  return packet.verifyCRC();
 }
 
 uint32_t Packet::calculateCRC(const std::vector<uint8_t> &data) const {
@@ -5,13 +5,26 @@
 #include <array>
 #include <cstring>
 #include <stdint.h>
+#include <string>
 #include <unistd.h>
 #include <vector>
 
 constexpr int MAX_BUFFER_SIZE = 50 * 1000; // 50 KB
-constexpr int PKT_VERSION = 1;
+constexpr int PKT_VERSION = 6;
+constexpr int DEFAULT_TTL = 64;
+constexpr int MAX_SOURCE_ROUTE_HOPS = 16;
+// Fixed header + CRC + a full source route
+constexpr int MAX_HEADER_SIZE = 52 + MAX_SOURCE_ROUTE_HOPS * 6;
 
-enum class packetType : uint8_t { TEXT, FILE };
+enum class packetType : uint8_t { TEXT, FILE, LSA, PROBE, PROBE_REPLY };
+
+// ROUTED: source route / routing table, GREEDY and PERIMETER: geographic
+enum class forwardMode : uint8_t { ROUTED, GREEDY, PERIMETER };
+
+struct RouteHop {
+  uint32_t address; // IPV4 Address of the hop
+  uint16_t port;    // Port of the hop
+};
 
 struct Packet {
   uint8_t version;
@@ -22,6 +35,18 @@ struct Packet {
   packetType type;
   uint16_t fragmentNumber;
   uint16_t fragmentCount;
+  uint8_t routeLength; // Hops in the source route, 0 for hop-by-hop routing
+  uint8_t routeIndex;  // Next hop to visit in the source route
+  uint8_t ttl;         // Relays left before the packet is dropped
+  forwardMode forwarding;
+  int32_t targetX; // Position of the final receiver, geographic forwarding
+  int32_t targetY;
+  int32_t entryX; // Where the packet entered perimeter mode
+  int32_t entryY;
+  int32_t faceX; // Where it entered the face it is walking, on the line
+  int32_t faceY; // from the entry point to the target
+  std::array<RouteHop, MAX_SOURCE_ROUTE_HOPS> route;
+  uint16_t dataLength; // Bytes of data carried on the wire
   uint32_t errorCorrectionCode;
 
   std::array<uint8_t, MAX_BUFFER_SIZE> data;
@@ -30,8 +55,17 @@ struct Packet {
   Packet(uint32_t sAddr, uint16_t sPort, uint32_t tAddr, uint16_t tPort,
          packetType type);
 
+  // Short control payloads only put their own bytes on the wire
+  void setPayload(const std::string &payload);
+  std::string payload() const;
+
+  bool setSourceRoute(const std::vector<RouteHop> &hops);
+  bool popNextHop(uint32_t &address, uint16_t &port);
+
   std::vector<uint8_t> serialize() const;
-  static Packet deserialize(const std::vector<uint8_t> &buffer);
+  // False if the buffer is short, of another version, out of range or
+  // fails its CRC; packet is then left partly filled in
+  static bool deserialize(const std::vector<uint8_t> &buffer, Packet &packet);
 
   void computeCRC();
   bool verifyCRC() const;
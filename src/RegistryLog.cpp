@@ -0,0 +1,291 @@
+#include "RegistryLog.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char LOG_FILE[] = "registry.log";
+static const char OLD_LOG_FILE[] = "registry.log.old"; // Log being compacted
+static const char SNAPSHOT_FILE[] = "registry.snapshot";
+static const char SNAPSHOT_TMP_FILE[] = "registry.snapshot.tmp";
+static const size_t RECORD_HEADER = 8; // Length and checksum
+
+// FNV-1a, enough to tell a torn or garbled record from a whole one
+static uint32_t checksum(const char *data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+static bool writeAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+static void syncDirectory(const std::string &directory) {
+  int fd = ::open(directory.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+RegistryLog::RegistryLog(const std::string &directory)
+    : directory(directory) {}
+
+RegistryLog::~RegistryLog() {
+  if (logFd >= 0) {
+    fdatasync(logFd);
+    close(logFd);
+  }
+}
+
+bool RegistryLog::open(NodeStore &store) {
+  if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+    logger.log(LogLevel::ERROR, "Failed to create registry directory " +
+                                    directory + ": " + strerror(errno));
+    return false;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+  // An old log is left only by a compaction cut short, and is older than
+  // the current one
+  size_t records = replay(path(SNAPSHOT_FILE), store) +
+                   replay(path(OLD_LOG_FILE), store) +
+                   replay(path(LOG_FILE), store);
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+
+  // Nothing journals yet, so the snapshot holds everything replayed and
+  // both logs can go once it is in place
+  std::vector<NodeInfo> nodes = store.snapshot();
+  if (!writeSnapshot(nodes)) {
+    return false;
+  }
+  unlink(path(OLD_LOG_FILE).c_str());
+  unlink(path(LOG_FILE).c_str());
+  syncDirectory(directory);
+
+  logFd = ::open(path(LOG_FILE).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (logFd < 0) {
+    logger.log(LogLevel::ERROR, "Failed to open registry log in " +
+                                    directory + ": " + strerror(errno));
+    return false;
+  }
+
+  logger.log(LogLevel::INFO, "Recovered " + std::to_string(nodes.size()) +
+                                 " nodes from " + std::to_string(records) +
+                                 " records in " +
+                                 std::to_string(elapsed.count()) + " ms.");
+  store.setJournal(this);
+  return true;
+}
+
+bool RegistryLog::compact(const NodeStore &store) {
+  std::lock_guard<std::mutex> compactLock(compactMutex);
+
+  // Start a new log first: whatever the snapshot misses lands in it, and
+  // replaying records the snapshot already has only repeats them
+  int oldFd;
+  {
+    std::lock_guard<std::mutex> lock(logMutex);
+    if (logFd < 0 ||
+        rename(path(LOG_FILE).c_str(), path(OLD_LOG_FILE).c_str()) < 0) {
+      return false;
+    }
+    oldFd = logFd;
+    logFd = ::open(path(LOG_FILE).c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                   0644);
+    logSize = 0;
+  }
+  fdatasync(oldFd);
+  close(oldFd);
+  if (logFd < 0) {
+    logger.log(LogLevel::ERROR, "Failed to reopen registry log in " +
+                                    directory + ": " + strerror(errno));
+    return false;
+  }
+
+  // On failure the old log stays and is replayed after the last snapshot
+  if (!writeSnapshot(store.snapshot())) {
+    return false;
+  }
+  unlink(path(OLD_LOG_FILE).c_str());
+  syncDirectory(directory);
+  logger.log(LogLevel::DEBUG, "Compacted registry log.");
+  return true;
+}
+
+void RegistryLog::sync() {
+  // Synced through a duplicate so appends need not wait for the disk
+  int fd;
+  {
+    std::lock_guard<std::mutex> lock(logMutex);
+    fd = logFd < 0 ? -1 : dup(logFd);
+  }
+  if (fd >= 0) {
+    fdatasync(fd);
+    close(fd);
+  }
+}
+
+void RegistryLog::upserted(const NodeInfo &node) {
+  WireWriter out;
+  out.node(node);
+  append(Record::UPSERT, out.release());
+}
+
+void RegistryLog::moved(const std::string &name,
+                        const std::pair<double, double> &coords) {
+  WireWriter out;
+  out.str(name);
+  out.f64(coords.first);
+  out.f64(coords.second);
+  append(Record::MOVE, out.release());
+}
+
+void RegistryLog::removed(const std::string &name) {
+  WireWriter out;
+  out.str(name);
+  append(Record::REMOVE, out.release());
+}
+
+void RegistryLog::append(Record type, const std::string &payload) {
+  std::string record = encode(type, payload);
+  std::lock_guard<std::mutex> lock(logMutex);
+  if (logFd < 0) {
+    return;
+  }
+  if (!writeAll(logFd, record.data(), record.size())) {
+    if (!writeFailed) {
+      logger.log(LogLevel::ERROR, "Failed to append to registry log: " +
+                                      std::string(strerror(errno)));
+      writeFailed = true;
+    }
+    return;
+  }
+  writeFailed = false;
+  logSize += record.size();
+}
+
+std::string RegistryLog::encode(Record type, const std::string &payload) {
+  std::string body(1, static_cast<char>(type));
+  body += payload;
+  WireWriter out;
+  out.u32(static_cast<uint32_t>(body.size()));
+  out.u32(checksum(body.data(), body.size()));
+  return out.release() + body;
+}
+
+size_t RegistryLog::replay(const std::string &path, NodeStore &store) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return 0;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  const std::string data = contents.str();
+
+  size_t records = 0;
+  size_t pos = 0;
+  while (data.size() - pos >= RECORD_HEADER) {
+    uint32_t length = 0;
+    uint32_t sum = 0;
+    WireReader header(data.data() + pos, RECORD_HEADER);
+    header.u32(length);
+    header.u32(sum);
+    const char *body = data.data() + pos + RECORD_HEADER;
+    if (length == 0 || data.size() - pos - RECORD_HEADER < length ||
+        checksum(body, length) != sum) {
+      break;
+    }
+
+    WireReader in(body + 1, length - 1);
+    std::string name;
+    bool valid = false;
+    switch (static_cast<Record>(body[0])) {
+    case Record::UPSERT: {
+      NodeInfo node{};
+      if ((valid = in.node(node))) {
+        store.upsert(node);
+      }
+      break;
+    }
+    case Record::MOVE: {
+      std::pair<double, double> coords;
+      in.str(name);
+      in.f64(coords.first);
+      if ((valid = in.f64(coords.second))) {
+        store.move(name, coords);
+      }
+      break;
+    }
+    case Record::REMOVE:
+      if ((valid = in.str(name))) {
+        store.remove(name);
+      }
+      break;
+    }
+    if (!valid) {
+      break;
+    }
+    pos += RECORD_HEADER + length;
+    records++;
+  }
+
+  if (pos < data.size()) {
+    logger.log(LogLevel::WARNING, "Ignoring " +
+                                      std::to_string(data.size() - pos) +
+                                      " bytes of torn or corrupt records at "
+                                      "the end of " +
+                                      path + ".");
+  }
+  return records;
+}
+
+bool RegistryLog::writeSnapshot(const std::vector<NodeInfo> &nodes) {
+  std::string snapshot;
+  WireWriter out;
+  for (const auto &node : nodes) {
+    out.node(node);
+    snapshot += encode(Record::UPSERT, out.release());
+  }
+  // Written aside and renamed over, so a snapshot on disk is always whole
+  if (!writeFile(path(SNAPSHOT_TMP_FILE), snapshot) ||
+      rename(path(SNAPSHOT_TMP_FILE).c_str(), path(SNAPSHOT_FILE).c_str()) <
+          0) {
+    logger.log(LogLevel::ERROR, "Failed to write registry snapshot in " +
+                                    directory + ": " + strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool RegistryLog::writeFile(const std::string &path, const std::string &data) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = writeAll(fd, data.data(), data.size()) && fsync(fd) == 0;
+  close(fd);
+  return written;
+}
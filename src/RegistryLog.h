@@ -0,0 +1,63 @@
+#ifndef REGISTRY_LOG_H
+#define REGISTRY_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "NodeStore.h"
+
+// Log size past which compact() is due
+constexpr size_t REGISTRY_LOG_COMPACT_BYTES = 16 << 20;
+
+// Keeps a NodeStore across restarts as a snapshot plus an append-only log
+// of the mutations since, both in one directory. Each record is
+//   u32 length | u32 checksum | u8 type | payload
+// with the wire encoding of RegistryProtocol.h, and a snapshot is just a log
+// of upserts. Appends are written straight away but only synced by sync(),
+// so a crash may lose the last moments of changes, which nodes send again.
+class RegistryLog : public NodeJournal {
+public:
+  explicit RegistryLog(const std::string &directory);
+  ~RegistryLog() override;
+
+  RegistryLog(const RegistryLog &) = delete;
+  RegistryLog &operator=(const RegistryLog &) = delete;
+
+  // Loads the snapshot and the log into store, folds them into a fresh
+  // snapshot and starts journaling the store's changes
+  bool open(NodeStore &store);
+  // Writes a snapshot of store and drops the log it replaces
+  bool compact(const NodeStore &store);
+  bool compactDue() const { return logSize >= REGISTRY_LOG_COMPACT_BYTES; }
+  // Flushes appended records to disk
+  void sync();
+
+  void upserted(const NodeInfo &node) override;
+  void moved(const std::string &name,
+             const std::pair<double, double> &coords) override;
+  void removed(const std::string &name) override;
+
+private:
+  enum class Record : uint8_t { UPSERT, MOVE, REMOVE };
+
+  std::string directory;
+  int logFd = -1;
+  std::atomic<size_t> logSize{0};
+  bool writeFailed = false; // Reported once, not for every record
+  std::mutex logMutex;      // Held while appending or swapping the log
+  std::mutex compactMutex;  // One compaction at a time
+
+  std::string path(const char *name) const { return directory + "/" + name; }
+  void append(Record type, const std::string &payload);
+  static std::string encode(Record type, const std::string &payload);
+  // Applies the records in the file at path; a torn or corrupt tail ends it
+  static size_t replay(const std::string &path, NodeStore &store);
+  bool writeSnapshot(const std::vector<NodeInfo> &nodes);
+  static bool writeFile(const std::string &path, const std::string &data);
+};
+
+#endif // REGISTRY_LOG_H
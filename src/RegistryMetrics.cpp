@@ -0,0 +1,158 @@
+#include "RegistryMetrics.h"
+#include "RegistryProtocol.h"
+
+#include <cstdio>
+
+static const char *const ACTION_NAMES[] = {
+    "register", "deregister", "update",       "move",    "list",
+    "watch",    "renew",      "batch",        "near",    "nearest",
+    "getPublicKey", "metrics", "invalid"};
+static const char *const PROTOCOL_NAMES[] = {"http", "binary"};
+
+// Upper bounds of all but the last bucket, in microseconds
+static const uint64_t LATENCY_BOUNDS_US[REGISTRY_LATENCY_BUCKETS - 1] = {
+    100,    250,    500,    1000,    2500,    5000,    10000,   25000,
+    50000,  100000, 250000, 500000,  1000000, 2500000, 10000000};
+
+static std::string formatValue(double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.15g", value);
+  return text;
+}
+
+RegistryAction RegistryMetrics::actionNamed(const std::string &action) {
+  for (size_t i = 0; i < static_cast<size_t>(RegistryAction::COUNT); i++) {
+    // Watches are list requests, told apart only once they are held
+    RegistryAction named = static_cast<RegistryAction>(i);
+    if (action == ACTION_NAMES[i] && named != RegistryAction::WATCH) {
+      return named;
+    }
+  }
+  return RegistryAction::INVALID;
+}
+
+RegistryAction RegistryMetrics::actionForOp(uint8_t op) {
+  switch (static_cast<RegistryOp>(op)) {
+  case RegistryOp::REGISTER:
+    return RegistryAction::REGISTER;
+  case RegistryOp::MOVE:
+    return RegistryAction::MOVE;
+  case RegistryOp::DEREGISTER:
+    return RegistryAction::DEREGISTER;
+  case RegistryOp::LIST:
+    return RegistryAction::LIST;
+  case RegistryOp::GET_PUBLIC_KEY:
+    return RegistryAction::GET_PUBLIC_KEY;
+  case RegistryOp::RENEW:
+    return RegistryAction::RENEW;
+  case RegistryOp::BATCH:
+    return RegistryAction::BATCH;
+  case RegistryOp::NEAR:
+    return RegistryAction::NEAR;
+  case RegistryOp::NEAREST:
+    return RegistryAction::NEAREST;
+  }
+  return RegistryAction::INVALID;
+}
+
+void RegistryMetrics::connectionOpened() {
+  connections.fetch_add(1, std::memory_order_relaxed);
+  accepted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RegistryMetrics::connectionClosed() {
+  connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RegistryMetrics::observe(RegistryAction action, bool binary,
+                              std::chrono::steady_clock::duration latency,
+                              size_t bytes) {
+  Series &entry = series[binary ? 1 : 0][static_cast<size_t>(action)];
+  auto nanos =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+  uint64_t micros = nanos > 0 ? static_cast<uint64_t>(nanos) / 1000 : 0;
+
+  size_t bucket = 0;
+  while (bucket < REGISTRY_LATENCY_BUCKETS - 1 &&
+         micros > LATENCY_BOUNDS_US[bucket]) {
+    bucket++;
+  }
+  entry.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  entry.latencyNanos.fetch_add(nanos > 0 ? nanos : 0,
+                               std::memory_order_relaxed);
+  entry.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+std::string RegistryMetrics::render(const std::vector<Sample> &samples) const {
+  std::string requests =
+      "# HELP nexus_registry_requests_total Requests answered.\n"
+      "# TYPE nexus_registry_requests_total counter\n";
+  std::string bytes =
+      "# HELP nexus_registry_response_bytes_total Bytes of responses, "
+      "headers included.\n"
+      "# TYPE nexus_registry_response_bytes_total counter\n";
+  std::string latency =
+      "# HELP nexus_registry_request_duration_seconds Time from a request "
+      "being read to its response being ready, worker queueing included.\n"
+      "# TYPE nexus_registry_request_duration_seconds histogram\n";
+
+  // Only actions seen so far, most of the table is usually empty
+  for (size_t protocol = 0; protocol < series.size(); protocol++) {
+    for (size_t action = 0; action < series[protocol].size(); action++) {
+      const Series &entry = series[protocol][action];
+      std::array<uint64_t, REGISTRY_LATENCY_BUCKETS> counts;
+      uint64_t total = 0;
+      for (size_t i = 0; i < REGISTRY_LATENCY_BUCKETS; i++) {
+        counts[i] = entry.buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+      }
+      if (total == 0) {
+        continue;
+      }
+
+      std::string labels = std::string("action=\"") + ACTION_NAMES[action] +
+                           "\",protocol=\"" + PROTOCOL_NAMES[protocol] + "\"";
+      requests += "nexus_registry_requests_total{" + labels + "} " +
+                  std::to_string(total) + "\n";
+      bytes += "nexus_registry_response_bytes_total{" + labels + "} " +
+               std::to_string(entry.bytes.load(std::memory_order_relaxed)) +
+               "\n";
+
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i < REGISTRY_LATENCY_BUCKETS; i++) {
+        cumulative += counts[i];
+        std::string bound =
+            i + 1 < REGISTRY_LATENCY_BUCKETS
+                ? formatValue(LATENCY_BOUNDS_US[i] / 1e6)
+                : "+Inf";
+        latency += "nexus_registry_request_duration_seconds_bucket{" +
+                   labels + ",le=\"" + bound + "\"} " +
+                   std::to_string(cumulative) + "\n";
+      }
+      latency +=
+          "nexus_registry_request_duration_seconds_sum{" + labels + "} " +
+          formatValue(entry.latencyNanos.load(std::memory_order_relaxed) /
+                      1e9) +
+          "\n";
+      latency += "nexus_registry_request_duration_seconds_count{" + labels +
+                 "} " + std::to_string(total) + "\n";
+    }
+  }
+
+  std::string text = requests + bytes + latency;
+  text += "# HELP nexus_registry_connections Open client connections.\n"
+          "# TYPE nexus_registry_connections gauge\n"
+          "nexus_registry_connections " +
+          std::to_string(connections.load(std::memory_order_relaxed)) + "\n";
+  text += "# HELP nexus_registry_connections_total Client connections "
+          "accepted.\n"
+          "# TYPE nexus_registry_connections_total counter\n"
+          "nexus_registry_connections_total " +
+          std::to_string(accepted.load(std::memory_order_relaxed)) + "\n";
+  for (const auto &sample : samples) {
+    text += std::string("# HELP ") + sample.name + " " + sample.help + "\n" +
+            "# TYPE " + sample.name + " " + sample.type + "\n" + sample.name +
+            " " + formatValue(sample.value) + "\n";
+  }
+  return text;
+}
@@ -0,0 +1,70 @@
+#ifndef REGISTRY_METRICS_H
+#define REGISTRY_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What a registry request asked for. WATCH is a list request that was held
+// until the nodes changed, kept apart so its waits do not swamp list latency.
+enum class RegistryAction : uint8_t {
+  REGISTER,
+  DEREGISTER,
+  UPDATE,
+  MOVE,
+  LIST,
+  WATCH,
+  RENEW,
+  BATCH,
+  NEAR,
+  NEAREST,
+  GET_PUBLIC_KEY,
+  METRICS,
+  INVALID,
+  COUNT
+};
+
+// Latency buckets, the last one unbounded
+constexpr size_t REGISTRY_LATENCY_BUCKETS = 16;
+
+// Request counters of the registry, exported in the Prometheus text format.
+// Every update is a relaxed atomic add, so the request path never locks;
+// a scrape may catch a request half counted, which the next one corrects.
+class RegistryMetrics {
+public:
+  // Value the server samples at scrape time, such as the store size
+  struct Sample {
+    const char *name;
+    const char *type; // "gauge" or "counter"
+    const char *help;
+    double value;
+  };
+
+  static RegistryAction actionNamed(const std::string &action);
+  static RegistryAction actionForOp(uint8_t op);
+
+  void connectionOpened();
+  void connectionClosed();
+  // Counts a response of size bytes ready latency after its request was read
+  void observe(RegistryAction action, bool binary,
+               std::chrono::steady_clock::duration latency, size_t bytes);
+  std::string render(const std::vector<Sample> &samples) const;
+
+private:
+  struct Series {
+    std::array<std::atomic<uint64_t>, REGISTRY_LATENCY_BUCKETS> buckets{};
+    std::atomic<uint64_t> latencyNanos{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+
+  // Indexed by protocol (HTTP, binary), then action
+  std::array<std::array<Series, static_cast<size_t>(RegistryAction::COUNT)>, 2>
+      series;
+  std::atomic<int64_t> connections{0};
+  std::atomic<uint64_t> accepted{0};
+};
+
+#endif // REGISTRY_METRICS_H
@@ -0,0 +1,202 @@
+#include "RegistryProtocol.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstring>
+
+static uint64_t hostToNetwork64(uint64_t value) {
+  return (static_cast<uint64_t>(htonl(value & 0xffffffff)) << 32) |
+         htonl(value >> 32);
+}
+
+void WireWriter::u16(uint16_t value) {
+  value = htons(value);
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void WireWriter::u32(uint32_t value) {
+  value = htonl(value);
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void WireWriter::u64(uint64_t value) {
+  value = hostToNetwork64(value);
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void WireWriter::f64(double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  u64(bits);
+}
+
+void WireWriter::str(const std::string &value) {
+  // Longer strings are cut, the reader still finds the next field
+  size_t length = std::min<size_t>(value.size(), UINT16_MAX);
+  u16(static_cast<uint16_t>(length));
+  out.append(value, 0, length);
+}
+
+void WireWriter::node(const NodeInfo &node) {
+  str(node.type);
+  str(node.name);
+  str(node.ip);
+  u16(static_cast<uint16_t>(node.port));
+  f64(node.coords.first);
+  f64(node.coords.second);
+  str(node.publicKey);
+  u16(static_cast<uint16_t>(node.groups.size()));
+  for (const auto &group : node.groups) {
+    str(group);
+  }
+}
+
+void WireWriter::changes(const NodeChanges &changes) {
+  u64(changes.epoch);
+  u64(changes.version);
+  u8(changes.full ? 1 : 0);
+  u32(static_cast<uint32_t>(changes.nodes.size()));
+  for (const auto &node : changes.nodes) {
+    this->node(node);
+  }
+  u32(static_cast<uint32_t>(changes.removed.size()));
+  for (const auto &name : changes.removed) {
+    str(name);
+  }
+}
+
+std::string WireWriter::release() {
+  std::string result;
+  result.swap(out);
+  return result;
+}
+
+bool WireReader::take(void *value, size_t size) {
+  if (!pos || static_cast<size_t>(end - pos) < size) {
+    pos = nullptr;
+    return false;
+  }
+  std::memcpy(value, pos, size);
+  pos += size;
+  return true;
+}
+
+bool WireReader::u8(uint8_t &value) { return take(&value, sizeof(value)); }
+
+bool WireReader::u16(uint16_t &value) {
+  if (!take(&value, sizeof(value))) {
+    return false;
+  }
+  value = ntohs(value);
+  return true;
+}
+
+bool WireReader::u32(uint32_t &value) {
+  if (!take(&value, sizeof(value))) {
+    return false;
+  }
+  value = ntohl(value);
+  return true;
+}
+
+bool WireReader::u64(uint64_t &value) {
+  if (!take(&value, sizeof(value))) {
+    return false;
+  }
+  value = hostToNetwork64(value);
+  return true;
+}
+
+bool WireReader::f64(double &value) {
+  uint64_t bits;
+  if (!u64(bits)) {
+    return false;
+  }
+  std::memcpy(&value, &bits, sizeof(value));
+  return true;
+}
+
+bool WireReader::str(std::string &value) {
+  uint16_t length;
+  return u16(length) && bytes(value, length);
+}
+
+bool WireReader::bytes(std::string &value, size_t size) {
+  if (!pos || static_cast<size_t>(end - pos) < size) {
+    pos = nullptr;
+    return false;
+  }
+  value.assign(pos, size);
+  pos += size;
+  return true;
+}
+
+bool WireReader::node(NodeInfo &node) {
+  uint16_t port = 0;
+  uint16_t groups = 0;
+  str(node.type);
+  str(node.name);
+  str(node.ip);
+  u16(port);
+  f64(node.coords.first);
+  f64(node.coords.second);
+  str(node.publicKey);
+  u16(groups);
+  node.port = port;
+  node.groups.resize(groups);
+  for (auto &group : node.groups) {
+    str(group);
+  }
+  return ok();
+}
+
+bool WireReader::changes(NodeChanges &changes) {
+  uint8_t full = 0;
+  uint32_t count = 0;
+  u64(changes.epoch);
+  u64(changes.version);
+  u8(full);
+  changes.full = full != 0;
+
+  u32(count);
+  for (uint32_t i = 0; i < count && ok(); i++) {
+    NodeInfo node{};
+    this->node(node);
+    changes.nodes.push_back(std::move(node));
+  }
+
+  count = 0;
+  u32(count);
+  for (uint32_t i = 0; i < count && ok(); i++) {
+    std::string name;
+    str(name);
+    changes.removed.push_back(std::move(name));
+  }
+  return ok();
+}
+
+std::string registryFrameHeader(uint8_t code, size_t payloadSize) {
+  uint32_t length = htonl(static_cast<uint32_t>(payloadSize + 1));
+  std::string header(reinterpret_cast<const char *>(&length), sizeof(length));
+  header.push_back(static_cast<char>(code));
+  return header;
+}
+
+bool registryFrameSize(const std::string &data, size_t pos, size_t &size) {
+  size = 0;
+  if (data.size() - pos < REGISTRY_FRAME_HEADER) {
+    return true;
+  }
+
+  uint32_t length;
+  std::memcpy(&length, data.data() + pos, sizeof(length));
+  length = ntohl(length);
+  if (length == 0 || length > REGISTRY_MAX_FRAME) {
+    return false;
+  }
+  if (data.size() - pos >= length + 4) {
+    size = length + 4;
+  }
+  return true;
+}
@@ -0,0 +1,112 @@
+#ifndef REGISTRY_PROTOCOL_H
+#define REGISTRY_PROTOCOL_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct NodeInfo {
+  std::string type;
+  std::string name;
+  std::string ip;
+  std::pair<double, double> coords;
+  int port;
+  std::string publicKey;
+  std::vector<std::string> groups; // Anycast groups the node answers for
+  uint64_t version;                // Store version of its last change
+};
+
+// What changed after some store version. When the removals since then are
+// no longer all retained, full is set and nodes holds every live node.
+struct NodeChanges {
+  uint64_t epoch = 0;
+  uint64_t version = 0; // Version the changes bring a reader up to
+  bool full = false;
+  std::vector<NodeInfo> nodes;
+  std::vector<std::string> removed;
+};
+
+// Binary registry protocol, spoken on the same port as the JSON one. A
+// client opens the connection with REGISTRY_MAGIC, then sends frames
+//   u32 length | u8 op | payload
+// and gets one frame back for each, in order
+//   u32 length | u8 status | payload
+// where length counts the bytes after itself. Integers are in network
+// order, strings are a u16 length and the bytes. The magic is a malformed
+// HTTP request line, so a JSON-only registry answers it with a 400.
+constexpr char REGISTRY_MAGIC[] = "NXR1\r\n";
+constexpr size_t REGISTRY_MAGIC_SIZE = 6;
+constexpr size_t REGISTRY_FRAME_HEADER = 5; // Length and op or status
+constexpr uint32_t REGISTRY_MAX_FRAME = 1 << 20;
+
+enum class RegistryOp : uint8_t {
+  REGISTER,       // node -> nothing
+  MOVE,           // name, x, y -> nothing
+  DEREGISTER,     // name -> nothing
+  LIST,           // epoch, since, u32 wait ms -> changes
+  GET_PUBLIC_KEY, // name -> key
+  RENEW,          // name -> nothing, NOT_FOUND once the lease ran out
+  // u32 count, then count times u8 op, u32 length, payload of a REGISTER,
+  // MOVE, DEREGISTER or RENEW -> u32 count, then a u8 status for each
+  BATCH,
+  NEAR,    // x, y, radius -> u32 count, then nodes nearest first
+  NEAREST, // x, y, u32 k -> u32 count, then nodes nearest first
+};
+
+enum class RegistryStatus : uint8_t { OK, NOT_FOUND, BAD_REQUEST };
+
+// Appends fields to a frame payload.
+class WireWriter {
+public:
+  void u8(uint8_t value) { out.push_back(static_cast<char>(value)); }
+  void u16(uint16_t value);
+  void u32(uint32_t value);
+  void u64(uint64_t value);
+  void f64(double value);
+  void str(const std::string &value);
+  void bytes(const std::string &value) { out += value; } // No length
+  void node(const NodeInfo &node);
+  void changes(const NodeChanges &changes);
+
+  // The payload written so far; the writer is left empty
+  std::string release();
+
+private:
+  std::string out;
+};
+
+// Reads fields from a frame payload. A read past the end fails and leaves
+// the reader failed, so a run of reads only needs one check at the end.
+class WireReader {
+public:
+  WireReader(const char *data, size_t size) : pos(data), end(data + size) {}
+
+  bool u8(uint8_t &value);
+  bool u16(uint16_t &value);
+  bool u32(uint32_t &value);
+  bool u64(uint64_t &value);
+  bool f64(double &value);
+  bool str(std::string &value);
+  bool bytes(std::string &value, size_t size);
+  bool node(NodeInfo &node);
+  bool changes(NodeChanges &changes);
+
+  bool ok() const { return pos != nullptr; }
+  bool done() const { return pos == end; }
+
+private:
+  const char *pos;
+  const char *end;
+
+  bool take(void *value, size_t size);
+};
+
+// Header (length and op or status) of a frame carrying payloadSize bytes
+std::string registryFrameHeader(uint8_t code, size_t payloadSize);
+
+// Size of the frame starting at data[pos], or 0 while it is incomplete.
+// Returns false if the frame is larger than REGISTRY_MAX_FRAME.
+bool registryFrameSize(const std::string &data, size_t pos, size_t &size);
+
+#endif // REGISTRY_PROTOCOL_H
@@ -0,0 +1,39 @@
+#ifndef ROUTING_MODE_H
+#define ROUTING_MODE_H
+
+#include <string>
+
+class RoutingMode {
+public:
+  // FLAT: every node routes over the full topology.
+  // AREA: detailed routes inside the surrounding areas, area summaries beyond.
+  // GEO: greedy geographic forwarding, no routing table.
+  enum Mode { FLAT, AREA, GEO, UNKNOWN };
+
+  // Convert enum to string for better readability
+  static std::string toString(Mode mode) {
+    switch (mode) {
+    case FLAT:
+      return "flat";
+    case AREA:
+      return "area";
+    case GEO:
+      return "geo";
+    default:
+      return "unknown";
+    }
+  }
+
+  // Convert string to enum for parsing
+  static Mode fromString(const std::string &modeStr) {
+    if (modeStr == "flat")
+      return FLAT;
+    if (modeStr == "area")
+      return AREA;
+    if (modeStr == "geo")
+      return GEO;
+    return UNKNOWN;
+  }
+};
+
+#endif // ROUTING_MODE_H
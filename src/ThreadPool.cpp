@@ -0,0 +1,68 @@
+#include "ThreadPool.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <exception>
+
+ThreadPool::ThreadPool(unsigned threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() { stop(); }
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    tasks.push_back(std::move(task));
+  }
+  tasksReady.notify_one();
+}
+
+size_t ThreadPool::queued() const {
+  std::lock_guard<std::mutex> lock(tasksMutex);
+  return tasks.size();
+}
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    stopping = true;
+  }
+  tasksReady.notify_all();
+
+  for (auto &worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+void ThreadPool::run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasksMutex);
+      tasksReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return; // Stopping and drained
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    // A failing task must not take the worker, and the process, with it
+    try {
+      task();
+    } catch (const std::exception &e) {
+      logger.log(LogLevel::ERROR,
+                 "Worker task failed: " + std::string(e.what()));
+    } catch (...) {
+      logger.log(LogLevel::ERROR, "Worker task failed.");
+    }
+  }
+}
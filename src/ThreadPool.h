@@ -0,0 +1,37 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a shared task queue.
+class ThreadPool {
+public:
+  // 0 threads means one per hardware thread
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+  // Tasks waiting for a free worker
+  size_t queued() const;
+  // Finishes the queued tasks and joins the workers
+  void stop();
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  mutable std::mutex tasksMutex;
+  std::condition_variable tasksReady;
+  bool stopping = false;
+
+  void run();
+};
+
+#endif // THREAD_POOL_H
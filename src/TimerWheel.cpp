@@ -0,0 +1,80 @@
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+void TimerWheel::schedule(const std::string &key, uint64_t tick) {
+  tick = std::max(tick, current + 1);
+  auto result = deadlines.emplace(key, Deadline{tick, tick});
+  if (result.second) {
+    place(key, tick);
+    return;
+  }
+
+  Deadline &deadline = result.first->second;
+  deadline.tick = tick;
+  // Later deadlines wait for the entry already on the wheel
+  if (tick < deadline.placed) {
+    deadline.placed = tick;
+    place(key, tick);
+  }
+}
+
+void TimerWheel::place(const std::string &key, uint64_t tick) {
+  // Beyond the top level the entry fires early and is placed again
+  uint64_t horizon =
+      current + (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+  if (tick >= horizon) {
+    tick = horizon - 1;
+    deadlines[key].placed = tick;
+  }
+
+  uint64_t delta = tick - current;
+  unsigned level = 0;
+  while (level + 1 < TIMER_WHEEL_LEVELS &&
+         delta >= (1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  unsigned slot = (tick >> (TIMER_WHEEL_BITS * level)) & (SLOTS - 1);
+  slots[level][slot].emplace_back(key, tick);
+}
+
+std::vector<std::string> TimerWheel::advance(uint64_t tick) {
+  std::vector<std::string> expired;
+  while (current < tick) {
+    current++;
+
+    // Entering a new span of a level brings its slot down a level or more,
+    // top level first so entries can fall through to the slot firing now
+    for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      uint64_t span = 1ull << (TIMER_WHEEL_BITS * level);
+      if (current % span != 0) {
+        continue;
+      }
+      std::vector<Entry> entries;
+      entries.swap(slots[level][(current / span) & (SLOTS - 1)]);
+      for (const auto &entry : entries) {
+        auto it = deadlines.find(entry.first);
+        if (it != deadlines.end() && it->second.placed == entry.second) {
+          place(entry.first, entry.second);
+        }
+      }
+    }
+
+    std::vector<Entry> entries;
+    entries.swap(slots[0][current & (SLOTS - 1)]);
+    for (const auto &entry : entries) {
+      auto it = deadlines.find(entry.first);
+      if (it == deadlines.end() || it->second.placed != entry.second) {
+        continue; // Cancelled, or placed again earlier
+      }
+      if (it->second.tick > current) {
+        it->second.placed = it->second.tick;
+        place(entry.first, it->second.tick);
+      } else {
+        expired.push_back(entry.first);
+        deadlines.erase(it);
+      }
+    }
+  }
+  return expired;
+}
@@ -0,0 +1,51 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+constexpr unsigned TIMER_WHEEL_BITS = 6; // 64 slots per level
+constexpr unsigned TIMER_WHEEL_LEVELS = 4;
+
+// Hierarchical timing wheel of named deadlines, in caller-defined ticks.
+// Level L holds deadlines up to 64^(L+1) ticks away, one slot per 64^L
+// ticks, and its slots are cascaded down as the wheel reaches them. Moving
+// a deadline later only records it; the entry is placed again when its old
+// slot comes up, so renewals cost O(1) and each tick touches only the one
+// slot it fires. Not thread-safe.
+class TimerWheel {
+public:
+  explicit TimerWheel(uint64_t now = 0) : current(now) {}
+
+  // Sets key to expire at tick, or next tick if that has passed
+  void schedule(const std::string &key, uint64_t tick);
+  void cancel(const std::string &key) { deadlines.erase(key); }
+  bool scheduled(const std::string &key) const {
+    return deadlines.count(key) != 0;
+  }
+  size_t size() const { return deadlines.size(); }
+
+  // Moves the wheel up to tick and returns the keys that expired
+  std::vector<std::string> advance(uint64_t tick);
+
+private:
+  static constexpr unsigned SLOTS = 1u << TIMER_WHEEL_BITS;
+
+  struct Deadline {
+    uint64_t tick;   // When the key expires
+    uint64_t placed; // Tick of its live wheel entry; others are stale
+  };
+  using Entry = std::pair<std::string, uint64_t>; // Key and placed tick
+
+  std::array<std::array<std::vector<Entry>, SLOTS>, TIMER_WHEEL_LEVELS> slots;
+  std::unordered_map<std::string, Deadline> deadlines;
+  uint64_t current; // Last tick fired
+
+  void place(const std::string &key, uint64_t tick);
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,165 @@
+#include "HttpParser.h"
+
+#include <gtest/gtest.h>
+
+// Feeds data one byte at a time, as a slow client would send it
+static HttpParser::Result parseByteByByte(HttpParser &parser,
+                                          const std::string &data,
+                                          size_t &pos) {
+  std::string received;
+  HttpParser::Result result = HttpParser::NEED_MORE;
+  for (char c : data) {
+    received += c;
+    result = parser.parse(received, pos);
+    if (result != HttpParser::NEED_MORE) {
+      break;
+    }
+  }
+  return result;
+}
+
+TEST(HttpParser, ParsesContentLengthBody) {
+  std::string data = "POST /nodes HTTP/1.1\r\n"
+                     "Host: registry\r\n"
+                     "Content-Type:  application/json \r\n"
+                     "Content-Length: 17\r\n"
+                     "\r\n"
+                     "{\"action\":\"list\"}";
+  HttpParser parser;
+  size_t pos = 0;
+
+  ASSERT_EQ(parser.parse(data, pos), HttpParser::DONE);
+  EXPECT_EQ(pos, data.size());
+  const HttpRequest &request = parser.request();
+  EXPECT_EQ(request.method, "POST");
+  EXPECT_EQ(request.target, "/nodes");
+  EXPECT_EQ(request.version, "HTTP/1.1");
+  EXPECT_EQ(request.header("content-type"), "application/json");
+  EXPECT_EQ(request.header("missing"), "");
+  EXPECT_EQ(request.body, "{\"action\":\"list\"}");
+  EXPECT_TRUE(request.keepAlive);
+}
+
+TEST(HttpParser, ParsesRequestSplitAnywhere) {
+  std::string data = "POST / HTTP/1.1\r\n"
+                     "Content-Length: 5\r\n"
+                     "\r\n"
+                     "hello";
+  HttpParser parser;
+  size_t pos = 0;
+
+  ASSERT_EQ(parseByteByByte(parser, data, pos), HttpParser::DONE);
+  EXPECT_EQ(parser.request().body, "hello");
+}
+
+TEST(HttpParser, ParsesChunkedBody) {
+  std::string data = "POST / HTTP/1.1\r\n"
+                     "Transfer-Encoding: gzip, Chunked\r\n"
+                     "\r\n"
+                     "5;name=value\r\nhello\r\n"
+                     "1\r\n \r\n"
+                     "A\r\n0123456789\r\n"
+                     "0\r\n"
+                     "Expires: never\r\n"
+                     "\r\n";
+  HttpParser parser;
+  size_t pos = 0;
+
+  ASSERT_EQ(parseByteByByte(parser, data, pos), HttpParser::DONE);
+  EXPECT_EQ(pos, data.size());
+  EXPECT_EQ(parser.request().body, "hello 0123456789");
+  // Trailers do not become headers
+  EXPECT_EQ(parser.request().header("expires"), "");
+}
+
+TEST(HttpParser, RejectsMalformedChunks) {
+  const char *const bodies[] = {
+      "zz\r\nhello\r\n0\r\n\r\n", // Size is not hex
+      "5\r\nhelloXX0\r\n\r\n",    // No CRLF after the data
+  };
+  for (const char *body : bodies) {
+    std::string data = std::string("POST / HTTP/1.1\r\n"
+                                   "Transfer-Encoding: chunked\r\n\r\n") +
+                       body;
+    HttpParser parser;
+    size_t pos = 0;
+    EXPECT_EQ(parser.parse(data, pos), HttpParser::BAD) << body;
+  }
+}
+
+TEST(HttpParser, ParsesPipelinedRequests) {
+  std::string data = "GET /a HTTP/1.1\r\n\r\n"
+                     "\r\n"
+                     "POST /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nok";
+  HttpParser parser;
+  size_t pos = 0;
+
+  ASSERT_EQ(parser.parse(data, pos), HttpParser::DONE);
+  EXPECT_EQ(parser.request().target, "/a");
+  EXPECT_EQ(parser.request().body, "");
+
+  parser.reset();
+  ASSERT_EQ(parser.parse(data, pos), HttpParser::DONE);
+  EXPECT_EQ(parser.request().target, "/b");
+  EXPECT_EQ(parser.request().body, "ok");
+  EXPECT_EQ(pos, data.size());
+}
+
+TEST(HttpParser, FollowsConnectionHeader) {
+  struct Case {
+    const char *request;
+    bool keepAlive;
+  };
+  const Case cases[] = {
+      {"GET / HTTP/1.1\r\n\r\n", true},
+      {"GET / HTTP/1.1\r\nConnection: Close\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", true},
+  };
+  for (const Case &test : cases) {
+    HttpParser parser;
+    size_t pos = 0;
+    ASSERT_EQ(parser.parse(test.request, pos), HttpParser::DONE);
+    EXPECT_EQ(parser.request().keepAlive, test.keepAlive) << test.request;
+  }
+}
+
+TEST(HttpParser, RejectsMalformedHeaders) {
+  const char *const requests[] = {
+      "GET /\r\n\r\n",                                    // No version
+      "GET / FTP/1.0\r\n\r\n",                            // Not HTTP
+      "GET / HTTP/1.1\r\nNo colon here\r\n\r\n",          // Bad header
+      "POST / HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n", // Bad length
+  };
+  for (const char *request : requests) {
+    HttpParser parser;
+    size_t pos = 0;
+    EXPECT_EQ(parser.parse(request, pos), HttpParser::BAD) << request;
+  }
+}
+
+TEST(HttpParser, LimitsHeaderSize) {
+  // One endless line
+  std::string line = "GET /" + std::string(HTTP_MAX_HEADER_SIZE, 'a');
+  HttpParser parser;
+  size_t pos = 0;
+  EXPECT_EQ(parser.parse(line, pos), HttpParser::BAD);
+
+  // Many short lines
+  std::string headers = "GET / HTTP/1.1\r\n";
+  while (headers.size() <= HTTP_MAX_HEADER_SIZE) {
+    headers += "X-Filler: 0123456789012345678901234567890123456789\r\n";
+  }
+  parser.reset();
+  pos = 0;
+  EXPECT_EQ(parser.parse(headers, pos), HttpParser::BAD);
+
+  // Just under the limit is fine
+  std::string fits = "GET / HTTP/1.1\r\nX-Filler: ";
+  fits += std::string(HTTP_MAX_HEADER_SIZE - fits.size() - 4, 'a');
+  fits += "\r\n\r\n";
+  ASSERT_EQ(fits.size(), HTTP_MAX_HEADER_SIZE);
+  parser.reset();
+  pos = 0;
+  EXPECT_EQ(parser.parse(fits, pos), HttpParser::DONE);
+}
@@ -0,0 +1,154 @@
+#include "LinkMonitor.h"
+#include "LinkState.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+
+static LinkStateAdvertisement makeLsa(const std::string &name,
+                                      uint32_t sequence) {
+  LinkStateAdvertisement lsa{name,       NodeType::SATELLITE, "127.0.0.1",
+                             5000,       {10, 20},            sequence,
+                             LSA_MAX_TTL};
+  return lsa;
+}
+
+static std::vector<std::string> sorted(std::vector<std::string> names) {
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+TEST(LinkState, RoundTripsThroughPayload) {
+  LinkStateAdvertisement lsa = makeLsa("S1", 42);
+  lsa.ttl = 3;
+  lsa.links = {{"S2", 100}, {"G1", 250}};
+  lsa.groups = {"downlink"};
+
+  LinkStateAdvertisement parsed;
+  ASSERT_TRUE(LinkStateAdvertisement::deserialize(lsa.serialize(), parsed));
+  EXPECT_EQ(parsed.name, "S1");
+  EXPECT_EQ(parsed.type, NodeType::SATELLITE);
+  EXPECT_EQ(parsed.ip, "127.0.0.1");
+  EXPECT_EQ(parsed.port, 5000);
+  EXPECT_EQ(parsed.coords, std::make_pair(10.0, 20.0));
+  EXPECT_EQ(parsed.sequence, 42u);
+  EXPECT_EQ(parsed.ttl, 3);
+  EXPECT_EQ(parsed.links, lsa.links);
+  EXPECT_EQ(parsed.groups, lsa.groups);
+}
+
+TEST(LinkState, RejectsMalformedPayloads) {
+  const char *const payloads[] = {
+      "",
+      "7 8 Satellite S1 127.0.0.1",              // Fields missing
+      "x 8 Satellite S1 127.0.0.1 5000 1 2",     // Sequence not a number
+      "7 8 Rocket S1 127.0.0.1 5000 1 2",        // Unknown type
+      "7 8 Satellite S1 127.0.0.1 port 1 2",     // Port not a number
+      "7 8 Satellite S1 127.0.0.1 5000 1 north", // Coordinate not a number
+      "7 8 Satellite S1 127.0.0.1 5000 1 2 S2",  // Link without a factor
+      "7 8 Satellite S1 127.0.0.1 5000 1 2 S2:x",
+      "7 8 Satellite S1 127.0.0.1 5000 1 2 S2:99999999999",
+      // TTLs that would let the flood run further than ours
+      "7 9 Satellite S1 127.0.0.1 5000 1 2",
+      "7 264 Satellite S1 127.0.0.1 5000 1 2",
+      "7 -1 Satellite S1 127.0.0.1 5000 1 2",
+  };
+  for (const char *payload : payloads) {
+    LinkStateAdvertisement lsa;
+    EXPECT_FALSE(LinkStateAdvertisement::deserialize(payload, lsa))
+        << payload;
+  }
+
+  LinkStateAdvertisement lsa;
+  EXPECT_TRUE(LinkStateAdvertisement::deserialize(
+      "7 8 Satellite S1 127.0.0.1 5000 1 2 S2:120 @downlink", lsa));
+}
+
+// Factors come off the wire; below 100 a link would cost less than its
+// length, and at 0 or less shortest paths break
+TEST(LinkState, ClampsLinkFactors) {
+  LinkStateAdvertisement lsa;
+  ASSERT_TRUE(LinkStateAdvertisement::deserialize(
+      "7 8 Satellite S1 127.0.0.1 5000 1 2 S2:0 S3:-50 S4:99 S5:150 "
+      "S6:2000000000",
+      lsa));
+  std::vector<std::pair<std::string, int>> expected = {
+      {"S2", 100}, {"S3", 100}, {"S4", 100}, {"S5", 150},
+      {"S6", LINK_MAX_FACTOR}};
+  EXPECT_EQ(lsa.links, expected);
+}
+
+TEST(LinkState, OnlyNewerSequencesAreStored) {
+  LinkStateDatabase lsdb;
+  EXPECT_TRUE(lsdb.update(makeLsa("S1", 5)));
+
+  // Duplicates and stale copies are dropped, which is what ends a flood
+  LinkStateAdvertisement stale = makeLsa("S1", 4);
+  stale.coords = {99, 99};
+  EXPECT_FALSE(lsdb.update(stale));
+  EXPECT_FALSE(lsdb.update(makeLsa("S1", 5)));
+  ASSERT_EQ(lsdb.entries().size(), 1u);
+  EXPECT_EQ(lsdb.entries()[0].sequence, 5u);
+  EXPECT_EQ(lsdb.entries()[0].coords, std::make_pair(10.0, 20.0));
+
+  LinkStateAdvertisement newer = makeLsa("S1", 6);
+  newer.coords = {30, 40};
+  EXPECT_TRUE(lsdb.update(newer));
+  EXPECT_EQ(lsdb.entries()[0].coords, std::make_pair(30.0, 40.0));
+
+  // Origins are ordered independently
+  EXPECT_TRUE(lsdb.update(makeLsa("S2", 1)));
+  EXPECT_EQ(lsdb.entries().size(), 2u);
+}
+
+TEST(LinkState, UnrefreshedEntriesExpire) {
+  LinkStateDatabase lsdb;
+  lsdb.update(makeLsa("S1", 1));
+  lsdb.update(makeLsa("S2", 1));
+
+  EXPECT_TRUE(lsdb.expire(std::chrono::seconds(LSA_MAX_AGE)).empty());
+  EXPECT_EQ(lsdb.entries().size(), 2u);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  lsdb.update(makeLsa("S2", 2)); // Refreshed, so younger than a second
+  EXPECT_EQ(lsdb.expire(std::chrono::seconds(1)),
+            std::vector<std::string>{"S1"});
+  ASSERT_EQ(lsdb.entries().size(), 1u);
+  EXPECT_EQ(lsdb.entries()[0].name, "S2");
+
+  // An expired origin is heard again from its next advertisement on
+  EXPECT_TRUE(lsdb.update(makeLsa("S1", 1)));
+}
+
+TEST(LinkState, SeededEntriesLastUntilRemoved) {
+  LinkStateDatabase lsdb;
+  lsdb.seed(makeLsa("S1", 0));
+  lsdb.seed(makeLsa("S2", 0));
+  lsdb.update(makeLsa("S3", 1));
+  EXPECT_EQ(sorted(lsdb.seededNames()), (std::vector<std::string>{"S1", "S2"}));
+
+  // A flooded advertisement replaces the seed but keeps it pinned
+  LinkStateAdvertisement flooded = makeLsa("S2", 9);
+  flooded.coords = {50, 60};
+  EXPECT_TRUE(lsdb.update(flooded));
+  // and seeding again does not roll it back
+  lsdb.seed(makeLsa("S2", 0));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(lsdb.expire(std::chrono::seconds(0)),
+            std::vector<std::string>{"S3"});
+  EXPECT_EQ(lsdb.entries().size(), 2u);
+  for (const auto &lsa : lsdb.entries()) {
+    if (lsa.name == "S2") {
+      EXPECT_EQ(lsa.sequence, 9u);
+      EXPECT_EQ(lsa.coords, std::make_pair(50.0, 60.0));
+    }
+  }
+
+  // Only the registry dropping a node removes it
+  lsdb.remove("S1");
+  EXPECT_EQ(lsdb.seededNames(), std::vector<std::string>{"S2"});
+  lsdb.remove("S2");
+  EXPECT_TRUE(lsdb.entries().empty());
+}
@@ -0,0 +1,340 @@
+#include "Logger.h"
+#include "NetworkManager.h"
+#include "Node.h"
+#include "Packet.hpp"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <map>
+#include <set>
+
+static const long long NO_LINK = LONG_LONG_MAX;
+
+// Routing over topologies given link by link rather than derived from
+// positions, and geographic forwarding over placed nodes. Node i is named Ni
+// and listens on port BASE_PORT + i.
+class NetworkManagerTest : public ::testing::Test {
+protected:
+  static const int BASE_PORT = 6000;
+  NetworkManager manager{"http://127.0.0.1:1"};
+
+  void SetUp() override { logger.setLogLevel(LogLevel::WARNING); }
+
+  static std::string nameOf(int node) { return "N" + std::to_string(node); }
+
+  static int nodeAt(const sockaddr_in &addr) {
+    return ntohs(addr.sin_port) - BASE_PORT;
+  }
+
+  // n nodes without any link
+  static matrix unlinked(int n) {
+    matrix topology(n, std::vector<long long>(n, NO_LINK));
+    for (int i = 0; i < n; i++) {
+      topology[i][i] = 0;
+    }
+    return topology;
+  }
+
+  static void link(matrix &topology, int a, int b, long long weight) {
+    topology[a][b] = weight;
+    topology[b][a] = weight;
+  }
+
+  // Adds a node per row of topology and routes from self over it
+  void routeOver(const matrix &topology, int self = 0) {
+    for (int i = manager.nodes.size(); i < topology.size(); i++) {
+      manager.addNode(std::make_shared<Node>(
+          NodeType::SATELLITE, nameOf(i), "127.0.0.1", BASE_PORT + i,
+          std::make_pair(static_cast<double>(i), 0.0), manager));
+    }
+    manager.members.clear();
+    for (int i = 0; i < topology.size(); i++) {
+      manager.members.push_back(i);
+    }
+    manager.topology = topology;
+    manager.route(self);
+    manager.summarizeAreas(self);
+    manager.publishSnapshot();
+  }
+
+  // Drops the nodes of an earlier routeOver
+  void clearNodes() { manager.nodes.clear(); }
+
+  int nextHop(int dest, size_t flow) const {
+    sockaddr_in addr{};
+    if (!manager.getNextHopAddress(nameOf(dest), addr, flow)) {
+      return -1;
+    }
+    return nodeAt(addr);
+  }
+
+  // N0 reaches N4 through N1 and N2 at cost 20, through N3 at 22 (the edge of
+  // the 10% tolerance) and through N6 at 23. N5 is one step away but no
+  // closer to N4 than N0 is.
+  static matrix diamond() {
+    matrix topology = unlinked(7);
+    link(topology, 0, 1, 10);
+    link(topology, 1, 4, 10);
+    link(topology, 0, 2, 10);
+    link(topology, 2, 4, 10);
+    link(topology, 0, 3, 10);
+    link(topology, 3, 4, 12);
+    link(topology, 0, 5, 1);
+    link(topology, 5, 4, 20);
+    link(topology, 0, 6, 10);
+    link(topology, 6, 4, 13);
+    return topology;
+  }
+
+  // Adds node i at positions[i], to route in mode by position
+  void place(const std::vector<std::pair<double, double>> &positions,
+             RoutingMode::Mode mode) {
+    for (int i = 0; i < positions.size(); i++) {
+      manager.addNode(std::make_shared<Node>(NodeType::SATELLITE, nameOf(i),
+                                             "127.0.0.1", BASE_PORT + i,
+                                             positions[i], manager));
+    }
+    manager.setRoutingMode(mode);
+  }
+
+  void setGroups(int node, const std::vector<std::string> &groups) {
+    manager.nodes[node]->setGroups(groups);
+  }
+
+  void routeFrom(int self) { manager.updateRoutingTable(manager.nodes[self]); }
+
+  // Where node forwards pkt by position having received it from prev, -1
+  // for none
+  int geoHop(int node, int prev, Packet &pkt) {
+    routeFrom(node);
+    sockaddr_in from{}, addr{};
+    from.sin_family = AF_INET;
+    from.sin_port = htons(BASE_PORT + prev);
+    inet_pton(AF_INET, "127.0.0.1", &from.sin_addr);
+    if (!manager.getGeographicNextHop(pkt, prev < 0 ? nullptr : &from,
+                                      addr)) {
+      return -1;
+    }
+    return nodeAt(addr);
+  }
+
+  std::set<int> nextHops(int dest) const {
+    std::set<int> hops;
+    for (size_t flow = 0; flow < 16; flow++) {
+      hops.insert(nextHop(dest, flow));
+    }
+    return hops;
+  }
+};
+
+TEST_F(NetworkManagerTest, AcceptsNearEqualDownstreamPaths) {
+  routeOver(diamond());
+
+  EXPECT_EQ(nextHops(4), (std::set<int>{1, 2, 3}));
+  EXPECT_EQ(manager.getSnapshot()->cost[4], 20);
+  // Direct links have no alternate within the tolerance
+  for (int dest : {1, 2, 3, 5, 6}) {
+    EXPECT_EQ(nextHops(dest), std::set<int>{dest}) << nameOf(dest);
+  }
+}
+
+TEST_F(NetworkManagerTest, KeepsAtMostEcmpMaxPaths) {
+  matrix topology = unlinked(ECMP_MAX_PATHS + 3);
+  int dest = ECMP_MAX_PATHS + 2;
+  for (int via = 1; via <= ECMP_MAX_PATHS + 1; via++) {
+    link(topology, 0, via, 10);
+    link(topology, via, dest, 10);
+  }
+  routeOver(topology);
+
+  EXPECT_EQ(manager.getSnapshot()->pathsTo[dest].size(),
+            static_cast<size_t>(ECMP_MAX_PATHS));
+  EXPECT_EQ(nextHops(dest).size(), static_cast<size_t>(ECMP_MAX_PATHS));
+}
+
+TEST_F(NetworkManagerTest, SpreadsFlowsOverPaths) {
+  routeOver(diamond());
+
+  std::map<int, int> flowsPerHop;
+  for (size_t flow = 0; flow < 300; flow++) {
+    int hop = nextHop(4, flow);
+    flowsPerHop[hop]++;
+    // A flow stays on its path, so its packets are not reordered
+    EXPECT_EQ(nextHop(4, flow), hop);
+  }
+  ASSERT_EQ(flowsPerHop.size(), 3u);
+  for (const auto &entry : flowsPerHop) {
+    EXPECT_EQ(entry.second, 100) << nameOf(entry.first);
+  }
+}
+
+TEST_F(NetworkManagerTest, SourceRoutesAreLoopFree) {
+  // A 4x4 grid of equal links, full of equal-cost paths, plus the diamond
+  // topology's detours
+  const int side = 4;
+  matrix grid = unlinked(side * side);
+  for (int row = 0; row < side; row++) {
+    for (int col = 0; col < side; col++) {
+      int node = row * side + col;
+      if (col + 1 < side) {
+        link(grid, node, node + 1, 10);
+      }
+      if (row + 1 < side) {
+        link(grid, node, node + side, 10);
+      }
+    }
+  }
+
+  for (const matrix &topology : {grid, diamond()}) {
+    clearNodes();
+    for (int self : {0, 5}) {
+      routeOver(topology, self);
+      auto snap = manager.getSnapshot();
+      for (int dest = 0; dest < topology.size(); dest++) {
+        if (dest == self) {
+          continue;
+        }
+        for (size_t flow = 0; flow < 8; flow++) {
+          std::vector<sockaddr_in> hops;
+          ASSERT_TRUE(manager.getSourceRoute(nameOf(dest), hops, flow));
+          ASSERT_FALSE(hops.empty());
+          EXPECT_EQ(nodeAt(hops.front()), nextHop(dest, flow));
+          EXPECT_EQ(nodeAt(hops.back()), dest);
+
+          std::set<int> visited{self};
+          int at = self;
+          long long cost = 0;
+          for (const auto &hop : hops) {
+            int next = nodeAt(hop);
+            EXPECT_TRUE(visited.insert(next).second)
+                << nameOf(dest) << " flow " << flow << " revisits "
+                << nameOf(next);
+            ASSERT_NE(topology[at][next], NO_LINK);
+            cost += topology[at][next];
+            at = next;
+          }
+          EXPECT_LE(cost, snap->cost[dest] +
+                              snap->cost[dest] * ECMP_COST_TOLERANCE_PERCENT /
+                                  100);
+        }
+      }
+    }
+  }
+}
+
+// N0 and N1 share an area; N2 is two areas east of it with nothing in
+// between, and N3 two further areas on. N1 is the member nearest to both.
+TEST_F(NetworkManagerTest, AreaRoutesCrossEmptyAreas) {
+  place({{100, 500}, {900, 500}, {2100, 500}, {4100, 500}, {500, -500}},
+        RoutingMode::AREA);
+  routeFrom(0);
+
+  EXPECT_EQ(nextHop(1, 0), 1);
+  EXPECT_EQ(nextHop(4, 0), 4);
+  EXPECT_EQ(nextHop(2, 0), 1);
+  EXPECT_EQ(nextHop(3, 0), 1);
+}
+
+// N2 and N4 are both 10 away, N2 the nearer; N1 is nearer still but 30 away
+// and N3 cannot be reached at all
+TEST_F(NetworkManagerTest, GroupsResolveToCheapestMember) {
+  matrix topology = unlinked(5);
+  link(topology, 0, 1, 30);
+  link(topology, 0, 2, 10);
+  link(topology, 0, 4, 10);
+  routeOver(topology);
+  for (int node = 0; node < 5; node++) {
+    setGroups(node, {"relay"});
+  }
+  routeOver(topology);
+
+  auto target = manager.resolveTarget("relay");
+  ASSERT_NE(target, nullptr);
+  EXPECT_EQ(target->getName(), nameOf(2));
+  EXPECT_EQ(manager.resolveTarget("nobody"), nullptr);
+}
+
+TEST_F(NetworkManagerTest, NodeNamesShadowGroups) {
+  matrix topology = unlinked(4);
+  link(topology, 0, 1, 10);
+  link(topology, 0, 2, 10);
+  routeOver(topology);
+  setGroups(1, {nameOf(3)});
+  setGroups(2, {nameOf(3)});
+  routeOver(topology);
+
+  auto target = manager.resolveTarget(nameOf(3));
+  ASSERT_NE(target, nullptr);
+  EXPECT_EQ(target->getName(), nameOf(3));
+}
+
+TEST_F(NetworkManagerTest, UnreachableNodesHaveNoRoute) {
+  matrix topology = unlinked(3);
+  link(topology, 0, 1, 10);
+  routeOver(topology);
+
+  sockaddr_in addr{};
+  std::vector<sockaddr_in> hops;
+  EXPECT_FALSE(manager.getNextHopAddress(nameOf(2), addr));
+  EXPECT_FALSE(manager.getSourceRoute(nameOf(2), hops));
+  EXPECT_FALSE(manager.getNextHopAddress("nobody", addr));
+}
+
+// N0 is a local minimum: its neighbors are all further from N1 than it is.
+// The way round the void is the arc N2..N6 above it; N7 and N8 below lead
+// nowhere.
+TEST_F(NetworkManagerTest, PerimeterModeCrossesVoids) {
+  place({{0, 0},
+         {3000, 0},
+         {-200, 900},
+         {400, 1600},
+         {1300, 1900},
+         {2200, 1700},
+         {2600, 900},
+         {0, -800},
+         {-700, -300}},
+        RoutingMode::GEO);
+  Packet pkt;
+  pkt.targetX = 3000;
+  pkt.targetY = 0;
+
+  std::vector<int> path{0};
+  int prev = -1;
+  bool perimeter = false;
+  while (path.back() != 1 && path.size() <= DEFAULT_TTL) {
+    int next = geoHop(path.back(), prev, pkt);
+    ASSERT_NE(next, -1) << "stuck at " << nameOf(path.back());
+    perimeter |= pkt.forwarding == forwardMode::PERIMETER;
+    prev = path.back();
+    path.push_back(next);
+  }
+
+  EXPECT_TRUE(perimeter);
+  EXPECT_EQ(path, (std::vector<int>{0, 2, 3, 4, 5, 6, 1}));
+  EXPECT_EQ(pkt.forwarding, forwardMode::GREEDY);
+}
+
+// Perimeter walk from (0, 0) towards (1500, 0), at N0 having come from N1.
+// The next edge counterclockwise, to N2, crosses the line 33 units along,
+// so the walk moves onto the face beyond it and takes N3 instead.
+TEST_F(NetworkManagerTest, ChangesFaceWhereTheWalkCrossesTheLine) {
+  place({{-100, 600}, {-900, 600}, {100, -300}, {500, 300}, {300, 1200}},
+        RoutingMode::GEO);
+  Packet pkt;
+  pkt.forwarding = forwardMode::PERIMETER;
+  pkt.targetX = 1500;
+  pkt.targetY = 0;
+  pkt.entryX = pkt.faceX = 0;
+  pkt.entryY = pkt.faceY = 0;
+
+  EXPECT_EQ(geoHop(0, 1, pkt), 3);
+  EXPECT_EQ(pkt.forwarding, forwardMode::PERIMETER);
+  EXPECT_EQ(pkt.faceX, 33);
+  EXPECT_EQ(pkt.faceY, 0);
+
+  // Already past that crossing, the walk stays on its face
+  pkt.faceX = 100;
+  EXPECT_EQ(geoHop(0, 1, pkt), 2);
+  EXPECT_EQ(pkt.faceX, 100);
+}
@@ -0,0 +1,196 @@
+#include "NodeStore.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+static NodeInfo makeNode(const std::string &name,
+                         const std::pair<double, double> &coords) {
+  NodeInfo node{};
+  node.type = "GROUND";
+  node.name = name;
+  node.ip = "127.0.0.1";
+  node.port = 5000;
+  node.coords = coords;
+  return node;
+}
+
+static std::set<std::string> namesOf(const std::vector<NodeInfo> &nodes) {
+  std::set<std::string> names;
+  for (const auto &node : nodes) {
+    names.insert(node.name);
+  }
+  return names;
+}
+
+static double distance2(const NodeInfo &node,
+                        const std::pair<double, double> &center) {
+  double dx = node.coords.first - center.first;
+  double dy = node.coords.second - center.second;
+  return dx * dx + dy * dy;
+}
+
+TEST(NodeStore, ChangesSinceReturnsOnlyLaterChanges) {
+  NodeStore store;
+  store.upsert(makeNode("a", {0, 0}));
+  store.upsert(makeNode("b", {1, 1}));
+  store.upsert(makeNode("c", {2, 2}));
+
+  NodeChanges first = store.changesSince(0, 0);
+  EXPECT_TRUE(first.full);
+  EXPECT_EQ(first.epoch, store.epoch());
+  EXPECT_EQ(namesOf(first.nodes), (std::set<std::string>{"a", "b", "c"}));
+
+  store.move("a", {10, 10});
+  store.remove("b");
+  store.upsert(makeNode("d", {3, 3}));
+
+  NodeChanges delta = store.changesSince(first.epoch, first.version);
+  EXPECT_FALSE(delta.full);
+  EXPECT_EQ(delta.version, store.currentVersion());
+  EXPECT_EQ(namesOf(delta.nodes), (std::set<std::string>{"a", "d"}));
+  EXPECT_EQ(delta.removed, std::vector<std::string>{"b"});
+
+  NodeChanges none = store.changesSince(delta.epoch, delta.version);
+  EXPECT_FALSE(none.full);
+  EXPECT_TRUE(none.nodes.empty());
+  EXPECT_TRUE(none.removed.empty());
+}
+
+TEST(NodeStore, ForeignEpochOrVersionGetsEverything) {
+  NodeStore store;
+  store.upsert(makeNode("a", {0, 0}));
+  store.upsert(makeNode("b", {1, 1}));
+  store.remove("b");
+  uint64_t version = store.currentVersion();
+
+  NodeChanges otherRun = store.changesSince(store.epoch() + 1, version);
+  EXPECT_TRUE(otherRun.full);
+  EXPECT_EQ(namesOf(otherRun.nodes), std::set<std::string>{"a"});
+  EXPECT_TRUE(otherRun.removed.empty());
+
+  NodeChanges future = store.changesSince(store.epoch(), version + 10);
+  EXPECT_TRUE(future.full);
+  EXPECT_EQ(namesOf(future.nodes), std::set<std::string>{"a"});
+}
+
+TEST(NodeStore, DroppedRemovalsForceFullList) {
+  NodeStore store;
+  store.upsert(makeNode("kept", {0, 0}));
+  uint64_t since = store.currentVersion();
+
+  // More removals than all shards keep, so some shard drops one
+  size_t count = NODE_STORE_SHARDS * NODE_STORE_TOMBSTONES + 1;
+  for (size_t i = 0; i < count; i++) {
+    store.upsert(makeNode("gone" + std::to_string(i), {0, 0}));
+    store.remove("gone" + std::to_string(i));
+  }
+
+  NodeChanges changes = store.changesSince(store.epoch(), since);
+  EXPECT_TRUE(changes.full);
+  EXPECT_EQ(namesOf(changes.nodes), std::set<std::string>{"kept"});
+  EXPECT_TRUE(changes.removed.empty());
+}
+
+TEST(NodeStore, WithinIncludesTheBoundary) {
+  NodeStore store;
+  store.upsert(makeNode("center", {-250, 250}));
+  store.upsert(makeNode("edge", {-250, 350}));
+  store.upsert(makeNode("outside", {-250, 350.5}));
+  store.upsert(makeNode("far", {1e8, -1e8}));
+
+  std::vector<NodeInfo> found = store.within({-250, 250}, 100);
+  ASSERT_EQ(found.size(), 2u);
+  EXPECT_EQ(found[0].name, "center");
+  EXPECT_EQ(found[1].name, "edge");
+
+  EXPECT_EQ(namesOf(store.within({-250, 250}, 0)),
+            std::set<std::string>{"center"});
+  EXPECT_TRUE(store.within({5000, 5000}, 10).empty());
+}
+
+TEST(NodeStore, NearestHandlesSmallAndLargeK) {
+  NodeStore store;
+  store.upsert(makeNode("a", {0, 0}));
+  store.upsert(makeNode("b", {3000, 0}));
+  store.upsert(makeNode("c", {-1e7, 0}));
+
+  EXPECT_TRUE(store.nearest({0, 0}, 0).empty());
+  std::vector<NodeInfo> all = store.nearest({2000, 0}, 10);
+  ASSERT_EQ(all.size(), 3u);
+  EXPECT_EQ(all[0].name, "b");
+  EXPECT_EQ(all[1].name, "a");
+  EXPECT_EQ(all[2].name, "c");
+}
+
+// Positions past the grid share its edge cells instead of overflowing
+TEST(NodeStore, FindsNodesBeyondTheGrid) {
+  NodeStore store;
+  store.upsert(makeNode("lost", {1e300, -1e300}));
+  store.upsert(makeNode("home", {0, 0}));
+
+  EXPECT_EQ(namesOf(store.within({1e300, -1e300}, 1)),
+            std::set<std::string>{"lost"});
+  std::vector<NodeInfo> found = store.nearest({1e300, -1e300}, 1);
+  ASSERT_EQ(found.size(), 1u);
+  EXPECT_EQ(found[0].name, "lost");
+
+  store.move("lost", {-1e300, 1e300});
+  EXPECT_TRUE(store.within({1e300, -1e300}, 1).empty());
+  EXPECT_EQ(store.nearest({0, 0}, 2).size(), 2u);
+}
+
+// Queries on a store churned by moves and removals against a scan of every
+// node
+TEST(NodeStore, SpatialQueriesMatchFullScan) {
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> spread(-20000, 20000);
+  NodeStore store;
+  for (int i = 0; i < 3000; i++) {
+    std::pair<double, double> coords{spread(rng), spread(rng)};
+    if (i % 7 == 0) {
+      coords = {spread(rng) / 100, spread(rng) / 100}; // A dense cluster
+    }
+    store.upsert(makeNode("n" + std::to_string(i), coords));
+  }
+  for (int i = 0; i < 1000; i++) {
+    store.move("n" + std::to_string(rng() % 3000), {spread(rng), spread(rng)});
+    store.remove("n" + std::to_string(rng() % 3000));
+  }
+  std::vector<NodeInfo> all = store.snapshot();
+
+  for (int query = 0; query < 100; query++) {
+    std::pair<double, double> center{spread(rng) * 1.5, spread(rng) * 1.5};
+    const double radii[] = {50, 1500, 100000};
+    double radius = radii[query % 3];
+    const size_t ks[] = {1, 10, 500, 10000};
+    size_t k = ks[query % 4];
+
+    std::vector<double> inside;
+    for (const auto &node : all) {
+      if (distance2(node, center) <= radius * radius) {
+        inside.push_back(distance2(node, center));
+      }
+    }
+    std::sort(inside.begin(), inside.end());
+    std::vector<double> found;
+    for (const auto &node : store.within(center, radius)) {
+      found.push_back(distance2(node, center));
+    }
+    EXPECT_EQ(found, inside) << "within " << radius;
+
+    std::vector<double> closest;
+    for (const auto &node : all) {
+      closest.push_back(distance2(node, center));
+    }
+    std::sort(closest.begin(), closest.end());
+    closest.resize(std::min(k, closest.size()));
+    std::vector<double> nearest;
+    for (const auto &node : store.nearest(center, k)) {
+      nearest.push_back(distance2(node, center));
+    }
+    EXPECT_EQ(nearest, closest) << "nearest " << k;
+  }
+}
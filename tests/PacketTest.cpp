@@ -0,0 +1,119 @@
+#include "Packet.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+
+// Offset of routeLength: version, source and target address and port,
+// type, fragment number and count
+constexpr size_t ROUTE_LENGTH_OFFSET = 1 + 4 + 2 + 4 + 2 + 1 + 2 + 2;
+
+static std::unique_ptr<Packet> routedPacket() {
+  std::unique_ptr<Packet> pkt(new Packet(0x7F000001, 5000, 0x7F000002, 5002,
+                                         packetType::TEXT));
+  pkt->fragmentNumber = 1;
+  pkt->fragmentCount = 3;
+  pkt->forwarding = forwardMode::PERIMETER;
+  pkt->targetX = -120;
+  pkt->targetY = 4500;
+  pkt->entryX = 7;
+  pkt->entryY = -8;
+  pkt->faceX = 30;
+  pkt->faceY = -40;
+  pkt->setSourceRoute(
+      {{0x0A000001, 6001}, {0x0A000002, 6002}, {0x0A000003, 6003}});
+  pkt->setPayload("hello-world");
+  pkt->computeCRC();
+  return pkt;
+}
+
+TEST(Packet, SourceRouteSurvivesTheWire) {
+  auto sent = routedPacket();
+  uint32_t address;
+  uint16_t port;
+  ASSERT_TRUE(sent->popNextHop(address, port));
+  sent->computeCRC();
+
+  std::unique_ptr<Packet> received(new Packet());
+  ASSERT_TRUE(Packet::deserialize(sent->serialize(), *received));
+
+  EXPECT_EQ(received->sAddress, 0x7F000001u);
+  EXPECT_EQ(received->sPort, 5000);
+  EXPECT_EQ(received->tAddress, 0x7F000002u);
+  EXPECT_EQ(received->tPort, 5002);
+  EXPECT_EQ(received->type, packetType::TEXT);
+  EXPECT_EQ(received->fragmentNumber, 1);
+  EXPECT_EQ(received->fragmentCount, 3);
+  EXPECT_EQ(received->forwarding, forwardMode::PERIMETER);
+  EXPECT_EQ(received->targetX, -120);
+  EXPECT_EQ(received->targetY, 4500);
+  EXPECT_EQ(received->entryX, 7);
+  EXPECT_EQ(received->entryY, -8);
+  EXPECT_EQ(received->faceX, 30);
+  EXPECT_EQ(received->faceY, -40);
+  EXPECT_EQ(received->payload(), "hello-world");
+
+  // The relay picks up where the sender left off
+  ASSERT_EQ(received->routeLength, 3);
+  ASSERT_EQ(received->routeIndex, 1);
+  ASSERT_TRUE(received->popNextHop(address, port));
+  EXPECT_EQ(address, 0x0A000002u);
+  EXPECT_EQ(port, 6002);
+  ASSERT_TRUE(received->popNextHop(address, port));
+  EXPECT_EQ(address, 0x0A000003u);
+  EXPECT_EQ(port, 6003);
+  EXPECT_FALSE(received->popNextHop(address, port));
+}
+
+TEST(Packet, RejectsTruncatedBuffers) {
+  std::vector<uint8_t> buffer = routedPacket()->serialize();
+  std::unique_ptr<Packet> received(new Packet());
+
+  for (size_t size = 0; size < buffer.size(); size++) {
+    std::vector<uint8_t> truncated(buffer.begin(), buffer.begin() + size);
+    EXPECT_FALSE(Packet::deserialize(truncated, *received)) << size;
+  }
+}
+
+TEST(Packet, RejectsDamagedBuffers) {
+  std::vector<uint8_t> buffer = routedPacket()->serialize();
+  std::unique_ptr<Packet> received(new Packet());
+
+  buffer[buffer.size() - 10] ^= 0x01;
+  EXPECT_FALSE(Packet::deserialize(buffer, *received));
+}
+
+TEST(Packet, RejectsOtherVersions) {
+  auto sent = routedPacket();
+  sent->version = PKT_VERSION + 1;
+  sent->computeCRC();
+  std::unique_ptr<Packet> received(new Packet());
+
+  EXPECT_FALSE(Packet::deserialize(sent->serialize(), *received));
+}
+
+TEST(Packet, RejectsOverlongSourceRoute) {
+  std::vector<uint8_t> buffer = routedPacket()->serialize();
+  std::unique_ptr<Packet> received(new Packet());
+
+  ASSERT_EQ(buffer[ROUTE_LENGTH_OFFSET], 3);
+  buffer[ROUTE_LENGTH_OFFSET] = MAX_SOURCE_ROUTE_HOPS + 1;
+  EXPECT_FALSE(Packet::deserialize(buffer, *received));
+}
+
+TEST(Packet, SurvivesRandomDatagrams) {
+  std::mt19937 rng(7);
+  std::unique_ptr<Packet> received(new Packet());
+
+  for (int i = 0; i < 2000; i++) {
+    std::vector<uint8_t> buffer(rng() % 300);
+    for (auto &byte : buffer) {
+      byte = static_cast<uint8_t>(rng());
+    }
+    if (!buffer.empty()) {
+      buffer[0] = PKT_VERSION;
+    }
+    EXPECT_FALSE(Packet::deserialize(buffer, *received));
+  }
+}
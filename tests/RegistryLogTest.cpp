@@ -0,0 +1,182 @@
+#include "RegistryLog.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class RegistryLogTest : public ::testing::Test {
+protected:
+  std::string directory;
+
+  void SetUp() override {
+    char name[] = "/tmp/registry_log_testXXXXXX";
+    ASSERT_NE(mkdtemp(name), nullptr);
+    directory = name;
+  }
+
+  void TearDown() override {
+    for (const char *file : {"registry.log", "registry.log.old",
+                             "registry.snapshot", "registry.snapshot.tmp"}) {
+      unlink(path(file).c_str());
+    }
+    rmdir(directory.c_str());
+  }
+
+  std::string path(const char *file) const { return directory + "/" + file; }
+
+  static NodeInfo makeNode(const std::string &name, double x) {
+    NodeInfo node{};
+    node.type = "SATELLITE";
+    node.name = name;
+    node.ip = "127.0.0.1";
+    node.port = 5000;
+    node.coords = {x, -x};
+    node.groups = {"relays"};
+    return node;
+  }
+
+  // Opens the directory into a fresh store, as a restarted registry does
+  void recover(NodeStore &store) {
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+  }
+
+  off_t fileSize(const char *file) const {
+    struct stat info {};
+    return stat(path(file).c_str(), &info) == 0 ? info.st_size : -1;
+  }
+};
+
+TEST_F(RegistryLogTest, ReplaysEveryKindOfRecord) {
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    store.upsert(makeNode("a", 1));
+    store.upsert(makeNode("b", 2));
+    store.move("a", {10, 20});
+    store.remove("b");
+    log.sync();
+  }
+
+  NodeStore store;
+  recover(store);
+  NodeInfo node;
+  ASSERT_TRUE(store.find("a", node));
+  EXPECT_EQ(node.coords, std::make_pair(10.0, 20.0));
+  EXPECT_EQ(node.groups, std::vector<std::string>{"relays"});
+  EXPECT_FALSE(store.contains("b"));
+  EXPECT_EQ(store.size(), 1u);
+}
+
+TEST_F(RegistryLogTest, TornTailIsDroppedAndLaterRecordsSurvive) {
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    store.upsert(makeNode("a", 1));
+    store.upsert(makeNode("torn", 2));
+    log.sync();
+  }
+  // A crash in the middle of the last append
+  ASSERT_EQ(truncate(path("registry.log").c_str(),
+                     fileSize("registry.log") - 3),
+            0);
+
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    EXPECT_TRUE(store.contains("a"));
+    EXPECT_FALSE(store.contains("torn"));
+    // The torn bytes must not hide what is appended after recovery
+    store.upsert(makeNode("c", 3));
+    log.sync();
+  }
+
+  NodeStore store;
+  recover(store);
+  EXPECT_TRUE(store.contains("a"));
+  EXPECT_TRUE(store.contains("c"));
+  EXPECT_FALSE(store.contains("torn"));
+}
+
+TEST_F(RegistryLogTest, CorruptRecordEndsReplay) {
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    store.upsert(makeNode("a", 1));
+    store.upsert(makeNode("garbled", 2));
+    log.sync();
+  }
+  // Flip a byte inside the last record's payload
+  off_t size = fileSize("registry.log");
+  std::fstream file(path("registry.log"),
+                    std::ios::in | std::ios::out | std::ios::binary);
+  file.seekg(size - 5);
+  char byte = static_cast<char>(file.get());
+  file.seekp(size - 5);
+  file.put(static_cast<char>(byte ^ 0x40));
+  file.close();
+
+  NodeStore store;
+  recover(store);
+  EXPECT_TRUE(store.contains("a"));
+  EXPECT_FALSE(store.contains("garbled"));
+}
+
+TEST_F(RegistryLogTest, CompactionKeepsStateAndEmptiesLog) {
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    for (int i = 0; i < 100; i++) {
+      store.upsert(makeNode("n" + std::to_string(i), i));
+    }
+    for (int i = 0; i < 50; i++) {
+      store.remove("n" + std::to_string(i));
+    }
+    ASSERT_TRUE(log.compact(store));
+    EXPECT_EQ(fileSize("registry.log"), 0);
+    EXPECT_EQ(fileSize("registry.log.old"), -1);
+    store.move("n99", {1, 2});
+    log.sync();
+  }
+
+  NodeStore store;
+  recover(store);
+  EXPECT_EQ(store.size(), 50u);
+  EXPECT_FALSE(store.contains("n0"));
+  NodeInfo node;
+  ASSERT_TRUE(store.find("n99", node));
+  EXPECT_EQ(node.coords, std::make_pair(1.0, 2.0));
+}
+
+// A compaction cut short leaves the old log next to the new one
+TEST_F(RegistryLogTest, ReplaysLeftoverOldLog) {
+  {
+    NodeStore store;
+    RegistryLog log(directory);
+    ASSERT_TRUE(log.open(store));
+    store.upsert(makeNode("a", 1));
+    store.upsert(makeNode("b", 2));
+    log.sync();
+  }
+  ASSERT_EQ(rename(path("registry.log").c_str(),
+                   path("registry.log.old").c_str()),
+            0);
+  {
+    std::ofstream newer(path("registry.log"), std::ios::binary);
+  }
+
+  NodeStore store;
+  recover(store);
+  EXPECT_TRUE(store.contains("a"));
+  EXPECT_TRUE(store.contains("b"));
+  EXPECT_EQ(fileSize("registry.log.old"), -1);
+}
@@ -0,0 +1,179 @@
+#include "RegistryProtocol.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+
+static NodeInfo sampleNode(const std::string &name) {
+  NodeInfo node{};
+  node.type = "SATELLITE";
+  node.name = name;
+  node.ip = "127.0.0.1";
+  node.port = 5001;
+  node.coords = {-12.5, 1e6};
+  node.publicKey = "-----BEGIN PUBLIC KEY-----";
+  node.groups = {"relays", "gateways"};
+  return node;
+}
+
+static void expectSameNode(const NodeInfo &actual, const NodeInfo &expected) {
+  EXPECT_EQ(actual.type, expected.type);
+  EXPECT_EQ(actual.name, expected.name);
+  EXPECT_EQ(actual.ip, expected.ip);
+  EXPECT_EQ(actual.port, expected.port);
+  EXPECT_EQ(actual.coords, expected.coords);
+  EXPECT_EQ(actual.publicKey, expected.publicKey);
+  EXPECT_EQ(actual.groups, expected.groups);
+}
+
+TEST(Wire, WritesNetworkOrder) {
+  WireWriter writer;
+  writer.u8(0x01);
+  writer.u16(0x0203);
+  writer.u32(0x04050607);
+  writer.u64(0x08090A0B0C0D0E0Full);
+  writer.str("ab");
+
+  EXPECT_EQ(writer.release(), std::string("\x01\x02\x03\x04\x05\x06\x07\x08"
+                                          "\x09\x0A\x0B\x0C\x0D\x0E\x0F"
+                                          "\x00\x02"
+                                          "ab",
+                                          19));
+  EXPECT_EQ(writer.release(), "");
+}
+
+TEST(Wire, ScalarsRoundTrip) {
+  WireWriter writer;
+  writer.u8(255);
+  writer.u16(65535);
+  writer.u32(4000000000u);
+  writer.u64(std::numeric_limits<uint64_t>::max() - 1);
+  writer.f64(-0.125);
+  writer.f64(std::numeric_limits<double>::infinity());
+  writer.str("");
+  writer.str("name");
+  std::string payload = writer.release();
+
+  WireReader reader(payload.data(), payload.size());
+  uint8_t u8 = 0;
+  uint16_t u16 = 0;
+  uint32_t u32 = 0;
+  uint64_t u64 = 0;
+  double small = 0;
+  double infinite = 0;
+  std::string empty = "x";
+  std::string name;
+  ASSERT_TRUE(reader.u8(u8) && reader.u16(u16) && reader.u32(u32) &&
+              reader.u64(u64) && reader.f64(small) && reader.f64(infinite) &&
+              reader.str(empty) && reader.str(name));
+  EXPECT_EQ(u8, 255);
+  EXPECT_EQ(u16, 65535);
+  EXPECT_EQ(u32, 4000000000u);
+  EXPECT_EQ(u64, std::numeric_limits<uint64_t>::max() - 1);
+  EXPECT_EQ(small, -0.125);
+  EXPECT_EQ(infinite, std::numeric_limits<double>::infinity());
+  EXPECT_EQ(empty, "");
+  EXPECT_EQ(name, "name");
+  EXPECT_TRUE(reader.done());
+}
+
+TEST(Wire, CutsOverlongStrings) {
+  WireWriter writer;
+  writer.str(std::string(70000, 'a'));
+  writer.u8(7);
+  std::string payload = writer.release();
+
+  WireReader reader(payload.data(), payload.size());
+  std::string value;
+  uint8_t next = 0;
+  ASSERT_TRUE(reader.str(value));
+  EXPECT_EQ(value.size(), 65535u);
+  ASSERT_TRUE(reader.u8(next));
+  EXPECT_EQ(next, 7);
+}
+
+TEST(Wire, ChangesRoundTrip) {
+  NodeChanges changes;
+  changes.epoch = 3;
+  changes.version = 1234567890123ull;
+  changes.full = true;
+  changes.nodes = {sampleNode("S1"), sampleNode("S2")};
+  changes.nodes[1].groups.clear();
+  changes.removed = {"G1", "G2", "S9"};
+  WireWriter writer;
+  writer.changes(changes);
+  std::string payload = writer.release();
+
+  WireReader reader(payload.data(), payload.size());
+  NodeChanges received;
+  ASSERT_TRUE(reader.changes(received));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(received.epoch, 3u);
+  EXPECT_EQ(received.version, 1234567890123ull);
+  EXPECT_TRUE(received.full);
+  ASSERT_EQ(received.nodes.size(), 2u);
+  expectSameNode(received.nodes[0], changes.nodes[0]);
+  expectSameNode(received.nodes[1], changes.nodes[1]);
+  EXPECT_EQ(received.removed, changes.removed);
+}
+
+TEST(Wire, TruncatedPayloadFailsAndStaysFailed) {
+  NodeChanges changes;
+  changes.nodes = {sampleNode("S1")};
+  changes.removed = {"G1"};
+  WireWriter writer;
+  writer.changes(changes);
+  std::string payload = writer.release();
+
+  for (size_t size = 0; size < payload.size(); size++) {
+    WireReader reader(payload.data(), size);
+    NodeChanges received;
+    EXPECT_FALSE(reader.changes(received)) << size;
+    EXPECT_FALSE(reader.ok());
+    // Later reads fail too, even ones that would fit
+    uint8_t value;
+    EXPECT_FALSE(reader.u8(value));
+  }
+}
+
+TEST(Wire, HugeCountsFailInsteadOfAllocating) {
+  WireWriter writer;
+  writer.u64(1);
+  writer.u64(2);
+  writer.u8(0);
+  writer.u32(std::numeric_limits<uint32_t>::max()); // Nodes that never come
+  std::string payload = writer.release();
+
+  WireReader reader(payload.data(), payload.size());
+  NodeChanges received;
+  EXPECT_FALSE(reader.changes(received));
+  EXPECT_LE(received.nodes.size(), 1u);
+}
+
+TEST(Wire, FramesAreSizedOnceComplete) {
+  std::string frame =
+      registryFrameHeader(static_cast<uint8_t>(RegistryOp::RENEW), 3) + "abc";
+  ASSERT_EQ(frame.size(), REGISTRY_FRAME_HEADER + 3);
+  EXPECT_EQ(static_cast<uint8_t>(frame[4]),
+            static_cast<uint8_t>(RegistryOp::RENEW));
+
+  std::string stream = "xx" + frame + frame;
+  size_t size = 1;
+  for (size_t end = 2; end < 2 + frame.size(); end++) {
+    ASSERT_TRUE(registryFrameSize(stream.substr(0, end), 2, size));
+    EXPECT_EQ(size, 0u) << end;
+  }
+  ASSERT_TRUE(registryFrameSize(stream, 2, size));
+  EXPECT_EQ(size, frame.size());
+  ASSERT_TRUE(registryFrameSize(stream, 2 + size, size));
+  EXPECT_EQ(size, frame.size());
+}
+
+TEST(Wire, RejectsEmptyAndOversizedFrames) {
+  size_t size;
+  std::string empty("\0\0\0\0\0", 5);
+  EXPECT_FALSE(registryFrameSize(empty, 0, size));
+
+  std::string oversized = registryFrameHeader(0, REGISTRY_MAX_FRAME);
+  EXPECT_FALSE(registryFrameSize(oversized, 0, size));
+}
@@ -0,0 +1,788 @@
+#include "NexusRegistryServer.h"
+#include "RegistryProtocol.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <map>
+#include <regex>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+// The registry_server binary on a free loopback port, for the length of a
+// test. The requests below used to throw on a worker or reactor thread and
+// take the registry down, so every test also checks it is still running.
+class RegistryServerTest : public ::testing::Test {
+protected:
+  int port = 0;
+  pid_t server = -1;
+  std::vector<std::string> arguments; // After the port
+
+  void SetUp() override {
+    port = freePort();
+    ASSERT_GT(port, 0);
+    server = fork();
+    ASSERT_GE(server, 0);
+    if (server == 0) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      std::vector<std::string> args{REGISTRY_SERVER_PATH,
+                                    std::to_string(port)};
+      args.insert(args.end(), arguments.begin(), arguments.end());
+      std::vector<char *> argv;
+      for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+      }
+      argv.push_back(nullptr);
+      execv(REGISTRY_SERVER_PATH, argv.data());
+      _exit(127);
+    }
+
+    for (int i = 0; i < 500 && running() && !answersList(); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_TRUE(alive()) << "no registry at " REGISTRY_SERVER_PATH;
+  }
+
+  void TearDown() override {
+    if (server > 0) {
+      kill(server, SIGKILL);
+      waitpid(server, nullptr, 0);
+    }
+  }
+
+  bool running() const { return waitpid(server, nullptr, WNOHANG) == 0; }
+
+  bool answersList() const {
+    std::string reply;
+    return post(R"({"action":"list"})", reply) == 200;
+  }
+
+  bool alive() const { return running() && answersList(); }
+
+  static int freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), length) < 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0) {
+      close(fd);
+      return 0;
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+  }
+
+  int connectToServer() const {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // Sends data on a new connection and reads until the registry closes it
+  // or goes quiet
+  std::string exchange(const std::string &data) const {
+    int fd = connectToServer();
+    if (fd < 0) {
+      return "";
+    }
+    send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    std::string received;
+    char buffer[4096];
+    ssize_t bytesRead;
+    while ((bytesRead = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      received.append(buffer, bytesRead);
+    }
+    close(fd);
+    return received;
+  }
+
+  // Posts body as JSON with the given extra header lines; returns the
+  // status code, 0 if there was no answer, and the response headers
+  int post(const std::string &body, std::string &reply,
+           const std::string &headers, std::string &responseHeaders) const {
+    std::string response =
+        exchange("POST / HTTP/1.1\r\nHost: registry\r\n" + headers +
+                 "Connection: close\r\nContent-Length: " +
+                 std::to_string(body.size()) + "\r\n\r\n" + body);
+    size_t headerEnd = response.find("\r\n\r\n");
+    if (response.compare(0, 9, "HTTP/1.1 ") != 0 ||
+        headerEnd == std::string::npos) {
+      return 0;
+    }
+    responseHeaders = response.substr(0, headerEnd + 2);
+    reply = response.substr(headerEnd + 4);
+    return std::atoi(response.c_str() + 9);
+  }
+
+  int post(const std::string &body, std::string &reply) const {
+    std::string headers;
+    return post(body, reply, "", headers);
+  }
+
+  // Value of the named header, as the registry spells it
+  static std::string header(const std::string &headers,
+                            const std::string &name) {
+    size_t at = headers.find("\r\n" + name + ": ");
+    if (at == std::string::npos) {
+      return "";
+    }
+    at += name.size() + 4;
+    return headers.substr(at, headers.find("\r\n", at) - at);
+  }
+
+  // Binary protocol connection, the magic already sent
+  int openBinary() const {
+    int fd = connectToServer();
+    if (fd >= 0) {
+      send(fd, REGISTRY_MAGIC, REGISTRY_MAGIC_SIZE, MSG_NOSIGNAL);
+    }
+    return fd;
+  }
+
+  static std::string frame(RegistryOp op, const std::string &payload) {
+    return registryFrameHeader(static_cast<uint8_t>(op), payload.size()) +
+           payload;
+  }
+
+  static bool receiveAll(int fd, char *data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+      ssize_t bytesRead = recv(fd, data + received, size - received, 0);
+      if (bytesRead <= 0) {
+        return false;
+      }
+      received += bytesRead;
+    }
+    return true;
+  }
+
+  // Reads the next reply frame; returns its status, -1 if there was none
+  static int readFrame(int fd, std::string &reply) {
+    char header[REGISTRY_FRAME_HEADER];
+    if (!receiveAll(fd, header, sizeof(header))) {
+      return -1;
+    }
+    uint32_t length;
+    std::memcpy(&length, header, sizeof(length));
+    length = ntohl(length);
+    reply.resize(length > 0 ? length - 1 : 0);
+    if (length == 0 || (!reply.empty() && !receiveAll(fd, &reply[0],
+                                                      reply.size()))) {
+      return -1;
+    }
+    return static_cast<uint8_t>(header[4]);
+  }
+
+  // One binary protocol request on a new connection; returns the reply
+  // status, -1 if there was no reply
+  int call(RegistryOp op, const std::string &payload,
+           std::string &reply) const {
+    int fd = openBinary();
+    if (fd < 0) {
+      return -1;
+    }
+    std::string request = frame(op, payload);
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    int status = readFrame(fd, reply);
+    close(fd);
+    return status;
+  }
+
+  int call(RegistryOp op, const std::string &payload) const {
+    std::string reply;
+    return call(op, payload, reply);
+  }
+
+  static std::string listRequest(uint64_t epoch, uint64_t since,
+                                 uint32_t waitMs) {
+    WireWriter out;
+    out.u64(epoch);
+    out.u64(since);
+    out.u32(waitMs);
+    return out.release();
+  }
+
+  static std::string moveRequest(const std::string &name, double x, double y) {
+    WireWriter out;
+    out.str(name);
+    out.f64(x);
+    out.f64(y);
+    return out.release();
+  }
+
+  bool registerNode(const std::string &name, double x, double y) const {
+    NodeInfo node{"SATELLITE", name, "127.0.0.1", {x, y}, 5001, "key"};
+    WireWriter out;
+    out.node(node);
+    return call(RegistryOp::REGISTER, out.release()) ==
+           static_cast<int>(RegistryStatus::OK);
+  }
+
+  // Everything the registry holds, as of its current version
+  bool listAll(NodeChanges &changes) const {
+    std::string reply;
+    if (call(RegistryOp::LIST, listRequest(0, 0, 0), reply) !=
+        static_cast<int>(RegistryStatus::OK)) {
+      return false;
+    }
+    WireReader in(reply.data(), reply.size());
+    return in.changes(changes) && in.done();
+  }
+};
+
+TEST_F(RegistryServerTest, RejectsMistypedListRequests) {
+  const char *const requests[] = {
+      R"({"action":"list","since":"12"})",
+      R"({"action":"list","since":-1})",
+      R"({"action":"list","since":1.5})",
+      R"({"action":"list","since":1,"epoch":"now"})",
+      R"({"action":"list","since":1,"epoch":[1]})",
+      R"({"action":"list","since":1,"wait":{"ms":5}})",
+      R"({"action":"list","since":1,"wait":1e30})",
+  };
+  for (const char *request : requests) {
+    std::string reply;
+    EXPECT_EQ(post(request, reply), 400) << request;
+    EXPECT_EQ(reply, R"({"error": "Invalid list request"})") << request;
+  }
+  EXPECT_TRUE(alive());
+
+  std::string reply;
+  EXPECT_EQ(post(R"({"action":"list","since":1,"epoch":2,"wait":0})", reply),
+            200);
+}
+
+TEST_F(RegistryServerTest, RejectsMalformedNodes) {
+  const char *const requests[] = {
+      R"({"action":"register","name":["S1"],"ip":"127.0.0.1","port":1})",
+      R"({"action":"register","name":"S1","ip":{},"port":1})",
+      R"({"action":"register","name":"S1","ip":"127.0.0.1","port":"1"})",
+      R"({"action":"register","name":"S1","x":"nan","y":0})",
+      R"({"action":"register","name":"S1","x":"1e999","y":0})",
+      R"({"action":"register","name":"S1","x":[1],"y":0})",
+      R"({"action":"register","name":"S1","groups":["a",7]})",
+      R"({"action":"register","name":""})",
+      R"({"action":"update","name":"S1","x":1,"y":"far"})",
+  };
+  for (const char *request : requests) {
+    std::string reply;
+    EXPECT_EQ(post(request, reply), 400) << request;
+    EXPECT_EQ(reply, R"({"error": "Invalid node"})") << request;
+  }
+  EXPECT_TRUE(alive());
+
+  // Coordinates given as text have always been accepted
+  std::string reply;
+  EXPECT_EQ(post(R"({"action":"register","name":"S1","type":"SATELLITE",)"
+                 R"("ip":"127.0.0.1","port":5001,"x":"1.5","y":2})",
+                 reply),
+            200);
+}
+
+TEST_F(RegistryServerTest, ReportsMalformedBatchEntries) {
+  std::string reply;
+  ASSERT_EQ(post(R"({"action":"batch","requests":[)"
+                 R"({"action":"register","name":"S1","ip":"127.0.0.1",)"
+                 R"("port":5001,"x":1,"y":2},)"
+                 R"({"action":"register","name":{"first":"S2"}},)"
+                 R"({"action":["renew"],"name":"S1"},)"
+                 R"({"action":"deregister","name":17},)"
+                 R"("renew S1",)"
+                 R"({"action":"update","name":"S1","x":"nan","y":0},)"
+                 R"({"action":"renew","name":"S1"},)"
+                 R"({"action":"renew","name":"S9"}]})",
+                 reply),
+            200);
+  EXPECT_EQ(reply, R"({"results":["ok","bad request","bad request",)"
+                   R"("bad request","bad request","bad request","ok",)"
+                   R"("not found"]})");
+  EXPECT_TRUE(alive());
+
+  EXPECT_EQ(post(R"({"action":"batch","requests":{"action":"renew"}})", reply),
+            200);
+  EXPECT_EQ(reply, R"({"results":[]})");
+  EXPECT_TRUE(alive());
+}
+
+TEST_F(RegistryServerTest, RejectsInvalidSpatialQueries) {
+  const char *const requests[] = {
+      R"({"action":"near","x":"1","y":0,"radius":10})",
+      R"({"action":"near","x":0,"y":0})",
+      R"({"action":"near","x":0,"y":0,"radius":-1})",
+      R"({"action":"near","x":1e300,"y":0,"radius":10})",
+      R"({"action":"near","x":0,"y":0,"radius":1e300})",
+      R"({"action":"nearest","x":0,"y":null,"k":3})",
+      R"({"action":"nearest","x":0,"y":0,"k":-3})",
+      R"({"action":"nearest","x":0,"y":0,"k":"3"})",
+      R"({"action":"nearest","x":-1e300,"y":-1e300,"k":3})",
+  };
+  for (const char *request : requests) {
+    std::string reply;
+    EXPECT_EQ(post(request, reply), 400) << request;
+    EXPECT_EQ(reply, R"({"error": "Invalid spatial query"})") << request;
+  }
+  EXPECT_TRUE(alive());
+
+  std::string reply;
+  EXPECT_EQ(post(R"({"action":"near","x":0,"y":0,"radius":10})", reply), 200);
+  EXPECT_EQ(post(R"({"action":"nearest","x":0,"y":0,"k":3})", reply), 200);
+}
+
+TEST_F(RegistryServerTest, RejectsInvalidBinarySpatialQueries) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const double inf = std::numeric_limits<double>::infinity();
+  const double centers[][2] = {{nan, 0}, {0, -inf}, {1e300, 0}};
+  for (const auto &center : centers) {
+    WireWriter near;
+    near.f64(center[0]);
+    near.f64(center[1]);
+    near.f64(10);
+    EXPECT_EQ(call(RegistryOp::NEAR, near.release()),
+              static_cast<int>(RegistryStatus::BAD_REQUEST));
+
+    WireWriter nearest;
+    nearest.f64(center[0]);
+    nearest.f64(center[1]);
+    nearest.u32(3);
+    EXPECT_EQ(call(RegistryOp::NEAREST, nearest.release()),
+              static_cast<int>(RegistryStatus::BAD_REQUEST));
+  }
+  for (double radius : {nan, -1.0, inf}) {
+    WireWriter near;
+    near.f64(0);
+    near.f64(0);
+    near.f64(radius);
+    EXPECT_EQ(call(RegistryOp::NEAR, near.release()),
+              static_cast<int>(RegistryStatus::BAD_REQUEST));
+  }
+  EXPECT_TRUE(alive());
+
+  WireWriter near;
+  near.f64(0);
+  near.f64(0);
+  near.f64(10);
+  EXPECT_EQ(call(RegistryOp::NEAR, near.release()),
+            static_cast<int>(RegistryStatus::OK));
+}
+
+// Fields of the wrong type throw inside jsoncpp; the worker turns that into
+// a 400 instead of dying
+TEST_F(RegistryServerTest, SurvivesRequestsThatThrow) {
+  const char *const requests[] = {
+      R"({"action":{"a":1}})",
+      R"({"action":"deregister","name":[1]})",
+      R"({"action":"renew","name":[]})",
+      R"({"action":"getPublicKey","name":{}})",
+  };
+  for (const char *request : requests) {
+    std::string reply;
+    EXPECT_EQ(post(request, reply), 400) << request;
+    EXPECT_EQ(reply, R"({"error": "Malformed request"})") << request;
+    ASSERT_TRUE(alive()) << request;
+  }
+
+  for (const char *request : {"[1]", "\"list\"", "not json"}) {
+    std::string reply;
+    post(request, reply);
+    EXPECT_EQ(reply, R"({"error": "Invalid JSON format"})") << request;
+  }
+  EXPECT_TRUE(alive());
+}
+
+TEST_F(RegistryServerTest, SurvivesGarbageFrames) {
+  // A name said to be 5 bytes long, with 2 of them sent
+  const std::string truncated("\x00\x05"
+                              "ab",
+                              4);
+  EXPECT_EQ(call(RegistryOp::REGISTER, truncated),
+            static_cast<int>(RegistryStatus::BAD_REQUEST));
+  EXPECT_EQ(call(RegistryOp::BATCH, std::string("\xff\xff\xff\xff", 4)),
+            static_cast<int>(RegistryStatus::BAD_REQUEST));
+  call(static_cast<RegistryOp>(200), "junk");
+  EXPECT_TRUE(alive());
+}
+
+// Every reply to a held list brings its client straight back, so a burst of
+// moves must reach each watcher as one reply rather than one per move
+TEST_F(RegistryServerTest, AnswersHeldListsOncePerBurst) {
+  ASSERT_TRUE(registerNode("S1", 0, 0));
+  NodeChanges seen;
+  ASSERT_TRUE(listAll(seen));
+
+  std::vector<int> watchers;
+  for (int i = 0; i < 3; i++) {
+    int fd = openBinary();
+    ASSERT_GE(fd, 0);
+    std::string request =
+        frame(RegistryOp::LIST, listRequest(seen.epoch, seen.version, 5000));
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    watchers.push_back(fd);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  const int moves = 20;
+  int mover = openBinary();
+  ASSERT_GE(mover, 0);
+  std::string burst;
+  for (int i = 1; i <= moves; i++) {
+    burst += frame(RegistryOp::MOVE, moveRequest("S1", i, i));
+  }
+  send(mover, burst.data(), burst.size(), MSG_NOSIGNAL);
+  for (int i = 0; i < moves; i++) {
+    std::string reply;
+    ASSERT_EQ(readFrame(mover, reply), static_cast<int>(RegistryStatus::OK));
+  }
+  close(mover);
+
+  for (int fd : watchers) {
+    std::string reply;
+    ASSERT_EQ(readFrame(fd, reply), static_cast<int>(RegistryStatus::OK));
+    NodeChanges changes;
+    WireReader in(reply.data(), reply.size());
+    ASSERT_TRUE(in.changes(changes));
+    EXPECT_EQ(changes.version, seen.version + moves);
+    ASSERT_EQ(changes.nodes.size(), 1u);
+    EXPECT_EQ(changes.nodes[0].coords, std::make_pair(20.0, 20.0));
+
+    // Nothing else is owed, so the next poll is held until it times out
+    std::string request = frame(RegistryOp::LIST,
+                                listRequest(changes.epoch, changes.version,
+                                            300));
+    auto sent = std::chrono::steady_clock::now();
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    ASSERT_EQ(readFrame(fd, reply), static_cast<int>(RegistryStatus::OK));
+    EXPECT_GE(std::chrono::steady_clock::now() - sent,
+              std::chrono::milliseconds(250));
+    close(fd);
+  }
+  EXPECT_TRUE(alive());
+}
+
+static std::string gunzip(const std::string &data) {
+  z_stream stream{};
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return "";
+  }
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  std::string out;
+  char buffer[4096];
+  int result;
+  do {
+    stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.append(buffer, sizeof(buffer) - stream.avail_out);
+  } while (result == Z_OK);
+  inflateEnd(&stream);
+  return result == Z_STREAM_END ? out : "";
+}
+
+TEST_F(RegistryServerTest, TagsListsPerContentCoding) {
+  // Enough nodes for the list to be worth compressing
+  for (int i = 0; i < 20; i++) {
+    ASSERT_TRUE(registerNode("S" + std::to_string(i), i, i));
+  }
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(2 * REGISTRY_LIST_CACHE_MS));
+  const std::string list = R"({"action":"list"})";
+  const std::string gzip = "Accept-Encoding: gzip\r\n";
+
+  std::string plain, plainHeaders;
+  ASSERT_EQ(post(list, plain, "", plainHeaders), 200);
+  std::string plainTag = header(plainHeaders, "ETag");
+  ASSERT_FALSE(plainTag.empty());
+  EXPECT_EQ(header(plainHeaders, "Vary"), "Accept-Encoding");
+  EXPECT_EQ(header(plainHeaders, "Content-Encoding"), "");
+  ASSERT_GE(plain.size(), REGISTRY_GZIP_MIN_BYTES);
+
+  std::string compressed, compressedHeaders;
+  ASSERT_EQ(post(list, compressed, gzip, compressedHeaders), 200);
+  std::string compressedTag = header(compressedHeaders, "ETag");
+  EXPECT_EQ(header(compressedHeaders, "Content-Encoding"), "gzip");
+  EXPECT_EQ(header(compressedHeaders, "Vary"), "Accept-Encoding");
+  EXPECT_NE(compressedTag, plainTag);
+  EXPECT_LT(compressed.size(), plain.size());
+  EXPECT_EQ(gunzip(compressed), plain);
+
+  // Only the tag of the coding asked for matches
+  std::string reply, headers;
+  EXPECT_EQ(post(list, reply, "If-None-Match: " + plainTag + "\r\n", headers),
+            304);
+  EXPECT_EQ(reply, "");
+  EXPECT_EQ(header(headers, "ETag"), plainTag);
+  EXPECT_EQ(post(list, reply, gzip + "If-None-Match: " + compressedTag + "\r\n",
+                 headers),
+            304);
+  EXPECT_EQ(reply, "");
+  EXPECT_EQ(header(headers, "Content-Encoding"), "");
+  EXPECT_EQ(post(list, reply, gzip + "If-None-Match: " + plainTag + "\r\n",
+                 headers),
+            200);
+  EXPECT_EQ(gunzip(reply), plain);
+
+  // A change retags the list
+  ASSERT_EQ(call(RegistryOp::MOVE, moveRequest("S0", 50, 50)),
+            static_cast<int>(RegistryStatus::OK));
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(2 * REGISTRY_LIST_CACHE_MS));
+  EXPECT_EQ(post(list, reply, "If-None-Match: " + plainTag + "\r\n", headers),
+            200);
+  EXPECT_NE(header(headers, "ETag"), plainTag);
+  EXPECT_NE(reply, plain);
+}
+
+// Samples of a Prometheus text exposition, by name and labels as written,
+// after checking every line is well formed and every sample typed
+static bool parseExposition(const std::string &text,
+                            std::map<std::string, double> &samples,
+                            std::vector<std::string> &order) {
+  static const std::regex help(R"(# HELP [a-zA-Z_:][a-zA-Z0-9_:]* .+)");
+  static const std::regex type(
+      R"(# TYPE ([a-zA-Z_:][a-zA-Z0-9_:]*) (counter|gauge|histogram))");
+  static const std::regex sample(
+      R"(([a-zA-Z_:][a-zA-Z0-9_:]*)(\{([a-zA-Z_]+="[^"]*",?)*\})? )"
+      R"(([-+0-9.eE]+|\+Inf|NaN))");
+  if (text.empty() || text.back() != '\n') {
+    return false;
+  }
+
+  std::map<std::string, std::string> types;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    std::smatch match;
+    if (std::regex_match(line, match, type)) {
+      if (!types.emplace(match[1], match[2]).second) {
+        ADD_FAILURE() << "typed twice: " << line;
+        return false;
+      }
+    } else if (std::regex_match(line, help)) {
+      continue;
+    } else if (std::regex_match(line, match, sample)) {
+      std::string name = match[1];
+      std::string family = name;
+      for (const char *suffix : {"_bucket", "_sum", "_count"}) {
+        size_t at = name.rfind(suffix);
+        if (at != std::string::npos && at + strlen(suffix) == name.size() &&
+            types.count(name.substr(0, at)) &&
+            types[name.substr(0, at)] == "histogram") {
+          family = name.substr(0, at);
+        }
+      }
+      if (!types.count(family)) {
+        ADD_FAILURE() << "untyped sample: " << line;
+        return false;
+      }
+      std::string key = line.substr(0, line.rfind(' '));
+      samples[key] = std::stod(line.substr(line.rfind(' ') + 1));
+      order.push_back(key);
+    } else {
+      ADD_FAILURE() << "malformed line: " << line;
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_F(RegistryServerTest, ExportsConsistentMetrics) {
+  ASSERT_TRUE(registerNode("S1", 1, 1));
+  ASSERT_TRUE(registerNode("S2", 2, 2));
+  std::string reply;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(post(R"({"action":"list"})", reply), 200);
+  }
+
+  std::string response = exchange("GET /metrics HTTP/1.1\r\nHost: registry\r\n"
+                                  "Connection: close\r\n\r\n");
+  size_t headerEnd = response.find("\r\n\r\n");
+  ASSERT_EQ(response.compare(0, 12, "HTTP/1.1 200"), 0) << response;
+  ASSERT_NE(headerEnd, std::string::npos);
+  std::string headers = response.substr(0, headerEnd + 2);
+  EXPECT_EQ(header(headers, "Content-Type"), "text/plain; version=0.0.4");
+
+  std::map<std::string, double> samples;
+  std::vector<std::string> order;
+  ASSERT_TRUE(parseExposition(response.substr(headerEnd + 4), samples, order));
+
+  const std::string binaryRegister =
+      R"({action="register",protocol="binary"})";
+  EXPECT_EQ(samples["nexus_registry_requests_total" + binaryRegister], 2);
+  EXPECT_GE(samples[R"(nexus_registry_requests_total{action="list",)"
+                    R"(protocol="http"})"],
+            3);
+  ASSERT_TRUE(samples.count("nexus_registry_connections"));
+  EXPECT_GE(samples["nexus_registry_connections"], 1); // The scrape's own
+  EXPECT_GE(samples["nexus_registry_connections_total"],
+            samples["nexus_registry_connections"]);
+  EXPECT_EQ(samples["nexus_registry_nodes"], 2);
+
+  // Buckets of every series never drop and end at its count, which is
+  // also its request counter
+  static const std::regex bucket(
+      R"re(nexus_registry_request_duration_seconds_bucket)re"
+      R"re(\{(.*),le="([^"]*)"\})re");
+  std::map<std::string, double> last;
+  std::set<std::string> series;
+  for (const auto &key : order) {
+    std::smatch match;
+    if (!std::regex_match(key, match, bucket)) {
+      continue;
+    }
+    std::string labels = match[1];
+    auto previous = last.find(labels);
+    if (previous != last.end()) {
+      EXPECT_GE(samples[key], previous->second) << key;
+    }
+    last[labels] = samples[key];
+    if (match[2] == "+Inf") {
+      series.insert(labels);
+      std::string count =
+          "nexus_registry_request_duration_seconds_count{" + labels + "}";
+      ASSERT_TRUE(samples.count(count)) << count;
+      EXPECT_EQ(samples[key], samples[count]) << key;
+      EXPECT_EQ(samples["nexus_registry_requests_total{" + labels + "}"],
+                samples[count])
+          << labels;
+      EXPECT_TRUE(samples.count(
+          "nexus_registry_request_duration_seconds_sum{" + labels + "}"));
+    }
+  }
+  EXPECT_TRUE(series.count(R"(action="register",protocol="binary")"));
+  EXPECT_TRUE(series.count(R"(action="list",protocol="http")"));
+  EXPECT_EQ(series.size(), last.size()); // Every series has its +Inf bucket
+  EXPECT_TRUE(alive());
+}
+
+TEST_F(RegistryServerTest, AnswersPipelinedRequestsInOrder) {
+  ASSERT_TRUE(registerNode("S9", 9, 9));
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(2 * REGISTRY_LIST_CACHE_MS));
+  int fd = connectToServer();
+  ASSERT_GE(fd, 0);
+  // Three requests with telltale answers, in one write
+  const std::string bodies[] = {R"({"action":"list","since":"x"})",
+                                R"({"action":"getPublicKey","name":"S9"})",
+                                R"({"action":"list"})"};
+  std::string requests;
+  for (const auto &body : bodies) {
+    requests += "POST / HTTP/1.1\r\nHost: registry\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\n\r\n" + body;
+  }
+  ASSERT_EQ(send(fd, requests.data(), requests.size(), MSG_NOSIGNAL),
+            static_cast<ssize_t>(requests.size()));
+
+  // Responses, split by their Content-Length
+  std::string received;
+  std::vector<std::string> statuses, replies;
+  char buffer[4096];
+  while (statuses.size() < 3) {
+    size_t headerEnd = received.find("\r\n\r\n");
+    size_t length = std::string::npos;
+    if (headerEnd != std::string::npos) {
+      length = std::stoul(
+          header(received.substr(0, headerEnd + 2), "Content-Length"));
+    }
+    if (length != std::string::npos &&
+        received.size() >= headerEnd + 4 + length) {
+      statuses.push_back(received.substr(9, 3));
+      replies.push_back(received.substr(headerEnd + 4, length));
+      received.erase(0, headerEnd + 4 + length);
+      continue;
+    }
+    ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+    ASSERT_GT(bytesRead, 0) << "connection closed after " << statuses.size();
+    received.append(buffer, bytesRead);
+  }
+
+  EXPECT_EQ(statuses, (std::vector<std::string>{"400", "200", "200"}));
+  EXPECT_EQ(replies[0], R"({"error": "Invalid list request"})");
+  EXPECT_EQ(replies[1], R"({"publicKey": "key"})");
+  EXPECT_NE(replies[2].find(R"("S9")"), std::string::npos) << replies[2];
+  EXPECT_TRUE(received.empty());
+
+  // The connection stays usable afterwards
+  const std::string again = "POST / HTTP/1.1\r\nHost: registry\r\n"
+                            "Content-Length: 17\r\n\r\n"
+                            R"({"action":"list"})";
+  send(fd, again.data(), again.size(), MSG_NOSIGNAL);
+  ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+  ASSERT_GT(bytesRead, 0);
+  EXPECT_EQ(std::string(buffer, 12), "HTTP/1.1 200");
+  close(fd);
+}
+
+// Two second leases, so one runs out within the test
+class ShortLeaseRegistryServerTest : public RegistryServerTest {
+protected:
+  ShortLeaseRegistryServerTest() {
+    arguments = {std::to_string(REGISTRY_DEFAULT_BACKLOG), "0", "", "2"};
+  }
+};
+
+TEST_F(ShortLeaseRegistryServerTest, DropsNodesWhoseLeaseRunsOut) {
+  ASSERT_TRUE(registerNode("S1", 1, 1));
+  ASSERT_TRUE(registerNode("S2", 2, 2));
+  NodeChanges seen;
+  ASSERT_TRUE(listAll(seen));
+  ASSERT_EQ(seen.nodes.size(), 2u);
+
+  // S2 keeps renewing, S1 goes quiet
+  WireWriter writeS1, writeS2;
+  writeS1.str("S1");
+  writeS2.str("S2");
+  const std::string renewS1 = writeS1.release(), renewS2 = writeS2.release();
+  NodeChanges delta;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(6);
+  while (delta.removed.empty() && std::chrono::steady_clock::now() < deadline) {
+    ASSERT_EQ(call(RegistryOp::RENEW, renewS2),
+              static_cast<int>(RegistryStatus::OK));
+    std::string reply;
+    ASSERT_EQ(call(RegistryOp::LIST, listRequest(seen.epoch, seen.version, 250),
+                   reply),
+              static_cast<int>(RegistryStatus::OK));
+    WireReader in(reply.data(), reply.size());
+    ASSERT_TRUE(in.changes(delta) && in.done());
+  }
+
+  // A tombstone in the delta, not a full list
+  EXPECT_FALSE(delta.full);
+  EXPECT_EQ(delta.epoch, seen.epoch);
+  EXPECT_EQ(delta.removed, std::vector<std::string>{"S1"});
+  EXPECT_TRUE(delta.nodes.empty());
+
+  NodeChanges now;
+  ASSERT_TRUE(listAll(now));
+  ASSERT_EQ(now.nodes.size(), 1u);
+  EXPECT_EQ(now.nodes[0].name, "S2");
+  EXPECT_EQ(call(RegistryOp::RENEW, renewS1),
+            static_cast<int>(RegistryStatus::NOT_FOUND));
+}
@@ -0,0 +1,105 @@
+#include "TimerWheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+TEST(TimerWheel, FiresAtItsDeadline) {
+  TimerWheel wheel(100);
+  wheel.schedule("a", 105);
+
+  EXPECT_TRUE(wheel.advance(104).empty());
+  EXPECT_EQ(wheel.advance(105), std::vector<std::string>{"a"});
+  EXPECT_FALSE(wheel.scheduled("a"));
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimerWheel, PastDeadlineFiresOnNextTick) {
+  TimerWheel wheel(100);
+  wheel.schedule("a", 10);
+
+  EXPECT_EQ(wheel.advance(101), std::vector<std::string>{"a"});
+}
+
+TEST(TimerWheel, RenewalPostponesExpiry) {
+  TimerWheel wheel;
+  wheel.schedule("a", 10);
+  wheel.schedule("a", 5000);
+
+  EXPECT_TRUE(wheel.advance(4999).empty());
+  EXPECT_TRUE(wheel.scheduled("a"));
+  EXPECT_EQ(wheel.advance(5000), std::vector<std::string>{"a"});
+}
+
+TEST(TimerWheel, EarlierDeadlineReplacesLaterOne) {
+  TimerWheel wheel;
+  wheel.schedule("a", 5000);
+  wheel.schedule("a", 10);
+
+  EXPECT_EQ(wheel.advance(10), std::vector<std::string>{"a"});
+  EXPECT_TRUE(wheel.advance(6000).empty());
+}
+
+TEST(TimerWheel, CancelledKeyNeverFires) {
+  TimerWheel wheel;
+  wheel.schedule("a", 10);
+  wheel.cancel("a");
+
+  EXPECT_FALSE(wheel.scheduled("a"));
+  EXPECT_TRUE(wheel.advance(100).empty());
+}
+
+TEST(TimerWheel, DeadlineBeyondTopLevelFiresOnTime) {
+  uint64_t horizon = 1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  TimerWheel wheel;
+  wheel.schedule("far", horizon * 2 + 7);
+
+  EXPECT_TRUE(wheel.advance(horizon * 2 + 6).empty());
+  EXPECT_EQ(wheel.advance(horizon * 2 + 7), std::vector<std::string>{"far"});
+}
+
+// Random schedules, renewals and cancels against a plain map of deadlines
+TEST(TimerWheel, MatchesReferenceModel) {
+  std::mt19937 rng(42);
+  TimerWheel wheel;
+  std::map<std::string, uint64_t> model;
+  uint64_t now = 0;
+
+  for (int step = 0; step < 20000; step++) {
+    std::string key = "k" + std::to_string(rng() % 200);
+    switch (rng() % 4) {
+    case 0:
+    case 1: {
+      // Mostly near, sometimes a few levels up
+      uint64_t delay = rng() % 3 == 0 ? rng() % 300000 : rng() % 100;
+      wheel.schedule(key, now + delay);
+      model[key] = std::max(now + delay, now + 1);
+      break;
+    }
+    case 2:
+      wheel.cancel(key);
+      model.erase(key);
+      break;
+    default: {
+      uint64_t target = now + rng() % 500;
+      std::vector<std::string> expected;
+      for (auto it = model.begin(); it != model.end();) {
+        if (it->second <= target) {
+          expected.push_back(it->first);
+          it = model.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      std::vector<std::string> expired = wheel.advance(target);
+      std::sort(expired.begin(), expired.end());
+      ASSERT_EQ(expired, expected) << "advancing to " << target;
+      now = target;
+      break;
+    }
+    }
+    ASSERT_EQ(wheel.size(), model.size());
+  }
+}